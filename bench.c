@@ -0,0 +1,864 @@
+// in-process benchmark : drives a disk through the library calls, see
+// ramdisk.h, with no mount and no FUSE round trips, so what it measures
+// is the disk alone. every result is one JSON object per line on stdout
+//
+//   bench [-s MB] [-f MB] [-n files] [-l files] [-d depth] [-t threads,...]
+//         [-i bytes,...] [-w io,meta,readdir,lookup,fill,deep,rename,copy] [-r seed]
+//         [-o options] [-m mountpoint]
+//
+// workloads : io writes then reads, sequentially and at random, every
+// I/O size over files of -f MB split between the threads. meta creates,
+// stats and unlinks -n files, readdir lists a directory of -n entries,
+// lookup times getattr as one directory grows to -l files and fill
+// writes until the disk is full. deep does what meta does at the bottom
+// of a tree -d directories deep, once through paths as the high-level
+// daemon does and once through inode numbers as the low-level one does.
+// copy times the stores into blocks from 512 B to 1 MB per call, on a
+// disk of its own for each kind -o copy takes that the CPU has, by
+// overwriting a file of -f MB per thread that is already in place.
+// rename moves one file back and forth between two names, then a
+// directory of -n files split between the threads, which should cost the
+// same. -t runs everything once per thread count, -o takes the mount options,
+// e.g. -o blocksize=65536,dedup. with -m only deep runs, through the
+// kernel on a mounted disk, to compare the daemon's two backends
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <linux/limits.h>
+#include "ramdisk.h"
+
+#define BENCHDEFAULTSIZE 512		// MB
+#define BENCHDEFAULTFILE 128		// MB
+#define BENCHDEFAULTFILES 100000
+#define BENCHDEFAULTLOOKUP 1000000
+#define BENCHLOOKUPCALLS 200000
+#define BENCHREADDIRCALLS 20
+#define BENCHRENAMECALLS 100000
+#define BENCHFILLFILE 64		// MB per file while filling
+#define BENCHDEFAULTDEPTH 16
+#define BENCHMAXDEPTH 256
+#define BENCHMAXTHREADS 256
+#define BENCHMAXSIZES 16
+#define BENCHCOPYMIN 512
+#define BENCHCOPYMAX (1024*1024)
+
+struct latency {
+	uint64_t *ns;
+	long count;
+	long cap;
+};
+
+struct job {
+	int id;
+	int threads;
+	int io;			// bytes per call
+	long count;		// calls or files for this thread
+	long bytes;		// moved by this thread
+	long dirSize;		// lookup : files in the directory
+	int err;		// first error, -errno
+	uint64_t seed;
+	struct latency lat;
+	void (*fn)(struct job *j);
+	pthread_barrier_t *start;
+	uint64_t began,ended;	// wall clock of this thread's run
+};
+
+struct ramdisk *rd;
+struct ramdisk_config config;
+long fileMB = BENCHDEFAULTFILE;
+long storm = BENCHDEFAULTFILES;
+long lookupMax = BENCHDEFAULTLOOKUP;
+long depth = BENCHDEFAULTDEPTH;
+const char *mountDir = NULL;
+char *ioBuf;
+long ioMax;
+
+static inline uint64_t now_ns(){
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC,&t);
+	return t.tv_sec*1000000000ULL+t.tv_nsec;
+}
+
+static inline uint64_t next_rand(uint64_t *s){
+	// xorshift64*
+	*s ^= *s >> 12;
+	*s ^= *s << 25;
+	*s ^= *s >> 27;
+	return *s * 2685821657736338717ULL;
+}
+
+static void lat_add(struct latency *l,uint64_t ns){
+	if(l->count==l->cap){
+		long cap = l->cap ? l->cap*2 : 4096;
+		uint64_t *p = (uint64_t *) realloc(l->ns,cap*sizeof(uint64_t));
+		if(p==NULL)
+			return;
+		l->ns = p;
+		l->cap = cap;
+	}
+	l->ns[l->count++] = ns;
+}
+
+static int cmp_u64(const void *a,const void *b){
+	uint64_t x = *(const uint64_t *)a,y = *(const uint64_t *)b;
+	return (x>y)-(x<y);
+}
+
+static uint64_t lat_pct(const struct latency *l,double pct){
+	// the sorted samples' pct-th percentile
+	if(l->count==0)
+		return 0;
+	long i = (long)(pct/100.0*(l->count-1)+0.5);
+	return l->ns[i];
+}
+
+static void report(const char *name,struct job *jobs,int threads,int io,double seconds,const char *extra){
+	// merge the threads' samples and print one result line
+	struct latency all = { NULL, 0, 0 };
+	long bytes = 0;
+	int t,err = 0;
+	for(t=0;t<threads;t++){
+		long i;
+		for(i=0;i<jobs[t].lat.count;i++)
+			lat_add(&all,jobs[t].lat.ns[i]);
+		bytes += jobs[t].bytes;
+		if(jobs[t].err && !err)
+			err = jobs[t].err;
+	}
+	qsort(all.ns,all.count,sizeof(uint64_t),cmp_u64);
+	printf("{\"workload\":\"%s\",\"threads\":%d,\"io\":%d,\"blocksize\":%ld,\"ops\":%ld,\"seconds\":%.6f,"
+		"\"ops_per_s\":%.0f,\"mb_per_s\":%.1f,\"p50_ns\":%llu,\"p90_ns\":%llu,\"p99_ns\":%llu,\"p999_ns\":%llu,\"max_ns\":%llu,\"error\":%d%s%s}\n",
+		name,threads,io,config.blocksize,all.count,seconds,seconds>0 ? all.count/seconds : 0.0,seconds>0 ? bytes/seconds/(1024*1024) : 0.0,
+		(unsigned long long)lat_pct(&all,50),(unsigned long long)lat_pct(&all,90),(unsigned long long)lat_pct(&all,99),
+		(unsigned long long)lat_pct(&all,99.9),(unsigned long long)(all.count ? all.ns[all.count-1] : 0),
+		err,extra ? "," : "",extra ? extra : "");
+	fflush(stdout);
+	free(all.ns);
+}
+
+static void *job_thread(void *arg){
+	struct job *j = (struct job *)arg;
+	pthread_barrier_wait(j->start);
+	j->began = now_ns();
+	j->fn(j);
+	j->ended = now_ns();
+	return NULL;
+}
+
+static double run(void (*fn)(struct job *j),struct job *jobs,int threads){
+	// start the threads together, returns the wall time from the first
+	// start to the last end. each thread stamps its own, as on few CPUs
+	// the threads can be done before this one runs again
+	pthread_t tid[BENCHMAXTHREADS];
+	pthread_barrier_t start;
+	uint64_t t0 = UINT64_MAX,t1 = 0;
+	int t;
+	pthread_barrier_init(&start,NULL,threads);
+	for(t=0;t<threads;t++){
+		jobs[t].fn = fn;
+		jobs[t].start = &start;
+		jobs[t].lat.count = 0;
+		jobs[t].bytes = 0;
+		jobs[t].err = 0;
+		pthread_create(&tid[t],NULL,job_thread,&jobs[t]);
+	}
+	for(t=0;t<threads;t++){
+		pthread_join(tid[t],NULL);
+		t0 = (jobs[t].began<t0) ? jobs[t].began : t0;
+		t1 = (jobs[t].ended>t1) ? jobs[t].ended : t1;
+	}
+	pthread_barrier_destroy(&start);
+	return (t1-t0)/1e9;
+}
+
+#define TIMED(j, call) ({ uint64_t t0_ = now_ns(); long r_ = (call); lat_add(&(j)->lat,now_ns()-t0_); if((r_<0)&&!(j)->err) (j)->err = r_; r_; })
+
+static void seq_write(struct job *j,int flags){
+	char path[64];
+	long i;
+	snprintf(path,sizeof(path),"/b%d/data",j->id);
+	int fd = rd_open(rd,path,flags,0644);
+	if(fd<0){
+		j->err = fd;
+		return;
+	}
+	for(i=0;i<j->count;i++){
+		if(TIMED(j,rd_pwrite(rd,fd,ioBuf,j->io,(off_t)i*j->io))!=j->io)
+			break;
+		j->bytes += j->io;
+	}
+	rd_close(rd,fd);
+}
+
+static void job_seq_write(struct job *j){
+	seq_write(j,O_CREAT|O_TRUNC|O_WRONLY);
+}
+
+static void job_overwrite(struct job *j){
+	seq_write(j,O_WRONLY);
+}
+
+static void job_seq_read(struct job *j){
+	char path[64],*buf = (char *) malloc(j->io);
+	long i;
+	snprintf(path,sizeof(path),"/b%d/data",j->id);
+	if(buf==NULL){
+		j->err = -ENOMEM;
+		return;
+	}
+	int fd = rd_open(rd,path,O_RDONLY,0);
+	if(fd<0){
+		j->err = fd;
+		free(buf);
+		return;
+	}
+	for(i=0;i<j->count;i++){
+		if(TIMED(j,rd_pread(rd,fd,buf,j->io,(off_t)i*j->io))!=j->io)
+			break;
+		j->bytes += j->io;
+	}
+	rd_close(rd,fd);
+	free(buf);
+}
+
+static void job_rand_write(struct job *j){
+	char path[64];
+	long i;
+	snprintf(path,sizeof(path),"/b%d/data",j->id);
+	int fd = rd_open(rd,path,O_WRONLY,0);
+	if(fd<0){
+		j->err = fd;
+		return;
+	}
+	for(i=0;i<j->count;i++){
+		off_t offset = (off_t)(next_rand(&j->seed)%j->count)*j->io;
+		if(TIMED(j,rd_pwrite(rd,fd,ioBuf,j->io,offset))!=j->io)
+			break;
+		j->bytes += j->io;
+	}
+	rd_close(rd,fd);
+}
+
+static void job_rand_read(struct job *j){
+	char path[64],*buf = (char *) malloc(j->io);
+	long i;
+	snprintf(path,sizeof(path),"/b%d/data",j->id);
+	if(buf==NULL){
+		j->err = -ENOMEM;
+		return;
+	}
+	int fd = rd_open(rd,path,O_RDONLY,0);
+	if(fd<0){
+		j->err = fd;
+		free(buf);
+		return;
+	}
+	for(i=0;i<j->count;i++){
+		off_t offset = (off_t)(next_rand(&j->seed)%j->count)*j->io;
+		if(TIMED(j,rd_pread(rd,fd,buf,j->io,offset))!=j->io)
+			break;
+		j->bytes += j->io;
+	}
+	rd_close(rd,fd);
+	free(buf);
+}
+
+static int bench_create(const char *path){
+	int fd = rd_open(rd,path,O_CREAT|O_TRUNC|O_WRONLY,0644);
+	if(fd<0)
+		return fd;
+	return rd_close(rd,fd);
+}
+
+static void job_create(struct job *j){
+	char path[64];
+	long i;
+	for(i=0;i<j->count;i++){
+		snprintf(path,sizeof(path),"/b%d/f%ld",j->id,i);
+		TIMED(j,bench_create(path));
+	}
+}
+
+static void job_stat(struct job *j){
+	struct stat st;
+	char path[64];
+	long i;
+	for(i=0;i<j->count;i++){
+		snprintf(path,sizeof(path),"/b%d/f%ld",j->id,(long)(next_rand(&j->seed)%j->count));
+		TIMED(j,rd_stat(rd,path,&st));
+	}
+}
+
+static void job_unlink(struct job *j){
+	char path[64];
+	long i;
+	for(i=0;i<j->count;i++){
+		snprintf(path,sizeof(path),"/b%d/f%ld",j->id,i);
+		TIMED(j,rd_unlink(rd,path));
+	}
+}
+
+struct dirSink {
+	long entries;
+	char name[NAME_MAX+1];
+};
+
+static __attribute__((noinline)) int count_entry(void *arg,const char *name,const struct stat *st){
+	// copy the name out as the daemon's filler does, kept out of line so
+	// the listing cannot be folded into a count
+	struct dirSink *d = (struct dirSink *)arg;
+	size_t len = strlen(name);
+	memcpy(d->name,name,(len>NAME_MAX) ? NAME_MAX : len);
+	d->entries++;
+	return 0;
+}
+
+static void job_readdir(struct job *j){
+	struct dirSink d;
+	long i;
+	for(i=0;i<j->count;i++){
+		d.entries = 0;
+		TIMED(j,rd_readdir(rd,"/dir",count_entry,&d));
+		j->bytes += d.entries;
+	}
+}
+
+static void job_lookup(struct job *j){
+	struct stat st;
+	char path[64];
+	long i;
+	for(i=0;i<j->count;i++){
+		snprintf(path,sizeof(path),"/lookup/f%ld",(long)(next_rand(&j->seed)%j->dirSize));
+		TIMED(j,rd_stat(rd,path,&st));
+	}
+}
+
+static void job_fill(struct job *j){
+	// write BENCHFILLFILE MB files until the disk says ENOSPC. every block
+	// is stamped with a count of its own, or with dedup on the writes
+	// would share the first blocks and never fill the disk
+	char path[64],*buf = (char *) malloc(j->io);
+	long k,per = BENCHFILLFILE*1024L*1024/j->io,step = (j->io<config.blocksize) ? j->io : config.blocksize;
+	uint64_t stamp = (uint64_t)j->id<<48;
+	if(buf==NULL){
+		j->err = -ENOMEM;
+		return;
+	}
+	memcpy(buf,ioBuf,j->io);
+	for(k=0;!j->err;k++){
+		long i,b;
+		snprintf(path,sizeof(path),"/b%d/fill%ld",j->id,k);
+		int fd = rd_open(rd,path,O_CREAT|O_TRUNC|O_WRONLY,0644);
+		if(fd<0)
+			break;
+		j->count = k+1;
+		for(i=0;(i<per)&&!j->err;i++){
+			for(b=0;b+(long)sizeof(stamp)<=j->io;b+=step,stamp++)
+				memcpy(buf+b,&stamp,sizeof(stamp));
+			if(TIMED(j,rd_pwrite(rd,fd,buf,j->io,(off_t)i*j->io))==j->io)
+				j->bytes += j->io;
+		}
+		rd_close(rd,fd);
+	}
+	free(buf);
+}
+
+// deep : the backend the calls go through, and the directory at the
+// bottom of the tree as a path and as an inode number
+#define BACKEND_PATH 0
+#define BACKEND_INODE 1
+#define BACKEND_MOUNT 2
+#define DEEP_CREATE 0
+#define DEEP_STAT 1
+#define DEEP_UNLINK 2
+static const char *backendNames[] = { "path", "inode", "mount" };
+int deepBackend;
+char deepPath[PATH_MAX];
+rd_ino_t deepIno;
+
+static long deep_call(int op,const char *name){
+	// one operation on name in the deep directory
+	char path[sizeof(deepPath)+64];
+	struct stat st;
+	long res;
+	if(deepBackend==BACKEND_INODE){
+		switch(op){
+		case DEEP_CREATE:
+			res = rd_openat(rd,deepIno,name,O_CREAT|O_TRUNC|O_WRONLY,0644,NULL);
+			return (res<0) ? res : rd_close(rd,res);
+		case DEEP_STAT:
+			// a lookup and the forget that later follows it
+			res = rd_lookup(rd,deepIno,name,&st);
+			if(res==0)
+				rd_forget(rd,st.st_ino,1);
+			return res;
+		default:
+			return rd_unlinkat(rd,deepIno,name,0);
+		}
+	}
+	snprintf(path,sizeof(path),"%s/%s",deepPath,name);
+	if(deepBackend==BACKEND_PATH){
+		switch(op){
+		case DEEP_CREATE:
+			return bench_create(path);
+		case DEEP_STAT:
+			return rd_stat(rd,path,&st);
+		default:
+			return rd_unlink(rd,path);
+		}
+	}
+	switch(op){
+	case DEEP_CREATE:
+		res = open(path,O_CREAT|O_TRUNC|O_WRONLY,0644);
+		return (res<0) ? -errno : close(res);
+	case DEEP_STAT:
+		return stat(path,&st) ? -errno : 0;
+	default:
+		return unlink(path) ? -errno : 0;
+	}
+}
+
+static void job_deep(struct job *j,int op){
+	char name[64];
+	long i;
+	for(i=0;i<j->count;i++){
+		long f = (op==DEEP_STAT) ? (long)(next_rand(&j->seed)%j->count) : i;
+		snprintf(name,sizeof(name),"t%d_%ld",j->id,f);
+		TIMED(j,deep_call(op,name));
+	}
+}
+
+static void job_deep_create(struct job *j){
+	job_deep(j,DEEP_CREATE);
+}
+
+static void job_deep_stat(struct job *j){
+	job_deep(j,DEEP_STAT);
+}
+
+static void job_deep_unlink(struct job *j){
+	job_deep(j,DEEP_UNLINK);
+}
+
+static void bench_seq_rand(struct job *jobs,int threads,int io){
+	long t,per = fileMB*1024L*1024/threads/io;
+	if(per<1)
+		per = 1;
+	for(t=0;t<threads;t++){
+		jobs[t].io = io;
+		jobs[t].count = per;
+	}
+	report("seqwrite",jobs,threads,io,run(job_seq_write,jobs,threads),NULL);
+	report("seqread",jobs,threads,io,run(job_seq_read,jobs,threads),NULL);
+	report("randwrite",jobs,threads,io,run(job_rand_write,jobs,threads),NULL);
+	report("randread",jobs,threads,io,run(job_rand_read,jobs,threads),NULL);
+	for(t=0;t<threads;t++){
+		char path[64];
+		snprintf(path,sizeof(path),"/b%ld/data",t);
+		rd_unlink(rd,path);
+	}
+}
+
+static void bench_meta(struct job *jobs,int threads){
+	int t;
+	for(t=0;t<threads;t++){
+		jobs[t].io = 0;
+		jobs[t].count = storm/threads;
+	}
+	report("create",jobs,threads,0,run(job_create,jobs,threads),NULL);
+	report("stat",jobs,threads,0,run(job_stat,jobs,threads),NULL);
+	report("unlink",jobs,threads,0,run(job_unlink,jobs,threads),NULL);
+}
+
+static void bench_readdir(struct job *jobs,int threads){
+	char path[64],extra[64];
+	long i,entries = 0;
+	int t;
+	rd_mkdir(rd,"/dir",0755);
+	for(i=0;i<storm;i++){
+		snprintf(path,sizeof(path),"/dir/f%ld",i);
+		bench_create(path);
+	}
+	for(t=0;t<threads;t++){
+		jobs[t].io = 0;
+		jobs[t].count = BENCHREADDIRCALLS;
+	}
+	double s = run(job_readdir,jobs,threads);
+	for(t=0;t<threads;t++)
+		entries += jobs[t].bytes;
+	for(t=0;t<threads;t++)
+		jobs[t].bytes = 0;
+	snprintf(extra,sizeof(extra),"\"entries\":%ld,\"entries_per_s\":%.0f",storm,s>0 ? entries/s : 0.0);
+	report("readdir",jobs,threads,0,s,extra);
+	for(i=0;i<storm;i++){
+		snprintf(path,sizeof(path),"/dir/f%ld",i);
+		rd_unlink(rd,path);
+	}
+	rd_rmdir(rd,"/dir");
+}
+
+static void bench_lookup(struct job *jobs,int threads){
+	// getattr latency should stay flat as the directory grows
+	char path[64],extra[32];
+	long size,have = 0;
+	int t;
+	rd_mkdir(rd,"/lookup",0755);
+	for(size=10;size<=lookupMax;size*=10){
+		for(;have<size;have++){
+			snprintf(path,sizeof(path),"/lookup/f%ld",have);
+			if(bench_create(path))
+				break;
+		}
+		for(t=0;t<threads;t++){
+			jobs[t].io = 0;
+			jobs[t].count = BENCHLOOKUPCALLS/threads;
+			jobs[t].dirSize = have;
+		}
+		snprintf(extra,sizeof(extra),"\"files\":%ld",have);
+		report("lookup",jobs,threads,0,run(job_lookup,jobs,threads),extra);
+	}
+	for(size=0;size<have;size++){
+		snprintf(path,sizeof(path),"/lookup/f%ld",size);
+		rd_unlink(rd,path);
+	}
+	rd_rmdir(rd,"/lookup");
+}
+
+static void bench_fill(struct job *jobs,int threads,int io){
+	char path[64],extra[64];
+	long k;
+	int t;
+	for(t=0;t<threads;t++)
+		jobs[t].io = io;
+	struct statvfs st;
+	double s = run(job_fill,jobs,threads);
+	rd_statfs(rd,&st);
+	snprintf(extra,sizeof(extra),"\"used_pct\":%.2f",100.0*(st.f_blocks-st.f_bfree)/st.f_blocks);
+	for(t=0;t<threads;t++){
+		if(jobs[t].err==-ENOSPC)
+			jobs[t].err = 0;	// the expected end
+	}
+	report("fill",jobs,threads,io,s,extra);
+	for(t=0;t<threads;t++){
+		for(k=0;k<jobs[t].count;k++){
+			snprintf(path,sizeof(path),"/b%d/fill%ld",t,k);
+			rd_unlink(rd,path);
+		}
+	}
+}
+
+static void copy_jobs(struct job *jobs,int threads,int io){
+	int t;
+	for(t=0;t<threads;t++){
+		jobs[t].io = io;
+		jobs[t].count = fileMB*1024L*1024/threads/io;
+		if(jobs[t].count<1)
+			jobs[t].count = 1;
+	}
+}
+
+static void bench_copy(struct job *jobs,int threads,long size){
+	static const char *kinds[] = { "libc", "sse2", "avx2" };
+	static const int ios[] = { BENCHCOPYMIN, 4096, 16384, 65536, 262144, BENCHCOPYMAX };
+	struct ramdisk *first = rd;
+	char option[32],extra[32];
+	int k,i,t;
+	for(k=0;k<3;k++){
+		struct ramdisk_config c = config;
+		snprintf(option,sizeof(option),"copy=%s",kinds[k]);
+		rd_config_set(&c,option);
+		if(rd_new(&rd,size*1024*1024,NULL,&c))
+			continue;	// not on this CPU
+		rd_start(rd);
+		for(t=0;t<threads;t++){
+			snprintf(option,sizeof(option),"/b%d",t);
+			rd_mkdir(rd,option,0755);
+		}
+		// the files in place first, so no block is mapped while timed
+		copy_jobs(jobs,threads,BENCHCOPYMAX);
+		run(job_seq_write,jobs,threads);
+		snprintf(extra,sizeof(extra),"\"copy\":\"%s\"",kinds[k]);
+		for(i=0;i<(int)(sizeof(ios)/sizeof(ios[0]));i++){
+			copy_jobs(jobs,threads,ios[i]);
+			report("copywrite",jobs,threads,ios[i],run(job_overwrite,jobs,threads),extra);
+			report("copyread",jobs,threads,ios[i],run(job_seq_read,jobs,threads),extra);
+		}
+		rd_free(rd);
+	}
+	rd = first;
+}
+
+static int deep_dir(int make){
+	// make or remove the tree below /deep, from the top or the bottom
+	char path[PATH_MAX];
+	int d,res = 0;
+	for(d=0;d<=depth;d++){
+		int level = make ? d : depth-d,len = snprintf(path,sizeof(path),"%s/deep",mountDir ? mountDir : "");
+		int k;
+		for(k=1;k<=level;k++)
+			len += snprintf(path+len,sizeof(path)-len,"/d%d",k);
+		if(mountDir)
+			res = make ? mkdir(path,0755) : rmdir(path);
+		else
+			res = make ? rd_mkdir(rd,path,0755) : rd_rmdir(rd,path);
+		if(res)
+			return res;
+		if(make)
+			strcpy(deepPath,path);
+	}
+	return 0;
+}
+
+static void bench_deep(struct job *jobs,int threads){
+	rd_ino_t chain[BENCHMAXDEPTH+1];
+	char extra[64];
+	int b,t,d;
+	struct stat st;
+	if(deep_dir(1)){
+		fprintf(stderr,"cannot make the deep tree\n");
+		return;
+	}
+	if(!mountDir){
+		// hold the numbers down to the bottom as the kernel would
+		for(d=0,deepIno=RD_ROOT_INO;d<=depth;d++){
+			char name[16];
+			if(d)
+				snprintf(name,sizeof(name),"d%d",d);
+			if(rd_lookup(rd,deepIno,d ? name : "deep",&st))
+				break;
+			chain[d] = deepIno = st.st_ino;
+		}
+	}
+	for(t=0;t<threads;t++){
+		jobs[t].io = 0;
+		jobs[t].count = storm/threads;
+	}
+	for(b=mountDir ? BACKEND_MOUNT : BACKEND_PATH;b<=(mountDir ? BACKEND_MOUNT : BACKEND_INODE);b++){
+		deepBackend = b;
+		snprintf(extra,sizeof(extra),"\"backend\":\"%s\",\"depth\":%ld",backendNames[b],depth);
+		report("deep_create",jobs,threads,0,run(job_deep_create,jobs,threads),extra);
+		report("deep_stat",jobs,threads,0,run(job_deep_stat,jobs,threads),extra);
+		report("deep_unlink",jobs,threads,0,run(job_deep_unlink,jobs,threads),extra);
+	}
+	if(!mountDir){
+		for(d=0;d<=depth;d++)
+			rd_forget(rd,chain[d],1);
+	}
+	deep_dir(0);
+}
+
+static void job_rename(struct job *j){
+	// between /bN/x and /bN/y, whatever is there
+	char from[64],to[64];
+	long i;
+	for(i=0;i<j->count;i++){
+		snprintf(from,sizeof(from),"/b%d/%c",j->id,(i&1) ? 'y' : 'x');
+		snprintf(to,sizeof(to),"/b%d/%c",j->id,(i&1) ? 'x' : 'y');
+		TIMED(j,rd_rename(rd,from,to));
+	}
+}
+
+static void bench_rename(struct job *jobs,int threads){
+	char path[64],extra[32];
+	long i,per = storm/threads;
+	int t,tree;
+	for(tree=0;tree<=1;tree++){
+		for(t=0;t<threads;t++){
+			snprintf(path,sizeof(path),"/b%d/x",t);
+			if(!tree){
+				bench_create(path);
+				continue;
+			}
+			rd_mkdir(rd,path,0755);
+			for(i=0;i<per;i++){
+				snprintf(path,sizeof(path),"/b%d/x/f%ld",t,i);
+				bench_create(path);
+			}
+		}
+		for(t=0;t<threads;t++){
+			jobs[t].io = 0;
+			jobs[t].count = BENCHRENAMECALLS/threads;
+		}
+		snprintf(extra,sizeof(extra),"\"files\":%ld",tree ? per : 0L);
+		report(tree ? "rename_dir" : "rename_file",jobs,threads,0,run(job_rename,jobs,threads),extra);
+		for(t=0;t<threads;t++){
+			// an odd count of calls leaves it at y
+			char name = (jobs[t].count&1) ? 'y' : 'x';
+			for(i=0;tree && (i<per);i++){
+				snprintf(path,sizeof(path),"/b%d/%c/f%ld",t,name,i);
+				rd_unlink(rd,path);
+			}
+			snprintf(path,sizeof(path),"/b%d/%c",t,name);
+			if(tree)
+				rd_rmdir(rd,path);
+			else
+				rd_unlink(rd,path);
+		}
+	}
+}
+
+static int parse_list(const char *s,long *out,int max){
+	// comma separated positive numbers, returns how many
+	int n = 0;
+	while(*s && (n<max)){
+		char *end;
+		long v = strtol(s,&end,10);
+		if((end==s)||(v<=0))
+			return -1;
+		out[n++] = v;
+		s = (*end==',') ? end+1 : end;
+		if((*end!=',')&&(*end!='\0'))
+			return -1;
+	}
+	return n;
+}
+
+static int has_workload(const char *list,const char *name){
+	size_t len = strlen(name);
+	const char *p = list;
+	while((p = strstr(p,name))!=NULL){
+		if(((p==list)||(p[-1]==','))&&((p[len]==',')||(p[len]=='\0')))
+			return 1;
+		p += len;
+	}
+	return 0;
+}
+
+int main(int argc,char *argv[]){
+	long threadList[BENCHMAXSIZES] = { 1 },ioList[BENCHMAXSIZES] = { 4096, 65536, 1048576 };
+	int threadCount = 1,ioCount = 3,opt,i,k;
+	const char *workloads = "io,meta,readdir,lookup,fill,deep,rename,copy";
+	const char *options = NULL;
+	uint64_t seed = 1;
+	long size = BENCHDEFAULTSIZE;
+
+	while((opt = getopt(argc,argv,"s:f:n:l:d:t:i:w:r:o:m:"))!=-1){
+		switch(opt){
+		case 's': size = atol(optarg); break;
+		case 'f': fileMB = atol(optarg); break;
+		case 'n': storm = atol(optarg); break;
+		case 'l': lookupMax = atol(optarg); break;
+		case 'd': depth = atol(optarg); break;
+		case 't': threadCount = parse_list(optarg,threadList,BENCHMAXSIZES); break;
+		case 'i': ioCount = parse_list(optarg,ioList,BENCHMAXSIZES); break;
+		case 'w': workloads = optarg; break;
+		case 'r': seed = strtoull(optarg,NULL,10); break;
+		case 'o': options = optarg; break;
+		case 'm': mountDir = optarg; break;
+		default:
+			fprintf(stderr,"usage : %s [-s MB] [-f MB] [-n files] [-l files] [-d depth] [-t threads,...] [-i bytes,...] [-w io,meta,readdir,lookup,fill,deep,rename,copy] [-r seed] [-o options] [-m mountpoint]\n",argv[0]);
+			return 1;
+		}
+	}
+	if((threadCount<=0)||(ioCount<=0)||(fileMB<=0)||(storm<=0)||(lookupMax<10)||(seed==0)||(depth<0)||(depth>BENCHMAXDEPTH)){
+		fprintf(stderr,"sizes, counts and the seed must be positive, -l at least 10, -d at most %d\n",BENCHMAXDEPTH);
+		return 1;
+	}
+	for(i=0;i<threadCount;i++){
+		if(threadList[i]>BENCHMAXTHREADS){
+			fprintf(stderr,"at most %d threads\n",BENCHMAXTHREADS);
+			return 1;
+		}
+	}
+	if(mountDir){
+		// only deep, and through the kernel
+		struct statvfs vfs;
+		if(statvfs(mountDir,&vfs)){
+			fprintf(stderr,"cannot stat %s\n",mountDir);
+			return 1;
+		}
+		config.blocksize = vfs.f_bsize;
+		for(k=0;k<threadCount;k++){
+			int threads = threadList[k];
+			struct job jobs[BENCHMAXTHREADS];
+			memset(jobs,0,sizeof(jobs));
+			for(i=0;i<threads;i++){
+				jobs[i].id = i;
+				jobs[i].threads = threads;
+				jobs[i].seed = seed+i;
+			}
+			bench_deep(jobs,threads);
+			for(i=0;i<threads;i++)
+				free(jobs[i].lat.ns);
+		}
+		return 0;
+	}
+
+	// the mount options, taken and checked as the daemon takes them, with
+	// logging off unless asked for
+	rd_config_init(&config);
+	config.loglevel = 0;
+	if(options){
+		char *list = strdup(options),*save,*o;
+		for(o=strtok_r(list,",",&save);o;o=strtok_r(NULL,",",&save)){
+			if(rd_config_set(&config,o)){
+				fprintf(stderr,"bad option `%s'\n",o);
+				return 1;
+			}
+		}
+		free(list);
+	}
+	if(rd_new(&rd,size*1024*1024,NULL,&config)){
+		fprintf(stderr,"cannot set up a %ld MB disk\n",size);
+		return 1;
+	}
+	rd_start(rd);
+
+	for(i=0,ioMax=0;i<ioCount;i++)
+		ioMax = (ioList[i]>ioMax) ? ioList[i] : ioMax;
+	if(has_workload(workloads,"copy")&&(ioMax<BENCHCOPYMAX))
+		ioMax = BENCHCOPYMAX;
+	ioBuf = (char *) malloc(ioMax);
+	if(ioBuf==NULL)
+		return 1;
+	for(i=0;i<ioMax;i++)
+		ioBuf[i] = (char)next_rand(&seed);
+
+	for(k=0;k<threadCount;k++){
+		int threads = threadList[k];
+		struct job jobs[BENCHMAXTHREADS];
+		memset(jobs,0,sizeof(jobs));
+		for(i=0;i<threads;i++){
+			char path[64];
+			jobs[i].id = i;
+			jobs[i].threads = threads;
+			jobs[i].seed = seed+i;
+			snprintf(path,sizeof(path),"/b%d",i);
+			rd_mkdir(rd,path,0755);
+		}
+		if(has_workload(workloads,"io")){
+			for(i=0;i<ioCount;i++)
+				bench_seq_rand(jobs,threads,ioList[i]);
+		}
+		if(has_workload(workloads,"meta"))
+			bench_meta(jobs,threads);
+		if(has_workload(workloads,"readdir"))
+			bench_readdir(jobs,threads);
+		if(has_workload(workloads,"lookup"))
+			bench_lookup(jobs,threads);
+		if(has_workload(workloads,"fill"))
+			bench_fill(jobs,threads,ioMax);
+		if(has_workload(workloads,"deep"))
+			bench_deep(jobs,threads);
+		if(has_workload(workloads,"rename"))
+			bench_rename(jobs,threads);
+		if(has_workload(workloads,"copy"))
+			bench_copy(jobs,threads,size);
+		for(i=0;i<threads;i++){
+			char path[64];
+			free(jobs[i].lat.ns);
+			snprintf(path,sizeof(path),"/b%d",i);
+			rd_rmdir(rd,path);
+		}
+	}
+	rd_free(rd);
+	return 0;
+}
@@ -0,0 +1,693 @@
+// library checks : drives disks through the calls in ramdisk.h and
+// verifies what comes back, so the behaviour the README describes can be
+// reproduced without mounting. every check prints one line, and the exit
+// status is 1 when any of them failed, 0 otherwise
+//
+//   check [-k] [name,...]
+//
+// images are kept in a directory under /tmp, removed at the end unless -k
+// is given. the checks :
+//
+// paths : absolute paths resolve, and the errors of a path that is
+// empty, relative, or runs through or ends in a slash after a file.
+// dirs : the errors of rmdir, and a directory going once it is empty.
+// renames : with and without renameat2 flags, whole trees moving, names
+// replaced and hard links kept. hole : punched ranges read back as
+// zeros and free their blocks, and writes, truncate and fallocate stop
+// at the same largest size. replay : a child changes a disk with an
+// image and exits without unmounting, the disk it left must come back
+// from the journal, then again from the checkpoint rd_free writes.
+// reload : the same when the child unmounts. snapshot : reload through
+// a snapshot image. compress : files that go cold read back intact, and
+// one can be overwritten. ceiling : a child with compression on writes
+// twice the ceiling and exits without unmounting, all of it must come
+// back from the journal. dedup : with compress and dedup on, files that
+// share blocks and files that go cold read back intact, before and
+// after one of the sharers is overwritten. disks : disks in one process
+// count their own calls, from any thread, and an image path longer than
+// PATH_MAX is refused. notify : changes are reported to the notifier
+// unless the thread rd_serve marked made them
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <dirent.h>
+#include <sys/wait.h>
+#include <pthread.h>
+#include "ramdisk.h"
+
+#define CHECKDISK (32L*1024*1024)
+#define CHECKFILE (256*1024)
+#define CHECKTIERWAIT 20	// s for the tier to compress something
+#define CHECKFILES 8		// files in the compress check
+#define CHECKMAXSIZE ((off_t)1<<62)	// the largest file the library allows
+#define CHECKSHARED 4		// files with the same bytes in dedup
+
+struct ramdisk *rd;
+char imageDir[64];
+const char *failedCheck;
+int failures;
+
+// a failed expectation : note it and go on, the check reports once
+#define EXPECT(e) do { if(!(e)){ printf("     %s:%d : %s\n",failedCheck,__LINE__,#e); failures++; } } while(0)
+#define EXPECT_RES(call,want) do { long r_ = (call); if(r_!=(want)){ printf("     %s:%d : %s gave %ld, not %ld\n",failedCheck,__LINE__,#call,r_,(long)(want)); failures++; } } while(0)
+
+static void fill(char *buf,size_t len,uint64_t seed,off_t offset){
+	// bytes that depend on seed and offset, and compress : every 4 KB is
+	// seed and its own number, repeated
+	size_t i;
+	for(i=0;i<len;i++){
+		uint64_t at = (offset+i)>>12,word = ((offset+i)&8) ? at : seed;
+		buf[i] = (char)(word>>(8*((offset+i)&7)));
+	}
+}
+
+static int put(struct ramdisk *d,const char *path,uint64_t seed,size_t len){
+	char *buf = (char *) malloc(len);
+	int fd = rd_open(d,path,O_CREAT|O_TRUNC|O_WRONLY,0644);
+	ssize_t n = -ENOMEM;
+	if((buf!=NULL)&&(fd>=0)){
+		fill(buf,len,seed,0);
+		n = rd_pwrite(d,fd,buf,len,0);
+	}
+	if(fd>=0)
+		rd_close(d,fd);
+	free(buf);
+	return (fd<0) ? fd : (n==(ssize_t)len) ? 0 : -EIO;
+}
+
+static int same(struct ramdisk *d,const char *path,uint64_t seed,size_t len){
+	// 1 when path holds exactly what put wrote with seed
+	char *buf = (char *) malloc(len+1),*want = (char *) malloc(len);
+	int fd = rd_open(d,path,O_RDONLY,0),ok = 0;
+	if((buf!=NULL)&&(want!=NULL)&&(fd>=0)){
+		fill(want,len,seed,0);
+		ok = (rd_pread(d,fd,buf,len+1,0)==(ssize_t)len)&&!memcmp(buf,want,len);
+	}
+	if(fd>=0)
+		rd_close(d,fd);
+	free(buf);
+	free(want);
+	return ok;
+}
+
+static long ctl_value(struct ramdisk *d,const char *file,const char *key){
+	// the number after key in a control file, -1 when it is not there
+	char buf[1024],path[64];
+	snprintf(path,sizeof(path),"%s/%s",RAMDISK_CTLDIR,file);
+	int fd = rd_open(d,path,O_RDONLY,0);
+	if(fd<0)
+		return -1;
+	ssize_t n = rd_read(d,fd,buf,sizeof(buf)-1);
+	rd_close(d,fd);
+	if(n<=0)
+		return -1;
+	buf[n] = 0;
+	size_t len = strlen(key);
+	char *p;
+	for(p=buf;p && *p;p=strchr(p,'\n'),p=p ? p+1 : NULL){
+		if(!strncmp(p,key,len)&&(p[len]==' '))
+			return atol(p+len+1);
+	}
+	return -1;
+}
+
+static struct ramdisk *disk_up(const char *image,const char *options){
+	// a started disk, options comma separated as -o takes them
+	struct ramdisk_config config;
+	struct ramdisk *d;
+	rd_config_init(&config);
+	config.loglevel = 0;
+	if(options){
+		char *list = strdup(options),*save,*o;
+		for(o=strtok_r(list,",",&save);o;o=strtok_r(NULL,",",&save))
+			rd_config_set(&config,o);
+		free(list);
+	}
+	if(rd_new(&d,CHECKDISK,image,&config))
+		return NULL;
+	rd_start(d);
+	return d;
+}
+
+static void check_paths(){
+	struct stat st;
+	rd = disk_up(NULL,NULL);
+	if(rd==NULL){
+		EXPECT(rd!=NULL);
+		return;
+	}
+	EXPECT_RES(put(rd,"/file",1,10),0);
+	EXPECT_RES(rd_mkdir(rd,"/dir",0755),0);
+	EXPECT_RES(rd_stat(rd,"/file",&st),0);
+	EXPECT_RES(rd_stat(rd,"//dir//",&st),0);
+	EXPECT_RES(rd_stat(rd,"/file/",&st),-ENOTDIR);
+	EXPECT_RES(rd_stat(rd,"/file/x",&st),-ENOTDIR);
+	EXPECT_RES(rd_stat(rd,"",&st),-ENOENT);
+	EXPECT_RES(rd_stat(rd,"dir",&st),-ENOENT);
+	EXPECT_RES(rd_open(rd,"file",O_RDONLY,0),-ENOENT);
+	EXPECT_RES(rd_open(rd,"new",O_CREAT|O_WRONLY,0644),-ENOENT);
+	EXPECT_RES(rd_mkdir(rd,"/file/x",0755),-ENOTDIR);
+	EXPECT_RES(rd_mkdir(rd,"dir/x",0755),-ENOENT);
+	EXPECT_RES(rd_open(rd,"/file/x",O_CREAT|O_WRONLY,0644),-ENOTDIR);
+	EXPECT_RES(rd_open(rd,"/file/",O_CREAT|O_WRONLY,0644),-ENOTDIR);
+	EXPECT_RES(rd_open(rd,"/none/x",O_CREAT|O_WRONLY,0644),-ENOENT);
+	EXPECT_RES(rd_unlink(rd,"/file/"),-ENOTDIR);
+	EXPECT_RES(rd_stat(rd,"/file",&st),0);
+	rd_free(rd);
+}
+
+static void check_dirs(){
+	struct stat st;
+	rd = disk_up(NULL,NULL);
+	if(rd==NULL){
+		EXPECT(rd!=NULL);
+		return;
+	}
+	EXPECT_RES(put(rd,"/file",1,10),0);
+	EXPECT_RES(rd_mkdir(rd,"/d",0755),0);
+	EXPECT_RES(rd_mkdir(rd,"/d",0755),-EEXIST);
+	EXPECT_RES(put(rd,"/d/f",2,10),0);
+	EXPECT_RES(rd_rmdir(rd,"/"),-EBUSY);
+	EXPECT_RES(rd_rmdir(rd,"/none"),-ENOENT);
+	EXPECT_RES(rd_rmdir(rd,"/file"),-ENOTDIR);
+	EXPECT_RES(rd_rmdir(rd,"/d"),-ENOTEMPTY);
+	EXPECT_RES(rd_unlink(rd,"/d"),-EISDIR);
+	EXPECT_RES(rd_unlink(rd,"/d/f"),0);
+	EXPECT_RES(rd_rmdir(rd,"/d"),0);
+	EXPECT_RES(rd_stat(rd,"/d",&st),-ENOENT);
+	rd_free(rd);
+}
+
+static void check_renames(){
+	struct stat st,a,b;
+	rd = disk_up(NULL,NULL);
+	if(rd==NULL){
+		EXPECT(rd!=NULL);
+		return;
+	}
+	EXPECT_RES(rd_rename(rd,"/","/x"),-EBUSY);
+
+	// a tree moves whole and keeps its inode numbers
+	EXPECT_RES(rd_mkdir(rd,"/top",0755),0);
+	EXPECT_RES(rd_mkdir(rd,"/top/sub",0755),0);
+	EXPECT_RES(put(rd,"/top/sub/f",2,100),0);
+	EXPECT_RES(rd_stat(rd,"/top/sub/f",&a),0);
+	EXPECT_RES(rd_rename(rd,"/top","/top/sub/in"),-EINVAL);
+	EXPECT_RES(rd_rename(rd,"/top","/moved"),0);
+	EXPECT_RES(rd_stat(rd,"/top",&st),-ENOENT);
+	EXPECT_RES(rd_stat(rd,"/moved/sub/f",&b),0);
+	EXPECT(a.st_ino==b.st_ino);
+	EXPECT(same(rd,"/moved/sub/f",2,100));
+
+	// replacing : only an empty directory by a directory, a file by a file
+	EXPECT_RES(rd_mkdir(rd,"/full",0755),0);
+	EXPECT_RES(put(rd,"/full/k",3,10),0);
+	EXPECT_RES(rd_mkdir(rd,"/empty",0755),0);
+	EXPECT_RES(rd_rename(rd,"/empty","/full"),-ENOTEMPTY);
+	EXPECT_RES(rd_rename(rd,"/full/k","/empty"),-EISDIR);
+	EXPECT_RES(rd_rename(rd,"/empty","/full/k"),-ENOTDIR);
+	EXPECT_RES(rd_mkdir(rd,"/gone",0755),0);
+	EXPECT_RES(rd_rename(rd,"/gone","/empty"),0);
+	EXPECT_RES(rd_stat(rd,"/gone",&st),-ENOENT);
+	EXPECT_RES(put(rd,"/r1",4,40),0);
+	EXPECT_RES(put(rd,"/r2",5,50),0);
+	EXPECT_RES(rd_rename(rd,"/r1","/r2"),0);
+	EXPECT(same(rd,"/r2",4,40));
+
+	// a hard link keeps the file when the name it shares is replaced
+	EXPECT_RES(put(rd,"/h",6,60),0);
+	EXPECT_RES(rd_link(rd,"/h","/hl"),0);
+	EXPECT_RES(rd_rename(rd,"/h","/hl"),0);	// the same file : nothing happens
+	EXPECT_RES(rd_stat(rd,"/h",&st),0);
+	EXPECT(st.st_nlink==2);
+	EXPECT_RES(rd_rename(rd,"/r2","/h"),0);
+	EXPECT_RES(rd_stat(rd,"/hl",&st),0);
+	EXPECT(st.st_nlink==1);
+	EXPECT(same(rd,"/hl",6,60));
+
+	// renameat2 flags through the inode calls
+	EXPECT_RES(rd_mkdir(rd,"/e1",0755),0);
+	EXPECT_RES(rd_mkdir(rd,"/e2",0755),0);
+	EXPECT_RES(put(rd,"/e1/a",7,70),0);
+	EXPECT_RES(put(rd,"/e2/b",8,80),0);
+	EXPECT_RES(rd_lookup(rd,RD_ROOT_INO,"e1",&a),0);
+	EXPECT_RES(rd_lookup(rd,RD_ROOT_INO,"e2",&b),0);
+	EXPECT_RES(rd_renameat(rd,a.st_ino,"a",b.st_ino,"b",RENAME_NOREPLACE),-EEXIST);
+	EXPECT_RES(rd_renameat(rd,a.st_ino,"a",b.st_ino,"b",RENAME_NOREPLACE|RENAME_EXCHANGE),-EINVAL);
+	EXPECT_RES(rd_renameat(rd,a.st_ino,"a",b.st_ino,"none",RENAME_EXCHANGE),-ENOENT);
+	EXPECT_RES(rd_renameat(rd,a.st_ino,"a",b.st_ino,"b",RENAME_EXCHANGE),0);
+	EXPECT(same(rd,"/e1/a",8,80));
+	EXPECT(same(rd,"/e2/b",7,70));
+	EXPECT_RES(rd_renameat(rd,RD_ROOT_INO,"e1",b.st_ino,"b",RENAME_EXCHANGE),0);
+	EXPECT(same(rd,"/e1",7,70));
+	EXPECT(same(rd,"/e2/b/a",8,80));
+	EXPECT_RES(rd_renameat(rd,RD_ROOT_INO,"e2",a.st_ino,"a",RENAME_EXCHANGE),-EINVAL);	// e2 holds e1 now
+	EXPECT_RES(rd_renameat(rd,b.st_ino,"c",b.st_ino,"d",RENAME_NOREPLACE),-ENOENT);
+	EXPECT_RES(rd_renameat(rd,b.st_ino,"b",b.st_ino,"d",RENAME_NOREPLACE),0);
+	EXPECT_RES(rd_stat(rd,"/e2",&st),0);
+	EXPECT(st.st_nlink==3);
+	rd_forget(rd,a.st_ino,1);
+	rd_forget(rd,b.st_ino,1);
+	rd_free(rd);
+}
+
+static void check_hole(){
+	struct stat before,after;
+	char buf[CHECKFILE],want[CHECKFILE];
+	rd = disk_up(NULL,NULL);
+	if(rd==NULL){
+		EXPECT(rd!=NULL);
+		return;
+	}
+	EXPECT_RES(put(rd,"/holes",9,CHECKFILE),0);
+	int fd = rd_open(rd,"/holes",O_RDWR,0);
+	EXPECT(fd>=0);
+	EXPECT_RES(rd_fstat(rd,fd,&before),0);
+	EXPECT_RES(rd_fallocate(rd,fd,FALLOC_FL_PUNCH_HOLE,0,4096),-EOPNOTSUPP);
+	EXPECT_RES(rd_fallocate(rd,fd,FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE,65536,65536),0);
+	EXPECT_RES(rd_fallocate(rd,fd,FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE,1000,2000),0);
+	EXPECT_RES(rd_fstat(rd,fd,&after),0);
+	EXPECT(after.st_size==before.st_size);
+	EXPECT(after.st_blocks<before.st_blocks);
+	fill(want,CHECKFILE,9,0);
+	memset(want+65536,0,65536);
+	memset(want+1000,0,2000);
+	EXPECT_RES(rd_pread(rd,fd,buf,CHECKFILE,0),CHECKFILE);
+	EXPECT(!memcmp(buf,want,CHECKFILE));
+	// one largest size for writes, truncate and fallocate alike
+	EXPECT_RES(rd_pwrite(rd,fd,"x",1,CHECKMAXSIZE-1),1);
+	EXPECT_RES(rd_pwrite(rd,fd,"x",1,CHECKMAXSIZE),-EFBIG);
+	EXPECT_RES(rd_ftruncate(rd,fd,CHECKMAXSIZE),0);
+	EXPECT_RES(rd_ftruncate(rd,fd,CHECKMAXSIZE+1),-EFBIG);
+	EXPECT_RES(rd_fallocate(rd,fd,FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE,CHECKMAXSIZE-4096,8192),-EFBIG);
+	EXPECT_RES(rd_fstat(rd,fd,&after),0);
+	EXPECT(after.st_size==CHECKMAXSIZE);
+	rd_close(rd,fd);
+	rd_free(rd);
+}
+
+// replay : what the child leaves and what must come back
+static void replay_changes(struct ramdisk *d){
+	int fd;
+	rd_mkdir(d,"/tree",0755);
+	rd_mkdir(d,"/tree/sub",0755);
+	put(d,"/tree/sub/f",10,CHECKFILE);
+	put(d,"/tree/g",11,5000);
+	rd_rename(d,"/tree","/moved");
+	put(d,"/a",12,100);
+	put(d,"/b",13,200);
+	rd_rename(d,"/a","/b");
+	put(d,"/x",14,300);
+	put(d,"/y",15,400);
+	rd_link(d,"/x","/xl");
+	rd_unlink(d,"/x");
+	rd_renameat(d,RD_ROOT_INO,"xl",RD_ROOT_INO,"y",RENAME_EXCHANGE);
+	fd = rd_open(d,"/moved/sub/f",O_RDWR,0);
+	rd_fallocate(d,fd,FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE,0,65536);
+	rd_ftruncate(d,fd,CHECKFILE/2);
+	rd_close(d,fd);
+	put(d,"/gone",16,100);
+	rd_unlink(d,"/gone");
+}
+
+static void replay_expect(struct ramdisk *d){
+	struct stat st;
+	char buf[CHECKFILE],want[CHECKFILE];
+	EXPECT_RES(rd_stat(d,"/tree",&st),-ENOENT);
+	EXPECT(same(d,"/moved/g",11,5000));
+	EXPECT(same(d,"/b",12,100));
+	EXPECT_RES(rd_stat(d,"/a",&st),-ENOENT);
+	EXPECT(same(d,"/y",14,300));
+	EXPECT(same(d,"/xl",15,400));
+	EXPECT_RES(rd_stat(d,"/x",&st),-ENOENT);
+	EXPECT_RES(rd_stat(d,"/gone",&st),-ENOENT);
+	int fd = rd_open(d,"/moved/sub/f",O_RDONLY,0);
+	EXPECT(fd>=0);
+	fill(want,CHECKFILE/2,10,0);
+	memset(want,0,65536);
+	EXPECT_RES(rd_pread(d,fd,buf,CHECKFILE,0),CHECKFILE/2);
+	EXPECT(!memcmp(buf,want,CHECKFILE/2));
+	if(fd>=0)
+		rd_close(d,fd);
+}
+
+static void check_replay(const char *options,const char *name,int crash){
+	// with crash the child leaves without rd_free, its journal synced
+	char image[128];
+	int status;
+	snprintf(image,sizeof(image),"%s/%s.img",imageDir,name);
+	pid_t pid = fork();
+	if(pid==0){
+		struct ramdisk *d = disk_up(image,options);
+		if(d==NULL)
+			_exit(1);
+		replay_changes(d);
+		if(crash){
+			rd_sync(d);
+			_exit(0);
+		}
+		rd_free(d);
+		_exit(0);
+	}
+	EXPECT((pid>0)&&(waitpid(pid,&status,0)==pid)&&WIFEXITED(status)&&(WEXITSTATUS(status)==0));
+	rd = disk_up(image,options);
+	if(rd==NULL){
+		EXPECT(rd!=NULL);
+		return;
+	}
+	replay_expect(rd);
+	rd_free(rd);
+	rd = disk_up(image,options);
+	if(rd==NULL){
+		EXPECT(rd!=NULL);
+		return;
+	}
+	replay_expect(rd);
+	rd_free(rd);
+}
+
+static void check_compress(){
+	char path[64];
+	int i,waited;
+	rd = disk_up(NULL,"compress=1,maxsize=64");
+	if(rd==NULL){
+		EXPECT(rd!=NULL);
+		return;
+	}
+	for(i=0;i<CHECKFILES;i++){
+		snprintf(path,sizeof(path),"/t%d",i);
+		EXPECT_RES(put(rd,path,20+i,CHECKFILE),0);
+	}
+	for(waited=0;(waited<CHECKTIERWAIT*10)&&(ctl_value(rd,"compress","compressed")<=0);waited++)
+		usleep(100000);
+	EXPECT(ctl_value(rd,"compress","compressed")>0);
+	for(i=0;i<CHECKFILES;i++){
+		snprintf(path,sizeof(path),"/t%d",i);
+		EXPECT(same(rd,path,20+i,CHECKFILE));
+	}
+	EXPECT(ctl_value(rd,"compress","restored")>0);
+	EXPECT_RES(put(rd,"/t0",30,CHECKFILE),0);
+	EXPECT(same(rd,"/t0",30,CHECKFILE));
+	rd_free(rd);
+}
+
+static void check_dedup(){
+	char path[64];
+	int i,waited;
+	rd = disk_up(NULL,"dedup,compress=1,maxsize=64");
+	if(rd==NULL){
+		EXPECT(rd!=NULL);
+		return;
+	}
+	for(i=0;i<2*CHECKSHARED;i++){
+		snprintf(path,sizeof(path),"/t%d",i);
+		EXPECT_RES(put(rd,path,(i<CHECKSHARED) ? 20 : 20+i,CHECKFILE),0);
+	}
+	EXPECT(ctl_value(rd,"dedup","saved")>=(CHECKSHARED-1)*CHECKFILE/4096);
+	for(waited=0;(waited<CHECKTIERWAIT*10)&&(ctl_value(rd,"compress","compressed")<=0);waited++)
+		usleep(100000);
+	EXPECT(ctl_value(rd,"compress","compressed")>0);
+	for(i=0;i<2*CHECKSHARED;i++){
+		snprintf(path,sizeof(path),"/t%d",i);
+		EXPECT(same(rd,path,(i<CHECKSHARED) ? 20 : 20+i,CHECKFILE));
+	}
+	EXPECT(ctl_value(rd,"compress","restored")>0);
+	// the others keep their bytes when one sharer is written
+	EXPECT_RES(put(rd,"/t0",30,CHECKFILE),0);
+	EXPECT(same(rd,"/t0",30,CHECKFILE));
+	for(i=1;i<2*CHECKSHARED;i++){
+		snprintf(path,sizeof(path),"/t%d",i);
+		EXPECT(same(rd,path,(i<CHECKSHARED) ? 20 : 20+i,CHECKFILE));
+	}
+	rd_free(rd);
+}
+
+static void check_ceiling(){
+	// a journal holding more than the ceiling replays whole, the
+	// scanner compresses it again once the disk is up
+	char image[128],path[64];
+	int i,status,round;
+	const long size = 4*1024*1024,count = 2*CHECKDISK/size;
+	snprintf(image,sizeof(image),"%s/ceiling.img",imageDir);
+	pid_t pid = fork();
+	if(pid==0){
+		struct ramdisk *d = disk_up(image,"compress=1,checkpoint=0");
+		if(d==NULL)
+			_exit(1);
+		for(i=0;i<count;i++){
+			snprintf(path,sizeof(path),"/c%d",i);
+			if(put(d,path,40+i,size))
+				_exit(2);
+		}
+		rd_sync(d);
+		_exit(0);
+	}
+	EXPECT((pid>0)&&(waitpid(pid,&status,0)==pid)&&WIFEXITED(status)&&(WEXITSTATUS(status)==0));
+	for(round=0;round<2;round++){
+		rd = disk_up(image,"compress=1,checkpoint=0");
+		if(rd==NULL){
+			EXPECT(rd!=NULL);
+			return;
+		}
+		for(i=0;i<count;i++){
+			snprintf(path,sizeof(path),"/c%d",i);
+			EXPECT(same(rd,path,40+i,size));
+		}
+		rd_free(rd);
+	}
+}
+
+static void *stats_thread(void *arg){
+	// calls from a thread that is gone when the stats are read
+	struct ramdisk *d = (struct ramdisk *)arg;
+	int fd = rd_open(d,"/f",O_WRONLY,0);
+	rd_pwrite(d,fd,"x",1,0);
+	rd_pwrite(d,fd,"x",1,1);
+	rd_close(d,fd);
+	return NULL;
+}
+
+static void check_disks(){
+	struct ramdisk *a,*b,*c;
+	struct ramdisk_config config;
+	char image[PATH_MAX+16];
+	pthread_t thread;
+	int fd;
+	a = disk_up(NULL,NULL);
+	b = disk_up(NULL,NULL);
+	if((a==NULL)||(b==NULL)){
+		EXPECT((a!=NULL)&&(b!=NULL));
+		return;
+	}
+	fd = rd_open(a,"/f",O_CREAT|O_WRONLY,0644);
+	EXPECT_RES(rd_pwrite(a,fd,"x",1,0),1);
+	EXPECT_RES(rd_pwrite(a,fd,"x",1,1),1);
+	EXPECT_RES(rd_pwrite(a,fd,"x",1,2),1);
+	rd_close(a,fd);
+	fd = rd_open(b,"/f",O_CREAT|O_WRONLY,0644);
+	EXPECT_RES(rd_pwrite(b,fd,"x",1,0),1);
+	rd_close(b,fd);
+	EXPECT(pthread_create(&thread,NULL,stats_thread,b)==0);
+	pthread_join(thread,NULL);
+	EXPECT(ctl_value(a,"stats","write calls")==3);
+	EXPECT(ctl_value(b,"stats","write calls")==3);
+	rd_free(a);
+	// a disk made where a was counts from nothing
+	c = disk_up(NULL,NULL);
+	EXPECT(c!=NULL);
+	if(c!=NULL){
+		EXPECT(ctl_value(c,"stats","write calls")==-1);
+		rd_free(c);
+	}
+	EXPECT(ctl_value(b,"stats","write calls")==3);
+	rd_free(b);
+
+	// an image path that does not fit, relative or not
+	rd_config_init(&config);
+	config.loglevel = 0;
+	memset(image,'a',sizeof(image)-1);
+	image[sizeof(image)-1] = 0;
+	EXPECT_RES(rd_new(&c,CHECKDISK,image+16,&config),-ENAMETOOLONG);
+	image[0] = '/';
+	EXPECT_RES(rd_new(&c,CHECKDISK,image,&config),-ENAMETOOLONG);
+}
+
+// notify : what the notifier was told
+struct notices {
+	int inodes,entries;
+	rd_ino_t ino,dir;
+	off_t offset,length;
+	char name[NAME_MAX+1];
+};
+
+static void notice_inode(void *arg,rd_ino_t ino,off_t offset,off_t length){
+	struct notices *n = (struct notices *)arg;
+	n->inodes++;
+	n->ino = ino;
+	n->offset = offset;
+	n->length = length;
+}
+
+static void notice_entry(void *arg,rd_ino_t dir,const char *name,size_t len){
+	struct notices *n = (struct notices *)arg;
+	n->entries++;
+	n->dir = dir;
+	snprintf(n->name,sizeof(n->name),"%.*s",(int)len,name);
+}
+
+static const struct rd_notifier notifier = { notice_inode, notice_entry };
+
+static void *notify_thread(void *arg){
+	// a change the server did not make, from a thread of its own
+	struct ramdisk *d = (struct ramdisk *)arg;
+	int fd = rd_open(d,"/m",O_WRONLY,0);
+	rd_pwrite(d,fd,"x",1,4096);
+	rd_close(d,fd);
+	return NULL;
+}
+
+static void check_notify(){
+	struct notices seen;
+	struct stat st;
+	pthread_t thread;
+	int inodes,entries;
+	rd = disk_up(NULL,NULL);
+	if(rd==NULL){
+		EXPECT(rd!=NULL);
+		return;
+	}
+	memset(&seen,0,sizeof(seen));
+	rd_notify(rd,&notifier,&seen);
+	EXPECT_RES(put(rd,"/n",1,100),0);
+	EXPECT_RES(rd_stat(rd,"/n",&st),0);
+	EXPECT((seen.entries>0)&&(seen.dir==RD_ROOT_INO)&&!strcmp(seen.name,"n"));
+	EXPECT((seen.inodes>0)&&(seen.ino==st.st_ino)&&(seen.offset==0)&&(seen.length==100));
+	EXPECT_RES(rd_chmod(rd,"/n",0600),0);
+	EXPECT((seen.ino==st.st_ino)&&(seen.offset==-1));
+	entries = seen.entries;
+	EXPECT_RES(rd_rename(rd,"/n","/m"),0);
+	EXPECT(seen.entries>=entries+2);
+
+	// the server's own changes are not reported back to it
+	rd_serve(rd);
+	inodes = seen.inodes;
+	entries = seen.entries;
+	EXPECT_RES(put(rd,"/s",2,100),0);
+	EXPECT_RES(rd_chmod(rd,"/m",0644),0);
+	EXPECT_RES(rd_rename(rd,"/s","/t"),0);
+	EXPECT_RES(rd_unlink(rd,"/t"),0);
+	EXPECT((seen.inodes==inodes)&&(seen.entries==entries));
+
+	// while another thread's are
+	EXPECT(pthread_create(&thread,NULL,notify_thread,rd)==0);
+	pthread_join(thread,NULL);
+	EXPECT((seen.inodes==inodes+1)&&(seen.ino==st.st_ino)&&(seen.offset==4096)&&(seen.length==1));
+	rd_serve(NULL);
+
+	rd_notify(rd,NULL,NULL);
+	inodes = seen.inodes;
+	EXPECT_RES(rd_chmod(rd,"/m",0600),0);
+	EXPECT(seen.inodes==inodes);
+	rd_free(rd);
+}
+
+static void check_replay_crash(){
+	check_replay(NULL,"replay",1);
+}
+
+static void check_replay_clean(){
+	check_replay(NULL,"clean",0);
+}
+
+static void check_snapshot(){
+	check_replay("snapshot","snapshot",0);
+}
+
+struct check {
+	const char *name;
+	void (*fn)();
+};
+
+static const struct check checks[] = {
+	{ "paths", check_paths },
+	{ "dirs", check_dirs },
+	{ "renames", check_renames },
+	{ "hole", check_hole },
+	{ "replay", check_replay_crash },
+	{ "reload", check_replay_clean },
+	{ "snapshot", check_snapshot },
+	{ "compress", check_compress },
+	{ "ceiling", check_ceiling },
+	{ "dedup", check_dedup },
+	{ "disks", check_disks },
+	{ "notify", check_notify },
+};
+
+static int wanted(const char *list,const char *name){
+	size_t len = strlen(name);
+	const char *p = list;
+	if(list==NULL)
+		return 1;
+	while((p = strstr(p,name))!=NULL){
+		if(((p==list)||(p[-1]==','))&&((p[len]==',')||(p[len]=='\0')))
+			return 1;
+		p += len;
+	}
+	return 0;
+}
+
+static void remove_images(){
+	DIR *d = opendir(imageDir);
+	struct dirent *e;
+	char path[PATH_MAX];
+	if(d==NULL)
+		return;
+	while((e = readdir(d))!=NULL){
+		if(e->d_name[0]=='.')
+			continue;
+		snprintf(path,sizeof(path),"%s/%s",imageDir,e->d_name);
+		unlink(path);
+	}
+	closedir(d);
+	rmdir(imageDir);
+}
+
+int main(int argc,char *argv[]){
+	const char *list = NULL;
+	int keep = 0,opt;
+	unsigned i;
+	while((opt = getopt(argc,argv,"k"))!=-1){
+		if(opt!='k'){
+			fprintf(stderr,"usage : %s [-k] [name,...]\n",argv[0]);
+			return 1;
+		}
+		keep = 1;
+	}
+	if(optind<argc)
+		list = argv[optind];
+	strcpy(imageDir,"/tmp/ramdisk-check.XXXXXX");
+	if(mkdtemp(imageDir)==NULL){
+		fprintf(stderr,"cannot make a directory for the images\n");
+		return 1;
+	}
+	for(i=0;i<sizeof(checks)/sizeof(checks[0]);i++){
+		if(!wanted(list,checks[i].name))
+			continue;
+		int before = failures;
+		failedCheck = checks[i].name;
+		checks[i].fn();
+		printf("%s %s\n",(failures==before) ? "ok  " : "FAIL",checks[i].name);
+		fflush(stdout);
+	}
+	if(keep)
+		printf("images kept in %s\n",imageDir);
+	else
+		remove_images();
+	return failures ? 1 : 0;
+}
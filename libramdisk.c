@@ -0,0 +1,6434 @@
+/*
+  RAMDISK :  the in-memory filesystem as a library, see ramdisk.h. the
+  FUSE daemon in ramdisk.c is one user of it
+  
+  Author: Durgesh Kumar Gupta (dgupta9@ncsu.edu)
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/ioctl.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <zlib.h>
+#include <sys/statvfs.h>
+#include "ramdisk.h"
+#if defined(__x86_64__)||defined(__i386__)
+#define COPY_X86
+#include <immintrin.h>
+#endif
+
+// block size is a mount option (-o blocksize=N), a power of two between
+// MINBLOCKSIZE and MAXBLOCKSIZE
+#define DEFAULTBLOCKSIZE 4096
+#define MINBLOCKSIZE 4096
+#define MAXBLOCKSIZE (2*1024*1024)
+
+//#define MEMORYSIZE 1048576
+//#define BLOCKCOUNT 1024
+
+
+// huge page backing of the data region
+#define HUGEPAGESIZE (2*1024*1024)
+#define BACKING_HUGETLB 0
+#define BACKING_THP 1
+#define BACKING_PAGES 2
+#define BACKING_IMAGE 3
+
+// block allocator : one bit per block packed in 64-bit words, a set bit
+// marks a used block. free space is simply the clear bits, so freeing a
+// run coalesces with its free neighbours without any extra bookkeeping
+
+// elastic capacity : memorysize and blockcount are a ceiling, not an
+// allocation. address space is reserved for maxBlocks at mount and the
+// ceiling moves anywhere below it online (/.ramdisk/size), blocks past
+// the ceiling stay set in the bitmap as a fence. memory is committed one
+// chunk at a time when blocks in it are first handed out, and a chunk
+// left empty goes back to the OS once keepChunks empty ones are resident
+#define CHUNKSIZE HUGEPAGESIZE
+#define DEFAULTKEEPFREE 64	// MB of empty chunks kept resident
+
+// copy layer : stores of COPYSTREAM bytes or more into the blocks bypass
+// the caches with non temporal stores, so a large write, a hole punched
+// or a snapshot loaded streams to memory instead of evicting the hot
+// set. below that, and for every copy out to a caller who is about to
+// read it, libc's memcpy and memset are used as they are : they already
+// pick their vector width by CPU. -o copy picks the stores, auto for the
+// widest the CPU has
+#define COPYSTREAM (64*1024)
+#define COPY_AUTO 0
+#define COPY_LIBC 1
+#define COPY_SSE2 2
+#define COPY_AVX2 3
+struct copyEngine {
+	const char *name;
+	void (*store)(char *dst,const char *src,size_t len);	// NULL for memcpy
+	void (*clear)(char *dst,size_t len);
+};
+
+// file block maps : every file owns an array of extents sorted by logical
+// block, each mapping a run of file blocks onto contiguous disk blocks
+struct extent {
+	long lblock;	// first block within the file
+	long pblock;	// first block on the disk
+	long count;
+};
+struct extentList {
+	struct extent *ext;
+	int count;
+	int cap;
+};
+
+// directory tree : every inode knows its parent slot and every directory
+// owns an unordered list of child slots
+struct childList {
+	int *child;
+	int count;
+	int cap;
+};
+
+// inode table : one fixed size record per file, directory or symbolic
+// link, held in
+// chunks of INODECHUNK records that never move once allocated, so a slot
+// stays valid without the namespace lock while a handle pins it. the
+// table grows a chunk at a time and freed slots are reused through a
+// free list. root is slot ROOTDIR. names are not stored here, only the
+// arena offset of the entry's last component. the inode calls number a
+// slot as slot+1, so root is RD_ROOT_INO, and the control entries come
+// after the last slot the table can hold. a hard link is a slot of its
+// own, of type 'h', that only carries a name and points at the file it
+// names : lookups go through it, so the file keeps one number and one
+// record whatever name it is reached by
+#define INODECHUNKBITS 10
+#define INODECHUNK (1<<INODECHUNKBITS)
+#define MAXINODECHUNKS (1<<16)
+#define ROOTDIR 0
+#define INODE(i) (&disk->inodeChunks[(i)>>INODECHUNKBITS][(i)&(INODECHUNK-1)])
+#define SLOT_INO(i) ((rd_ino_t)(i)+1)
+#define CTLINO RAMDISK_CTLINO	// the control directory, its files follow
+#if RAMDISK_CTLINO <= MAXINODECHUNKS*INODECHUNK
+#error "control inode numbers overlap the table"
+#endif
+struct inode {
+	pthread_rwlock_t lock;	// file data and extents
+	off_t size;		// read without the lock through atomic loads
+	long blocks;		// blocks the extents map, holes excluded, read the same way
+	struct extentList ext;
+	int parent;		// slot of the parent directory, -1 if detached
+	int childPos;		// position of the entry inside its parent's list
+	long name;		// arena offset of the component name
+	unsigned int nameHash;	// hash of parent and name, as in dirIndex
+	unsigned short nameLen;
+	char type;		// 'd', 'r', 'l' for a symbolic link, 'h' for a hard link or 0 for a free slot
+	char unlinked;		// removed while open or looked up, freed at the last release
+	int openCount;
+	long lookups;		// references rd_lookup and friends handed out, see rd_forget
+	int nextFree;		// free list link
+	struct childList children;
+	mode_t mode;		// permission bits
+	uid_t uid;
+	gid_t gid;
+	unsigned int nlink;	// names of a file, 2 plus subdirectories of a directory
+	int64_t atime,mtime,ctime;	// ns since the epoch, read through atomic loads
+	long target;		// 'l' : arena offset of the target, size is its length
+	int link;		// 'h' : the slot it names. 'r', 'l' : its first 'h', -1 for none
+	int nextLink;		// 'h' : the next one naming the same slot
+};
+
+// name arena : component names and symbolic link targets are stored
+// once, NUL terminated, in ARENACHUNK sized chunks that never move and
+// are addressed by a global offset. a freed name goes on the free list of
+// its 8 byte size class and is reused by the next name of that class, the
+// list link lives in the freed bytes
+#define ARENACHUNKBITS 20
+#define ARENACHUNK (1<<ARENACHUNKBITS)
+#define MAXARENACHUNKS (1<<16)
+#define NAMECLASSES ((PATH_MAX+7)/8)
+
+// directory index : open addressing with linear probing keyed on parent
+// slot and component name, each bucket caches the hash so probes rarely
+// touch the inodes. doubles when half full, only under the namespace write
+// lock so readers never see it move
+#define DIRINDEXMIN 4096	// initial bucket count, a power of two
+#define INDEX_EMPTY -1
+struct dirIndexEntry {
+	unsigned int hash;
+	int slot;
+};
+
+// open files : rd_open hands out descriptors into a table of FDCHUNK
+// records that never move once allocated, like the inode table, so read
+// and write find theirs without a lock. closed descriptors are reused
+// through a free list. an open file skips the path lookup and resumes at
+// the extent last touched, and a file unlinked while open keeps its slot
+// and blocks until the last close
+#define FDCHUNKBITS 10
+#define FDCHUNK (1<<FDCHUNKBITS)
+#define MAXFDCHUNKS (1<<10)
+#define OPENFILE(fd) (&disk->fdChunks[(fd)>>FDCHUNKBITS][(fd)&(FDCHUNK-1)])
+#define FD_FREE -3
+#define MAXIO (1<<30)	// most bytes one read or write moves
+#define MAXFILESIZE ((off_t)1<<62)	// largest file, rounding it up to blocks cannot overflow
+struct openFile {
+	int index;		// inode slot of the file, -1 for a control file
+	int cursor;		// extent touched by the last transfer
+	int ctl;		// ctlFiles index of a control file, CTL_NONE for a file, FD_FREE
+	int flags;		// open flags
+	off_t pos;		// where rd_read and rd_write go on
+	int nextFree;		// free list link
+};
+
+// locking : the namespace (inode table, names, index, tree) is guarded
+// by a reader/writer lock split into cache-line sized shards, a reader
+// takes the shard of its thread and a writer takes all of them. file data
+// and extents are guarded by the inode's rwlock taken under the namespace
+// read lock, and the block allocator has its own mutex
+#define NSLOCKSHARDS 16
+struct nsLockShard {
+	pthread_rwlock_t lock;
+} __attribute__((aligned(64)));
+static __thread int nsShard = -1;
+int nsShardNext = 0;
+pthread_rwlockattr_t lockAttr;	// writer preferring, for every rwlock
+
+// image layout : two header slots, the valid one with the higher
+// generation wins, then the data section at dataOffset holding every
+// block up to maxBlocks at its disk position, sparse where blocks were
+// never written, then the metadata (ns_save records). the metadata of
+// consecutive checkpoints alternates between just after the data section
+// and just after the previous copy, so the copy the live header points
+// at is never overwritten
+#define IMAGEMAGIC "RAMDISK"
+#define IMAGEVERSION 3
+#define IMAGEMETAVERSION 3	// the first whose metadata holds mode, owner and times
+#define IMAGEHEADER 4096
+#define IMAGEDATA HUGEPAGESIZE	// data section offset
+#define IMAGEALIGN 4096
+#define CKPTRUN 8192		// most blocks copied by one pwrite
+struct imageHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t headerSize;
+	uint64_t generation;	// checkpoints written, picks the slot
+	uint64_t seq;		// last journal record the checkpoint holds
+	int64_t blocksize;
+	int64_t blockcount;	// ceiling
+	int64_t maxBlocks;	// blocks the data section holds
+	uint64_t dataOffset;
+	uint64_t metaOffset;
+	uint64_t metaLength;
+	uint64_t metaCheck;
+	uint64_t check;		// of the header with check zeroed
+};
+
+// a disk : everything below is per instance, so a process can hold any
+// number of them. every entry point makes its instance the calling
+// thread's disk, and the threads a disk starts make it theirs, so the
+// code below reaches the state through disk without passing it around
+struct ramdisk {
+	struct ramdisk_config config;
+	long blocksize;
+	long memorysize;	// the ceiling in bytes
+	long blockcount;	// the ceiling in blocks
+
+	//hold pointer to ram disk block start
+	char *memoffset;
+	long mappedsize;	// length of the mapping behind memoffset
+	int dataBacking;
+	int dataFd;		// memfd behind the data region, -1 for anonymous memory
+
+	uint64_t *bitMap;
+	long bitMapWords;
+	long freeBlocks;	// kept in step with the bitmap on every alloc/free. it and
+				// fenceBlocks change atomically under allocLock, as statfs
+				// and the tier read them without it
+	long nextFitHint;	// word where the next search starts
+	long maxBlocks;
+	long chunkBlocks;	// blocks per chunk
+	long chunkCount;
+	int *chunkUsed;		// blocks in use per chunk
+	char *chunkResident;	// chunk memory committed
+	long emptyResident;	// resident chunks without a block in use
+	long keepChunks;
+	long fenceBlocks;	// where the fence starts, the ceiling unless compress is on
+	pthread_mutex_t allocLock;
+
+	struct inode *inodeChunks[MAXINODECHUNKS];
+	int inodeSlots;		// slots handed out so far, the table's high water
+	int inodeFree;		// head of the free slot list
+	long inodeCount;	// slots in use
+	char *arenaChunks[MAXARENACHUNKS];
+	long arenaTop;		// next unused byte
+	long arenaFree[NAMECLASSES+1];	// free list per size class, -1 when empty
+	struct dirIndexEntry *dirIndex;
+	unsigned long dirIndexSize;
+	long dirIndexUsed;
+	struct nsLockShard nsLock[NSLOCKSHARDS];
+
+	struct openFile *fdChunks[MAXFDCHUNKS];
+	int fdSlots;		// descriptors handed out so far
+	int fdFree;		// head of the free descriptor list
+	pthread_mutex_t fdLock;
+
+	int usePersist;
+	char persistPath[PATH_MAX];
+	int useSnapshot;	// persist to a snapshot at unmount instead
+	int walActive;		// records are queued, off while the image loads
+	pthread_mutex_t walLock;
+	pthread_cond_t walWake;	// flusher has work
+	pthread_cond_t walDone;	// flusher made progress
+	char *walQueue;		// records not written yet
+	size_t walLen,walCap;
+	char *walSpare;		// the flusher's last buffer, swapped back in
+	size_t walSpareCap;
+	uint64_t walSeq;	// last sequence handed out
+	uint64_t walDurable;	// last sequence on disk
+	uint64_t walFileSeq;	// the current journal holds records after this
+	uint64_t walRotateSeq;	// records after this go to a new journal
+	int walRotate;
+	int walUrgent;		// flush without waiting out the interval
+	int walError;		// a record was lost, fsync fails from now on
+	long walFlushMs;
+	uint64_t walLimit;
+	uint64_t walBytes;	// bytes in the current journal
+	int walStop;
+	pthread_t walThread;
+	uint64_t *dirtyMap;	// blocks written since the last checkpoint
+	int ckptActive;		// a checkpoint is copying blocks, frees wait
+	struct extentList ckptDeferred;	// runs freed meanwhile
+	long ckptDeferredBlocks;
+	struct imageHeader image;	// header of the last checkpoint
+	int imageFd;
+	uint64_t *ckptDirty;	// dirtyMap as the running checkpoint took it
+	uint64_t *ckptBitmap;	// bitMap as the running checkpoint took it
+	long ckptInterval;
+	pthread_mutex_t ckptWaitLock;
+	pthread_cond_t ckptWake;
+	int ckptKick;
+	int ckptStop;
+	pthread_t ckptThread;
+	int persistRunning;
+	long snapThreads;	// 0 for one per CPU
+
+	long coldAge;		// seconds between passes, 0 when compression is off
+	long coldRatio;
+	long coldHigh;
+	uint64_t *hotMap;	// touched since the last pass
+	uint64_t *coldMap;	// held deflated in the pool
+	uint64_t *rejectMap;	// did not deflate well enough, untouched since
+	struct coldBlock ***coldPool;	// per block, parts allocated as they are needed
+	pthread_mutex_t tierLock;	// the pool, cold bits and the inflater
+	pthread_mutex_t tierGate;	// no block goes cold while held
+	pthread_cond_t tierWake;
+	pthread_cond_t tierDone;	// a pass finished
+	uint64_t tierPasses;
+	int tierScanning;
+	z_stream tierInflate;
+	int tierInflateReady;
+	int tierKick;
+	int tierStop;
+	int tierRunning;
+	int tierBudget;		// the ceiling bounds allocations, off while the image loads
+	pthread_t tierThread;
+	long coldBlocks;
+	long poolBytes;
+	uint64_t tierCompressed,tierRestored,tierRejected;
+	uint64_t tierCompressNs,tierRestoreNs;
+
+	int useDedup;
+	uint32_t *shareCount;	// NULL while no block can be shared
+	uint64_t *blockHash;	// content hash of indexed blocks, 0 if not indexed
+	long *dedupIndex;	// open addressing on the hash, block+1 or 0 when empty
+	int dedupBits;
+	long dedupUsed;
+	long sharedRefs;	// owners beyond the first, summed over the blocks
+	uint64_t dedupHashed,dedupHits,dedupCopies,dedupHashNs;
+
+	const struct rd_notifier *notifier;	// see rd_notify
+	void *notifyArg;
+	uid_t uid;		// owner of the root, and of what is made without rd_creds
+	gid_t gid;
+	const struct copyEngine *copy;	// see COPYSTREAM
+
+	struct threadStats *statsList;	// a block per thread counting calls here, see stat_count
+	int statsThreads;	// of them, the ones whose thread is alive
+};
+static __thread struct ramdisk *disk;
+// the disk whose server the calling thread works for, see rd_serve
+static __thread struct ramdisk *serving;
+// owner of what the calling thread creates, see rd_creds, -1 for the disk's
+static __thread uid_t credUid = (uid_t)-1;
+static __thread gid_t credGid = (gid_t)-1;
+
+
+// log handler : every thread formats its messages into a private
+// single-producer ring, a background thread drains the rings, stamps the
+// time and writes them out in batches. messages above logLevel are
+// dropped by the log_write macro before any argument is evaluated
+#define LOGFILEPATH RAMDISK_LOGFILE
+#define LOG_OFF 0
+#define LOG_ERROR 1
+#define LOG_INFO 2
+#define LOG_TRACE 3
+int logLevel = LOG_ERROR;
+int logfd = -1;
+
+#define LOGRINGSIZE 256		// entries per thread, power of two
+#define LOGMSGSIZE 232
+#define LOGDRAININTERVAL 50	// ms between drains
+struct log_entry {
+	struct timespec ts;
+	int level;
+	char msg[LOGMSGSIZE];
+};
+struct log_ring {
+	struct log_entry entry[LOGRINGSIZE];
+	unsigned long head;	// advanced by the owning thread only
+	unsigned long tail;	// advanced by the drain thread only
+	unsigned long dropped;
+	int dead;		// owner exited, free once drained
+	struct log_ring *next;
+};
+static __thread struct log_ring *threadRing;
+struct log_ring *ringList = NULL;
+pthread_mutex_t ringListLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_key_t ringKey;
+pthread_t logThread;
+int logThreadRunning = 0;
+int logStop = 0;
+
+#define log_write(level, ...) do { if((level) <= logLevel) log_emit((level), __VA_ARGS__); } while(0)
+
+
+static void log_ring_release(void *ring){
+	// thread exit : leave the ring for the drain thread to empty and free
+	__atomic_store_n(&((struct log_ring *)ring)->dead,1,__ATOMIC_RELEASE);
+}
+
+static struct log_ring *log_ring_register(){
+	struct log_ring *ring = (struct log_ring *) calloc(1,sizeof(struct log_ring));
+	if(ring==NULL)
+		return NULL;
+	pthread_mutex_lock(&ringListLock);
+	ring->next = ringList;
+	ringList = ring;
+	pthread_mutex_unlock(&ringListLock);
+	pthread_setspecific(ringKey,ring);
+	threadRing = ring;
+	return ring;
+}
+
+static void log_emit(int level, const char *logmsg, ...){
+	struct log_ring *ring = threadRing ? threadRing : log_ring_register();
+	if(ring==NULL)
+		return;
+	unsigned long head = ring->head;
+	if(head - __atomic_load_n(&ring->tail,__ATOMIC_ACQUIRE) >= LOGRINGSIZE){
+		ring->dropped++;
+		return;
+	}
+	struct log_entry *e = &ring->entry[head & (LOGRINGSIZE-1)];
+	clock_gettime(CLOCK_REALTIME,&e->ts);
+	e->level = level;
+	va_list args;
+	va_start(args,logmsg);
+	vsnprintf(e->msg,LOGMSGSIZE,logmsg,args);
+	va_end(args);
+	__atomic_store_n(&ring->head,head+1,__ATOMIC_RELEASE);
+}
+
+static void log_drain(){
+	// format everything queued so far and write it with one call per ring
+	static const char *levelName[] = { "OFF", "ERROR", "INFO", "TRACE" };
+	static char out[LOGRINGSIZE*(LOGMSGSIZE+48)];
+	struct log_ring **link,*ring;
+	pthread_mutex_lock(&ringListLock);
+	link = &ringList;
+	while((ring = *link) != NULL){
+		int dead = __atomic_load_n(&ring->dead,__ATOMIC_ACQUIRE);
+		unsigned long head = __atomic_load_n(&ring->head,__ATOMIC_ACQUIRE);
+		unsigned long tail = ring->tail;
+		size_t len = 0;
+		while(tail != head){
+			struct log_entry *e = &ring->entry[tail & (LOGRINGSIZE-1)];
+			struct tm tm;
+			localtime_r(&e->ts.tv_sec,&tm);
+			len += snprintf(out+len,sizeof(out)-len,"%d-%02d-%02d %02d:%02d:%02d.%06ld [%s] : %s\n",
+				tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec,
+				e->ts.tv_nsec/1000, levelName[e->level], e->msg);
+			tail++;
+		}
+		__atomic_store_n(&ring->tail,tail,__ATOMIC_RELEASE);
+		if(ring->dropped){
+			len += snprintf(out+len,sizeof(out)-len,"log : %lu messages dropped\n",ring->dropped);
+			ring->dropped = 0;
+		}
+		if(len && (logfd != -1))
+			write(logfd,out,len);
+		if(dead){
+			*link = ring->next;
+			free(ring);
+		}else{
+			link = &ring->next;
+		}
+	}
+	pthread_mutex_unlock(&ringListLock);
+}
+
+static void *log_thread(void *arg){
+	struct timespec interval = { 0, LOGDRAININTERVAL*1000000L };
+	while(!__atomic_load_n(&logStop,__ATOMIC_ACQUIRE)){
+		nanosleep(&interval,NULL);
+		log_drain();
+	}
+	return NULL;
+}
+
+static void log_init(){
+	if((logLevel != LOG_OFF)&&(logfd == -1))
+		logfd = open(LOGFILEPATH,O_WRONLY|O_CREAT|O_APPEND|O_CLOEXEC,0644);
+}
+
+static void log_start(){
+	// the drain thread is started by rd_start, after the daemon has
+	// forked, since threads do not survive the fork
+	if((logLevel != LOG_OFF)&&(!logThreadRunning)){
+		__atomic_store_n(&logStop,0,__ATOMIC_RELEASE);
+		if(!pthread_create(&logThread,NULL,log_thread,NULL))
+			logThreadRunning = 1;
+	}
+}
+
+static void log_close(){
+	if(logThreadRunning){
+		__atomic_store_n(&logStop,1,__ATOMIC_RELEASE);
+		pthread_join(logThread,NULL);
+		logThreadRunning = 0;
+	}
+	log_drain();
+	if(logfd != -1)
+		close(logfd);
+	logfd = -1;
+}
+
+static void ns_read_lock(){
+	if(nsShard == -1)
+		nsShard = __atomic_fetch_add(&nsShardNext,1,__ATOMIC_RELAXED) % NSLOCKSHARDS;
+	pthread_rwlock_rdlock(&disk->nsLock[nsShard].lock);
+}
+
+static void ns_read_unlock(){
+	pthread_rwlock_unlock(&disk->nsLock[nsShard].lock);
+}
+
+static void ns_write_lock(){
+	int i;
+	for(i=0;i<NSLOCKSHARDS;i++)
+		pthread_rwlock_wrlock(&disk->nsLock[i].lock);
+}
+
+static void ns_write_unlock(){
+	int i;
+	for(i=NSLOCKSHARDS-1;i>=0;i--)
+		pthread_rwlock_unlock(&disk->nsLock[i].lock);
+}
+
+static int inode_grow(){
+	// extend the table by one slot, returns it or -1 when out of memory
+	int i;
+	if(disk->inodeSlots >= MAXINODECHUNKS*INODECHUNK)
+		return -1;
+	int chunk = disk->inodeSlots>>INODECHUNKBITS;
+	if(disk->inodeChunks[chunk]==NULL){
+		struct inode *c = (struct inode *) calloc(INODECHUNK,sizeof(struct inode));
+		if(c==NULL)
+			return -1;
+		for(i=0;i<INODECHUNK;i++)
+			pthread_rwlock_init(&c[i].lock,&lockAttr);
+		disk->inodeChunks[chunk] = c;
+	}
+	return disk->inodeSlots++;
+}
+
+static int64_t time_now(){
+	// file times go by the coarse clock, as the kernel's own do
+	struct timespec t;
+	clock_gettime(CLOCK_REALTIME_COARSE,&t);
+	return (int64_t)t.tv_sec*1000000000+t.tv_nsec;
+}
+
+#define TOUCH_ATIME 1
+#define TOUCH_MTIME 2
+#define TOUCH_CTIME 4
+static void inode_touch(int slot,int what){
+	// set the times in what to now. stores are atomic as stat reads
+	// them without the file's lock
+	struct inode *n = INODE(slot);
+	int64_t now = time_now();
+	if(what & TOUCH_ATIME)
+		__atomic_store_n(&n->atime,now,__ATOMIC_RELAXED);
+	if(what & TOUCH_MTIME)
+		__atomic_store_n(&n->mtime,now,__ATOMIC_RELAXED);
+	if(what & TOUCH_CTIME)
+		__atomic_store_n(&n->ctime,now,__ATOMIC_RELAXED);
+}
+
+static void inode_accessed(int slot){
+	// relatime : atime only moves when it is older than the last change
+	// or a day old, so a read seldom writes to the record
+	struct inode *n = INODE(slot);
+	int64_t at = __atomic_load_n(&n->atime,__ATOMIC_RELAXED);
+	if((at<=__atomic_load_n(&n->mtime,__ATOMIC_RELAXED))||(at<=__atomic_load_n(&n->ctime,__ATOMIC_RELAXED))||(time_now()-at > 86400LL*1000000000))
+		inode_touch(slot,TOUCH_ATIME);
+}
+
+static void inode_init(int slot,char type){
+	// a new record owned by the caller's credentials, its mode is set by
+	// whoever creates it
+	struct inode *n = INODE(slot);
+	n->type = type;
+	n->size = 0;
+	n->blocks = 0;
+	n->parent = -1;
+	n->unlinked = 0;
+	n->lookups = 0;
+	n->mode = 0;
+	n->uid = (credUid==(uid_t)-1) ? disk->uid : credUid;
+	n->gid = (credGid==(gid_t)-1) ? disk->gid : credGid;
+	n->nlink = (type=='d') ? 2 : 0;
+	n->atime = n->mtime = n->ctime = time_now();
+	n->target = -1;
+	n->link = -1;
+	n->nextLink = -1;
+	__atomic_add_fetch(&disk->inodeCount,1,__ATOMIC_RELAXED);	// statfs reads it unlocked
+}
+
+static int inode_alloc(char type){
+	// take a free slot or grow the table, returns the slot or -1 when out
+	// of memory. caller holds the namespace write lock
+	int slot = disk->inodeFree;
+	if(slot!=-1){
+		disk->inodeFree = INODE(slot)->nextFree;
+	}else{
+		slot = inode_grow();
+		if(slot==-1)
+			return -1;
+	}
+	inode_init(slot,type);
+	return slot;
+}
+
+static int inode_claim(int slot,char type){
+	// take exactly slot, for journal replay. the free list goes stale and
+	// is rebuilt by inode_rebuild_free once replay is done
+	while(disk->inodeSlots<=slot){
+		if(inode_grow()==-1)
+			return -ENOMEM;
+	}
+	if(INODE(slot)->type)
+		return -EEXIST;
+	inode_init(slot,type);
+	return 0;
+}
+
+static void name_free(long name,int len);
+
+static void inode_free(int slot){
+	// the slot must be detached, without blocks or children
+	struct inode *n = INODE(slot);
+	if(n->target!=-1)
+		name_free(n->target,n->size);
+	n->target = -1;
+	n->type = 0;
+	n->unlinked = 0;
+	n->nextFree = disk->inodeFree;
+	disk->inodeFree = slot;
+	__atomic_sub_fetch(&disk->inodeCount,1,__ATOMIC_RELAXED);
+}
+
+static void inode_rebuild_free(){
+	// chain every free slot, lowest first, and recount the ones in use
+	int i;
+	disk->inodeFree = -1;
+	disk->inodeCount = 0;
+	for(i=disk->inodeSlots-1;i>=0;i--){
+		struct inode *n = INODE(i);
+		if(n->type==0){
+			n->nextFree = disk->inodeFree;
+			disk->inodeFree = i;
+		}else{
+			disk->inodeCount++;
+		}
+	}
+}
+
+static char *name_str(long name){
+	return disk->arenaChunks[name>>ARENACHUNKBITS] + (name&(ARENACHUNK-1));
+}
+
+static int name_class(int len){
+	// size class of a name in 8 byte units, NUL included
+	return (len+1+7)/8;
+}
+
+static long name_alloc(const char *name,int len){
+	// store a component in the arena, returns its offset or -1 when out
+	// of memory. a name never straddles two chunks
+	int c = name_class(len);
+	long off = disk->arenaFree[c];
+	if(off!=-1){
+		disk->arenaFree[c] = *(long *)name_str(off);
+	}else{
+		long size = c*8;
+		if((disk->arenaTop&(ARENACHUNK-1))+size > ARENACHUNK)
+			disk->arenaTop = (disk->arenaTop|(ARENACHUNK-1))+1;
+		long chunk = disk->arenaTop>>ARENACHUNKBITS;
+		if(chunk>=MAXARENACHUNKS)
+			return -1;
+		if(disk->arenaChunks[chunk]==NULL){
+			disk->arenaChunks[chunk] = (char *) malloc(ARENACHUNK);
+			if(disk->arenaChunks[chunk]==NULL)
+				return -1;
+		}
+		off = disk->arenaTop;
+		disk->arenaTop += size;
+	}
+	memcpy(name_str(off),name,len);
+	name_str(off)[len] = '\0';
+	return off;
+}
+
+static void name_free(long name,int len){
+	int c = name_class(len);
+	*(long *)name_str(name) = disk->arenaFree[c];
+	disk->arenaFree[c] = name;
+}
+
+static unsigned int name_hash(int dir,const char *name,int len){
+	// FNV-1a over the parent slot and the component
+	unsigned int h = 2166136261u;
+	int i;
+	for(i=0;i<4;i++){
+		h ^= (dir>>(i*8)) & 0xff;
+		h *= 16777619u;
+	}
+	for(i=0;i<len;i++){
+		h ^= (unsigned char)name[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static int index_init(unsigned long size){
+	unsigned long i;
+	struct dirIndexEntry *table = (struct dirIndexEntry *) malloc(size*sizeof(struct dirIndexEntry));
+	if(table==NULL)
+		return -ENOMEM;
+	for(i=0;i<size;i++)
+		table[i].slot = INDEX_EMPTY;
+	free(disk->dirIndex);
+	disk->dirIndex = table;
+	disk->dirIndexSize = size;
+	disk->dirIndexUsed = 0;
+	return 0;
+}
+
+static void index_insert(unsigned int hash,int slot){
+	unsigned long b = hash & (disk->dirIndexSize-1);
+	while(disk->dirIndex[b].slot != INDEX_EMPTY)
+		b = (b+1) & (disk->dirIndexSize-1);
+	disk->dirIndex[b].hash = hash;
+	disk->dirIndex[b].slot = slot;
+	disk->dirIndexUsed++;
+}
+
+static int index_reserve(){
+	// make room for one more entry, doubling the table when half full
+	if((disk->dirIndexUsed+1)*2 <= (long)disk->dirIndexSize)
+		return 0;
+	struct dirIndexEntry *old = disk->dirIndex;
+	unsigned long i,oldSize = disk->dirIndexSize;
+	disk->dirIndex = NULL;
+	if(index_init(oldSize*2)){
+		disk->dirIndex = old;
+		disk->dirIndexSize = oldSize;
+		return -ENOMEM;
+	}
+	for(i=0;i<oldSize;i++){
+		if(old[i].slot != INDEX_EMPTY)
+			index_insert(old[i].hash,old[i].slot);
+	}
+	free(old);
+	return 0;
+}
+
+static int lookup_child(int dir,const char *name,int len){
+	// return the slot of name inside dir or -1 if not present
+	unsigned int h = name_hash(dir,name,len);
+	unsigned long b = h & (disk->dirIndexSize-1);
+	while(disk->dirIndex[b].slot != INDEX_EMPTY){
+		if(disk->dirIndex[b].hash == h){
+			struct inode *n = INODE(disk->dirIndex[b].slot);
+			if((n->parent==dir)&&(n->nameLen==len)&&(!memcmp(name_str(n->name),name,len)))
+				return disk->dirIndex[b].slot;
+		}
+		b = (b+1) & (disk->dirIndexSize-1);
+	}
+	return -1;
+}
+
+static void index_remove(int slot){
+	unsigned int h = INODE(slot)->nameHash;
+	unsigned long b = h & (disk->dirIndexSize-1);
+	while(disk->dirIndex[b].slot != slot){
+		if(disk->dirIndex[b].slot == INDEX_EMPTY)
+			return;
+		b = (b+1) & (disk->dirIndexSize-1);
+	}
+	// backward shift deletion keeps probe chains intact without tombstones
+	unsigned long hole = b;
+	b = (b+1) & (disk->dirIndexSize-1);
+	while(disk->dirIndex[b].slot != INDEX_EMPTY){
+		unsigned long home = disk->dirIndex[b].hash & (disk->dirIndexSize-1);
+		if(((b-home) & (disk->dirIndexSize-1)) >= ((b-hole) & (disk->dirIndexSize-1))){
+			disk->dirIndex[hole] = disk->dirIndex[b];
+			hole = b;
+		}
+		b = (b+1) & (disk->dirIndexSize-1);
+	}
+	disk->dirIndex[hole].slot = INDEX_EMPTY;
+	disk->dirIndexUsed--;
+}
+
+static int entry_target(int slot){
+	// the slot a name stands for, through a hard link
+	return ((slot>=0)&&(INODE(slot)->type=='h')) ? INODE(slot)->link : slot;
+}
+
+static int lookup_range(const char *path,const char *end){
+	// resolve the path between path and end one component at a time,
+	// return its slot, -ENOENT if it does not exist or -ENOTDIR if a
+	// component is not a directory, or the last one is but for a
+	// trailing slash
+	int slot = ROOTDIR;
+	const char *start = path;
+	while(path<end){
+		if(*path=='/'){
+			path++;
+			continue;
+		}
+		const char *next = memchr(path,'/',end-path);
+		if(next==NULL)
+			next = end;
+		if(INODE(slot)->type!='d')
+			return -ENOTDIR;
+		slot = lookup_child(slot,path,next-path);
+		if(slot==-1)
+			return -ENOENT;
+		path = next;
+	}
+	if((end>start)&&(end[-1]=='/')&&(INODE(entry_target(slot))->type!='d'))
+		return -ENOTDIR;
+	return slot;
+}
+
+static int lookup_entry(const char *path){
+	// the slot of the name itself, a hard link's own. paths are absolute
+	if(path[0]!='/')
+		return -ENOENT;
+	return lookup_range(path,path+strlen(path));
+}
+
+static int lookup_path(const char *path){
+	// the file or directory path names
+	return entry_target(lookup_entry(path));
+}
+
+static int lookup_parent(const char *path,const char **name,int *len){
+	// return the slot of the directory holding path and point name at the
+	// last component, -ENOENT if the parent does not exist and -ENOTDIR if
+	// it is not a directory
+	const char *last = strrchr(path,'/');
+	if((last==NULL)||(path[0]!='/'))
+		return -ENOENT;
+	*name = last+1;
+	*len = strlen(last+1);
+	int i = lookup_range(path,last);
+	if(i<0)
+		return i;
+	if(INODE(i)->type!='d')
+		return -ENOTDIR;
+	return i;
+}
+
+static int dir_add_child(int dir,int slot){
+	struct childList *list = &INODE(dir)->children;
+	if(list->count == list->cap){
+		int cap = list->cap ? list->cap*2 : 8;
+		int *child = (int*) realloc(list->child,cap*sizeof(int));
+		if(child==NULL)
+			return -ENOMEM;
+		list->child = child;
+		list->cap = cap;
+	}
+	INODE(slot)->parent = dir;
+	INODE(slot)->childPos = list->count;
+	list->child[list->count++] = slot;
+	return 0;
+}
+
+static void dir_remove_child(int slot){
+	// swap the last child into the freed position
+	struct inode *n = INODE(slot);
+	struct childList *list = &INODE(n->parent)->children;
+	int last = list->child[--list->count];
+	list->child[n->childPos] = last;
+	INODE(last)->childPos = n->childPos;
+	n->parent = -1;
+}
+
+static void dir_free(int dir){
+	struct childList *list = &INODE(dir)->children;
+	free(list->child);
+	list->child = NULL;
+	list->count = 0;
+	list->cap = 0;
+}
+
+// change notices : the namespace and data changes below report
+// themselves to the disk's notifier unless the server the notifier
+// belongs to made them, so a cache of the disk drops what they left stale
+static void notify_inode(int slot,off_t offset,off_t length){
+	const struct rd_notifier *n = __atomic_load_n(&disk->notifier,__ATOMIC_ACQUIRE);
+	if(n && (serving!=disk))
+		n->inode(disk->notifyArg,SLOT_INO(slot),offset,length);
+}
+
+static void notify_entry(int dir,const char *name,int len){
+	const struct rd_notifier *n = __atomic_load_n(&disk->notifier,__ATOMIC_ACQUIRE);
+	if(n && (serving!=disk))
+		n->entry(disk->notifyArg,SLOT_INO(dir),name,len);
+}
+
+static void entry_count(int dir,int slot,int delta){
+	// the link count the name of slot inside dir adds to : its file's, or
+	// its parent's for the '..' of a directory
+	int t = entry_target(slot);
+	if(INODE(t)->type=='d')
+		INODE(dir)->nlink += delta;
+	else
+		INODE(t)->nlink += delta;
+}
+
+static void entry_changed(int dir,int slot){
+	// a name of slot was added to, removed from or moved within dir
+	inode_touch(dir,TOUCH_MTIME|TOUCH_CTIME);
+	inode_touch(entry_target(slot),TOUCH_CTIME);
+}
+
+static void alias_add(int slot,int target){
+	// make the 'h' slot name target
+	INODE(slot)->link = target;
+	INODE(slot)->nextLink = INODE(target)->link;
+	INODE(target)->link = slot;
+}
+
+static void alias_drop(int slot){
+	// take the 'h' slot off the list of the file it names
+	int *p = &INODE(INODE(slot)->link)->link;
+	while(*p!=slot)
+		p = &INODE(*p)->nextLink;
+	*p = INODE(slot)->nextLink;
+}
+
+static int entry_add(int dir,int slot,const char *name,int len){
+	// link slot into dir under name, caller holds the namespace write lock
+	if(len>NAME_MAX)
+		return -ENAMETOOLONG;
+	if(index_reserve())
+		return -ENOMEM;
+	long off = name_alloc(name,len);
+	if(off==-1)
+		return -ENOMEM;
+	if(dir_add_child(dir,slot)){
+		name_free(off,len);
+		return -ENOMEM;
+	}
+	struct inode *n = INODE(slot);
+	n->name = off;
+	n->nameLen = len;
+	n->nameHash = name_hash(dir,name,len);
+	index_insert(n->nameHash,slot);
+	entry_count(dir,slot,1);
+	entry_changed(dir,slot);
+	notify_entry(dir,name,len);
+	return 0;
+}
+
+static void entry_remove(int slot){
+	// unlink slot from its directory and drop its name
+	struct inode *n = INODE(slot);
+	notify_entry(n->parent,name_str(n->name),n->nameLen);
+	entry_count(n->parent,slot,-1);
+	entry_changed(n->parent,slot);
+	index_remove(slot);
+	dir_remove_child(slot);
+	name_free(n->name,n->nameLen);
+}
+
+static int entry_move(int slot,int dir,const char *name,int len){
+	// rename slot to name inside dir, nothing changes on failure
+	struct inode *n = INODE(slot);
+	if(len>NAME_MAX)
+		return -ENAMETOOLONG;
+	long off = name_alloc(name,len);
+	if(off==-1)
+		return -ENOMEM;
+	int oldParent = n->parent;
+	if(dir!=oldParent){
+		dir_remove_child(slot);
+		if(dir_add_child(dir,slot)){
+			// cannot fail, the old list just lost an entry
+			dir_add_child(oldParent,slot);
+			name_free(off,len);
+			return -ENOMEM;
+		}
+	}
+	notify_entry(oldParent,name_str(n->name),n->nameLen);
+	index_remove(slot);
+	name_free(n->name,n->nameLen);
+	n->name = off;
+	n->nameLen = len;
+	n->nameHash = name_hash(dir,name,len);
+	index_insert(n->nameHash,slot);
+	if(dir!=oldParent){
+		entry_count(oldParent,slot,-1);
+		entry_count(dir,slot,1);
+		entry_changed(oldParent,slot);
+	}
+	entry_changed(dir,slot);
+	notify_entry(dir,name,len);
+	return 0;
+}
+
+static void entry_swap(int a,int b){
+	// trade the names of a and b, directories with all below them, in
+	// place : nothing is allocated so it cannot fail
+	struct inode *x = INODE(a),*y = INODE(b);
+	int pa = x->parent,pb = y->parent,pos = x->childPos;
+	long name = x->name;
+	unsigned short len = x->nameLen;
+	index_remove(a);
+	index_remove(b);
+	INODE(pa)->children.child[x->childPos] = b;
+	INODE(pb)->children.child[y->childPos] = a;
+	x->childPos = y->childPos;
+	y->childPos = pos;
+	x->parent = pb;
+	y->parent = pa;
+	x->name = y->name;
+	x->nameLen = y->nameLen;
+	y->name = name;
+	y->nameLen = len;
+	x->nameHash = name_hash(pb,name_str(x->name),x->nameLen);
+	y->nameHash = name_hash(pa,name_str(y->name),y->nameLen);
+	index_insert(x->nameHash,a);
+	index_insert(y->nameHash,b);
+	if(pa!=pb){
+		entry_count(pa,a,-1);
+		entry_count(pb,a,1);
+		entry_count(pb,b,-1);
+		entry_count(pa,b,1);
+	}
+	entry_changed(pa,b);
+	entry_changed(pb,a);
+	notify_entry(pa,name_str(y->name),y->nameLen);
+	notify_entry(pb,name_str(x->name),x->nameLen);
+}
+
+static int dir_contains(int dir,int slot){
+	// whether slot is dir or lies below it, one step per level
+	for(;slot!=-1;slot=INODE(slot)->parent){
+		if(slot==dir)
+			return 1;
+	}
+	return 0;
+}
+
+static const char *base_name(int slot){
+	return name_str(INODE(slot)->name);
+}
+
+static int ns_reset(){
+	int i;
+	for(i=0;i<=NAMECLASSES;i++)
+		disk->arenaFree[i] = -1;
+	return index_init(DIRINDEXMIN);
+}
+
+static int ns_init(){
+	// empty namespace holding only the root directory
+	if(ns_reset())
+		return -ENOMEM;
+	if(inode_alloc('d')!=ROOTDIR)
+		return -ENOMEM;
+	INODE(ROOTDIR)->mode = 0755;
+	INODE(ROOTDIR)->uid = disk->uid;
+	INODE(ROOTDIR)->gid = disk->gid;
+	INODE(ROOTDIR)->name = name_alloc("",0);
+	INODE(ROOTDIR)->nameLen = 0;
+	return (INODE(ROOTDIR)->name==-1) ? -ENOMEM : 0;
+}
+
+static void ns_save(FILE *dataFile){
+	// the table's high water mark, then one record per live slot : slot,
+	// parent, type, size, name length and bytes, extent count and extents,
+	// mode, owner, times, the slot a hard link names and the target of a
+	// symbolic link, size bytes. a slot of -1 ends the list. caller holds
+	// the namespace write lock, each file's lock is taken for its size and
+	// extents
+	int i,end = -1;
+	fwrite(&disk->inodeSlots,sizeof(int),1,dataFile);
+	for(i=0;i<disk->inodeSlots;i++){
+		struct inode *n = INODE(i);
+		if((n->type==0)||n->unlinked)
+			continue;
+		pthread_rwlock_rdlock(&n->lock);
+		fwrite(&i,sizeof(int),1,dataFile);
+		fwrite(&n->parent,sizeof(int),1,dataFile);
+		fwrite(&n->type,1,1,dataFile);
+		fwrite(&n->size,sizeof(off_t),1,dataFile);
+		fwrite(&n->nameLen,sizeof(unsigned short),1,dataFile);
+		fwrite(name_str(n->name),1,n->nameLen,dataFile);
+		fwrite(&n->ext.count,sizeof(int),1,dataFile);
+		if(n->ext.count)
+			fwrite(n->ext.ext,sizeof(struct extent),n->ext.count,dataFile);	// NULL while it has none
+		fwrite(&n->mode,sizeof(mode_t),1,dataFile);
+		fwrite(&n->uid,sizeof(uid_t),1,dataFile);
+		fwrite(&n->gid,sizeof(gid_t),1,dataFile);
+		fwrite(&n->atime,sizeof(int64_t),1,dataFile);
+		fwrite(&n->mtime,sizeof(int64_t),1,dataFile);
+		fwrite(&n->ctime,sizeof(int64_t),1,dataFile);
+		fwrite((n->type=='h') ? &n->link : &end,sizeof(int),1,dataFile);
+		if(n->type=='l')
+			fwrite(name_str(n->target),1,n->size,dataFile);
+		pthread_rwlock_unlock(&n->lock);
+	}
+	fwrite(&end,sizeof(int),1,dataFile);
+}
+
+static int ns_load(FILE *dataFile,int meta){
+	// rebuild the table from ns_save records, then the free list, the
+	// directory lists, link counts and the index. images from before the
+	// records held mode, owner and times (meta 0) get the defaults they
+	// were shown with, and the time of loading
+	int i,e,slots,slot;
+	char name[NAME_MAX+1];
+	char *target = NULL;
+	if(ns_reset())
+		return -ENOMEM;
+	if((fread(&slots,sizeof(int),1,dataFile)!=1)||(slots<1))
+		return -EIO;
+	for(i=0;i<slots;i++){
+		if(inode_grow()!=i)
+			return -ENOMEM;
+	}
+	while((fread(&slot,sizeof(int),1,dataFile)==1)&&(slot!=-1)){
+		if((slot<0)||(slot>=slots))
+			return -EIO;
+		struct inode *n = INODE(slot);
+		fread(&n->parent,sizeof(int),1,dataFile);
+		fread(&n->type,1,1,dataFile);
+		fread(&n->size,sizeof(off_t),1,dataFile);
+		fread(&n->nameLen,sizeof(unsigned short),1,dataFile);
+		if(n->nameLen>NAME_MAX)
+			return -EIO;
+		fread(name,1,n->nameLen,dataFile);
+		n->name = name_alloc(name,n->nameLen);
+		fread(&n->ext.count,sizeof(int),1,dataFile);
+		n->ext.cap = n->ext.count;
+		n->ext.ext = n->ext.count ? (struct extent*) malloc(n->ext.count*sizeof(struct extent)) : NULL;
+		if((n->name==-1)||(n->ext.count && (n->ext.ext==NULL)))
+			return -ENOMEM;
+		if(n->ext.count)
+			fread(n->ext.ext,sizeof(struct extent),n->ext.count,dataFile);
+		for(e=0,n->blocks=0;e<n->ext.count;e++)
+			n->blocks += n->ext.ext[e].count;
+		n->target = -1;
+		n->link = -1;
+		n->nextLink = -1;
+		n->uid = disk->uid;
+		n->gid = disk->gid;
+		n->mode = (n->type=='d') ? 0755 : 0644;
+		n->atime = n->mtime = n->ctime = time_now();
+		if(!meta)
+			continue;
+		fread(&n->mode,sizeof(mode_t),1,dataFile);
+		fread(&n->uid,sizeof(uid_t),1,dataFile);
+		fread(&n->gid,sizeof(gid_t),1,dataFile);
+		fread(&n->atime,sizeof(int64_t),1,dataFile);
+		fread(&n->mtime,sizeof(int64_t),1,dataFile);
+		fread(&n->ctime,sizeof(int64_t),1,dataFile);
+		if(fread(&n->link,sizeof(int),1,dataFile)!=1)
+			return -EIO;
+		if(n->type=='l'){
+			if((n->size<=0)||(n->size>=PATH_MAX))
+				return -EIO;
+			if((target==NULL)&&((target = (char *) malloc(PATH_MAX))==NULL))
+				return -ENOMEM;
+			if(fread(target,1,n->size,dataFile)!=(size_t)n->size)
+				return -EIO;
+			if((n->target = name_alloc(target,n->size))==-1)
+				return -ENOMEM;
+		}
+	}
+	free(target);
+	inode_rebuild_free();
+	for(i=0;i<slots;i++){
+		struct inode *n = INODE(i);
+		if(n->type=='h'){
+			if((n->link<0)||(n->link>=slots)||((INODE(n->link)->type!='r')&&(INODE(n->link)->type!='l')))
+				return -EIO;
+			slot = n->link;
+			n->link = -1;
+			alias_add(i,slot);
+		}
+		n->nlink = (n->type=='d') ? 2 : 0;
+	}
+	for(i=0;i<slots;i++){
+		struct inode *n = INODE(i);
+		if((n->type==0)||(i==ROOTDIR))
+			continue;
+		if((n->parent<0)||(n->parent>=slots)||(INODE(n->parent)->type!='d')||dir_add_child(n->parent,i)||index_reserve()){
+			log_write(LOG_ERROR,"ns_load : orphan entry [%s] at index %d",name_str(n->name),i);
+			return -EIO;
+		}
+		n->nameHash = name_hash(n->parent,name_str(n->name),n->nameLen);
+		index_insert(n->nameHash,i);
+		entry_count(n->parent,i,1);
+	}
+	return 0;
+}
+
+// persistence : with an image the disk survives a crash as well as an
+// unmount. every change is queued as a record for the write ahead
+// journal, <image>.wal.<seq>, which a flusher thread writes out every
+// walFlushMs and fsync waits on. blocks written are flagged in dirtyMap,
+// and a checkpoint thread periodically copies the flagged blocks into
+// the image in place, writes the metadata and a new header after them
+// and drops the journals the checkpoint covers. loading replays what is
+// left of the journal on top of the image
+#define WALMAGIC 0x4c415752
+#define WAL_WRITE 1		// value is the offset, data follows
+#define WAL_TRUNCATE 2		// value is the length
+#define WAL_CREATE 3		// parent, value is the type and WAL_OWNED, a walOwner, the name and a symbolic link's NUL and target follow
+#define WAL_REMOVE 4
+#define WAL_RENAME 5		// parent, name follows
+#define WAL_CEILING 6		// value is the ceiling in blocks
+#define WAL_ALLOCATE 7		// parent is the mode, value the offset, the length follows
+#define WAL_ATTR 8		// a walAttr follows
+#define WAL_LINK 9		// parent, value is the slot linked to, name follows
+#define WAL_EXCHANGE 10		// value is the slot whose name slot trades for its own
+#define WAL_REPLACE 1		// a rename's value : the name it takes is dropped first
+#define WAL_OWNED (1LL<<32)	// a create's walOwner, journals before it have the name alone
+#define WALKICK (4*1024*1024)		// queued bytes that wake the flusher early
+#define WALMAXQUEUE (256*1024*1024)	// queued bytes writers wait at
+#define DEFAULTFLUSHMS 1000
+#define DEFAULTCHECKPOINT 30		// seconds
+#define DEFAULTJOURNALMAX 256		// MB of journal that forces a checkpoint
+struct walRecord {
+	uint32_t magic;
+	uint32_t type;
+	uint64_t length;	// whole record, padded to 8 bytes
+	uint64_t seq;
+	uint64_t check;		// of the record with check zeroed
+	int32_t slot;
+	int32_t parent;
+	int64_t value;
+	uint64_t dataLen;	// name or data bytes after the record
+};
+struct walOwner {
+	uint32_t mode;
+	uint32_t uid;
+	uint32_t gid;
+	uint32_t pad;
+};
+struct walAttr {
+	struct walOwner owner;
+	int64_t atime,mtime,ctime;
+};
+
+
+static int ext_append(struct extentList *list,long lblock,long pblock,long count);
+
+static uint64_t checksum(const void *data,size_t len,uint64_t h){
+	// FNV style over 64-bit words, cheap enough for every journal record
+	const unsigned char *p = (const unsigned char *)data;
+	uint64_t w;
+	for(;len>=8;len-=8,p+=8){
+		memcpy(&w,p,8);
+		h = (h ^ w) * 0x100000001b3ULL;
+	}
+	while(len--)
+		h = (h ^ *p++) * 0x100000001b3ULL;
+	return h ^ (h>>32);
+}
+#define CHECKSEED 0xcbf29ce484222325ULL
+
+static void wal_append(int type,int slot,int parent,int64_t value,const struct iovec *data,int count){
+	// queue one record, its data gathered from count segments. callers
+	// hold the locks that order the change, so the queue is in the order
+	// the changes were made
+	int i;
+	size_t dataLen = 0;
+	if(!disk->walActive)
+		return;
+	for(i=0;i<count;i++)
+		dataLen += data[i].iov_len;
+	size_t len = (sizeof(struct walRecord)+dataLen+7) & ~(size_t)7;
+	pthread_mutex_lock(&disk->walLock);
+	while((disk->walLen>=WALMAXQUEUE)&&!disk->walError){
+		disk->walUrgent = 1;
+		pthread_cond_signal(&disk->walWake);
+		pthread_cond_wait(&disk->walDone,&disk->walLock);
+	}
+	if(disk->walLen+len > disk->walCap){
+		size_t cap = disk->walCap ? disk->walCap : WALKICK;
+		while(cap < disk->walLen+len)
+			cap *= 2;
+		char *queue = (char *) realloc(disk->walQueue,cap);
+		if(queue==NULL){
+			if(!disk->walError)
+				log_write(LOG_ERROR,"wal_append : out of memory, journal incomplete");
+			disk->walError = ENOMEM;
+			pthread_mutex_unlock(&disk->walLock);
+			return;
+		}
+		disk->walQueue = queue;
+		disk->walCap = cap;
+	}
+	struct walRecord *r = (struct walRecord *)(disk->walQueue+disk->walLen);
+	char *p = (char *)(r+1);
+	r->magic = WALMAGIC;
+	r->type = type;
+	r->length = len;
+	r->seq = ++disk->walSeq;
+	r->check = 0;
+	r->slot = slot;
+	r->parent = parent;
+	r->value = value;
+	r->dataLen = dataLen;
+	for(i=0;i<count;i++){
+		if(data[i].iov_len==0)
+			continue;	// its base may be NULL
+		memcpy(p,data[i].iov_base,data[i].iov_len);
+		p += data[i].iov_len;
+	}
+	memset(p,0,(char *)r+len-p);
+	r->check = checksum(r,len,CHECKSEED);
+	disk->walLen += len;
+	if(disk->walLen>=WALKICK){
+		disk->walUrgent = 1;
+		pthread_cond_signal(&disk->walWake);
+	}
+	pthread_mutex_unlock(&disk->walLock);
+}
+
+static void wal_name(int type,int slot,int parent,int64_t value,const char *name,int len){
+	struct iovec v = { (void *)name, (size_t)len };
+	wal_append(type,slot,parent,value,&v,1);
+}
+
+static void wal_create(int slot,const char *name,int len){
+	// the entry just made, with its mode and owner
+	struct inode *n = INODE(slot);
+	struct walOwner o = { n->mode, n->uid, n->gid, 0 };
+	struct iovec v[4] = { { &o, sizeof(o) }, { (void *)name, (size_t)len }, { (void *)"", 1 }, { NULL, 0 } };
+	if(n->type=='l'){
+		v[3].iov_base = name_str(n->target);
+		v[3].iov_len = n->size;
+	}
+	wal_append(WAL_CREATE,slot,n->parent,n->type|WAL_OWNED,v,(n->type=='l') ? 4 : 2);
+}
+
+static void wal_attr(int slot){
+	// mode, owner and times as they now stand
+	struct inode *n = INODE(slot);
+	struct walAttr a = { { n->mode, n->uid, n->gid, 0 }, n->atime, n->mtime, n->ctime };
+	struct iovec v = { &a, sizeof(a) };
+	wal_append(WAL_ATTR,slot,-1,0,&v,1);
+}
+
+static void mark_dirty(const char *p,size_t len){
+	// flag the blocks behind part of the data region for the next checkpoint
+	if((disk->dirtyMap==NULL)||(len==0))
+		return;
+	long b = (p-disk->memoffset)/disk->blocksize;
+	long end = (p-disk->memoffset+len-1)/disk->blocksize;
+	for(;b<=end;b++){
+		uint64_t bit = 1ULL<<(b&63);
+		if(!(__atomic_load_n(&disk->dirtyMap[b>>6],__ATOMIC_RELAXED) & bit))
+			__atomic_fetch_or(&disk->dirtyMap[b>>6],bit,__ATOMIC_RELAXED);
+	}
+}
+
+// statistics : every thread counts the calls it serves on a disk in a
+// private threadStats of that disk's, with no atomics or shared cache
+// lines on the way. a thread keeps one block per disk it served, the
+// last used first. when it exits its blocks stay on their disks' lists
+// for the next thread to take over, so nothing it counted is lost, and
+// /.ramdisk/stats sums the disk's list. latencies go in log2 buckets,
+// bucket b holding calls that took 2^b to 2^(b+1) ns
+#define STATBUCKETS 40
+enum { OP_GETATTR, OP_READDIR, OP_ACCESS, OP_MKDIR, OP_MKNOD, OP_CREATE, OP_OPEN,
+	OP_READ, OP_WRITE, OP_TRUNCATE, OP_FALLOCATE, OP_GETXATTR, OP_UNLINK,
+	OP_RMDIR, OP_RENAME, OP_READLINK, OP_UTIMENS, OP_SYMLINK, OP_LINK,
+	OP_CHMOD, OP_CHOWN, OP_STATFS, OP_RELEASE, OP_FSYNC, OP_LOOKUP, OP_FORGET, OPCOUNT };
+static const char *opNames[OPCOUNT] = { "getattr", "readdir", "access", "mkdir", "mknod", "create", "open",
+	"read", "write", "truncate", "fallocate", "getxattr", "unlink",
+	"rmdir", "rename", "readlink", "utimens", "symlink", "link",
+	"chmod", "chown", "statfs", "release", "fsync", "lookup", "forget" };
+struct opStats {
+	uint64_t calls;
+	uint64_t errors;
+	uint64_t bytes;		// read or written
+	uint64_t ns;
+	uint64_t hist[STATBUCKETS];
+};
+struct threadStats {
+	struct opStats op[OPCOUNT];
+	struct ramdisk *owner;	// the disk counted, NULL once it is freed
+	int live;		// a thread counts into it
+	struct threadStats *next;	// the disk's list
+	struct threadStats *threadNext;	// the thread's blocks
+};
+static __thread struct threadStats *threadStats;
+pthread_mutex_t statsLock = PTHREAD_MUTEX_INITIALIZER;	// the lists and live
+pthread_key_t statsKey;
+
+static void stats_release(void *ts){
+	// thread exit : leave each block to its disk, or free it if the disk
+	// went first
+	struct threadStats *t = (struct threadStats *)ts,*next;
+	pthread_mutex_lock(&statsLock);
+	for(;t;t=next){
+		next = t->threadNext;
+		if(t->owner==NULL){
+			free(t);
+			continue;
+		}
+		t->live = 0;
+		t->threadNext = NULL;
+		__atomic_sub_fetch(&t->owner->statsThreads,1,__ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&statsLock);
+}
+
+static void stats_free(){
+	// the disk goes : blocks with a thread are freed when it exits
+	struct threadStats *t,*next;
+	pthread_mutex_lock(&statsLock);
+	for(t=disk->statsList;t;t=next){
+		next = t->next;
+		if(t->live)
+			__atomic_store_n(&t->owner,NULL,__ATOMIC_RELAXED);
+		else
+			free(t);
+	}
+	disk->statsList = NULL;
+	pthread_mutex_unlock(&statsLock);
+}
+
+static struct threadStats *stats_register(){
+	// the calling thread's block for disk, moved to the front of its
+	// blocks. a block whose thread exited is taken over before a new one
+	// is made
+	struct threadStats **link,*t;
+	for(link=&threadStats;(t = *link)!=NULL;link=&t->threadNext){
+		if(__atomic_load_n(&t->owner,__ATOMIC_RELAXED)==disk)
+			break;
+	}
+	if(t!=NULL){
+		*link = t->threadNext;
+	}else{
+		pthread_mutex_lock(&statsLock);
+		for(t=disk->statsList;t&&t->live;t=t->next)
+			;
+		if(t==NULL){
+			t = (struct threadStats *) calloc(1,sizeof(struct threadStats));
+			if(t==NULL){
+				pthread_mutex_unlock(&statsLock);
+				return NULL;
+			}
+			t->owner = disk;
+			t->next = disk->statsList;
+			disk->statsList = t;
+		}
+		t->live = 1;
+		__atomic_add_fetch(&disk->statsThreads,1,__ATOMIC_RELAXED);
+		pthread_mutex_unlock(&statsLock);
+	}
+	t->threadNext = threadStats;
+	threadStats = t;
+	pthread_setspecific(statsKey,t);
+	return t;
+}
+
+static inline void stat_add(uint64_t *c,uint64_t v){
+	// only the owning thread writes, readers may load at any time
+	__atomic_store_n(c,*c+v,__ATOMIC_RELAXED);
+}
+
+static void stat_count(int op,const struct timespec *t0,long res){
+	// account one call that started at t0 and returned res
+	struct threadStats *t = threadStats;
+	if((t==NULL)||(__atomic_load_n(&t->owner,__ATOMIC_RELAXED)!=disk))
+		t = stats_register();
+	struct timespec t1;
+	if(t==NULL)
+		return;
+	clock_gettime(CLOCK_MONOTONIC,&t1);
+	uint64_t ns = (t1.tv_sec-t0->tv_sec)*1000000000ULL+t1.tv_nsec-t0->tv_nsec;
+	int b = ns ? 63-__builtin_clzll(ns) : 0;
+	struct opStats *s = &t->op[op];
+	stat_add(&s->calls,1);
+	stat_add(&s->ns,ns);
+	stat_add(&s->hist[(b<STATBUCKETS) ? b : STATBUCKETS-1],1);
+	if(res<0)
+		stat_add(&s->errors,1);
+	else if((op==OP_READ)||(op==OP_WRITE))
+		stat_add(&s->bytes,res);
+}
+
+static uint64_t stat_percentile(const struct opStats *s,int pct){
+	// upper bound of the bucket holding the pct-th percentile call
+	uint64_t seen = 0,want = (s->calls*pct+99)/100;
+	int b;
+	for(b=0;b<STATBUCKETS;b++){
+		seen += s->hist[b];
+		if(seen>=want)
+			break;
+	}
+	return 2ULL<<b;
+}
+
+static void bitmap_runs(long *runs,long *largest){
+	// free runs below the fence and the longest one, caller holds allocLock
+	long b,run = 0;
+	*runs = *largest = 0;
+	for(b=0;b<=disk->fenceBlocks;b++){
+		uint64_t w = (b<disk->fenceBlocks) ? disk->bitMap[b>>6] : ~0ULL;
+		int whole = !(b&63)&&(b+64<=disk->fenceBlocks)&&((w==0)||(w==~0ULL));
+		if(whole ? (w==0) : !((w>>(b&63))&1)){
+			run += whole ? 64 : 1;
+		}else if(run){
+			(*runs)++;
+			if(run>*largest)
+				*largest = run;
+			run = 0;
+		}
+		if(whole)
+			b += 63;
+	}
+}
+
+static int ctl_stats_show(char *buf,size_t size){
+	// allocator occupancy and fragmentation, then one line per operation
+	// called so far : calls, errors, bytes, mean and percentile latencies
+	// in ns and the non empty histogram buckets as bucket:count
+	struct threadStats *t;
+	struct opStats sum[OPCOUNT];
+	long runs,largest,avail;
+	int o,b,len;
+	pthread_mutex_lock(&disk->allocLock);
+	bitmap_runs(&runs,&largest);
+	avail = disk->freeBlocks;
+	pthread_mutex_unlock(&disk->allocLock);
+	len = snprintf(buf,size,"blocks %ld\nused %ld\nfree %ld\nfree_runs %ld\nlargest_free_run %ld\nfragmentation %.2f\ninodes %ld\nthreads %d\ncopy %s\n",
+		disk->fenceBlocks,disk->fenceBlocks-avail,avail,runs,largest,avail ? 100.0*(avail-largest)/avail : 0.0,
+		__atomic_load_n(&disk->inodeCount,__ATOMIC_RELAXED),__atomic_load_n(&disk->statsThreads,__ATOMIC_RELAXED),disk->copy->name);
+	pthread_mutex_lock(&statsLock);
+	memset(sum,0,sizeof(sum));
+	for(t=disk->statsList;t;t=t->next){
+		for(o=0;o<OPCOUNT;o++){
+			sum[o].calls += __atomic_load_n(&t->op[o].calls,__ATOMIC_RELAXED);
+			sum[o].errors += __atomic_load_n(&t->op[o].errors,__ATOMIC_RELAXED);
+			sum[o].bytes += __atomic_load_n(&t->op[o].bytes,__ATOMIC_RELAXED);
+			sum[o].ns += __atomic_load_n(&t->op[o].ns,__ATOMIC_RELAXED);
+			for(b=0;b<STATBUCKETS;b++)
+				sum[o].hist[b] += __atomic_load_n(&t->op[o].hist[b],__ATOMIC_RELAXED);
+		}
+	}
+	pthread_mutex_unlock(&statsLock);
+	for(o=0;(o<OPCOUNT)&&(len<(int)size);o++){
+		struct opStats *s = &sum[o];
+		if(s->calls==0)
+			continue;
+		len += snprintf(buf+len,size-len,"%s calls %llu errors %llu bytes %llu avg_ns %llu p50_ns %llu p90_ns %llu p99_ns %llu hist",
+			opNames[o],(unsigned long long)s->calls,(unsigned long long)s->errors,(unsigned long long)s->bytes,
+			(unsigned long long)(s->ns/s->calls),(unsigned long long)stat_percentile(s,50),
+			(unsigned long long)stat_percentile(s,90),(unsigned long long)stat_percentile(s,99));
+		for(b=0;(b<STATBUCKETS)&&(len<(int)size);b++){
+			if(s->hist[b])
+				len += snprintf(buf+len,size-len," %d:%llu",b,(unsigned long long)s->hist[b]);
+		}
+		if(len<(int)size)
+			len += snprintf(buf+len,size-len,"\n");
+	}
+	return len;
+}
+
+// control files : /.ramdisk is a directory kept outside the namespace
+// tables whose files report disk state on read and take settings on
+// write. the text is generated on every read, so they are opened
+// direct_io and report a zero size
+#define CTLDIR RAMDISK_CTLDIR
+#define CTL_NONE -2
+#define CTL_DIR -1
+#define CTLBUFSIZE 8192
+struct ctlFile {
+	const char *name;
+	int (*show)(char *buf,size_t size);		// returns the text length
+	int (*store)(const char *buf,size_t size);	// 0 or -errno
+};
+
+static int disk_resize(long blocks);
+static int ctl_compress_show(char *buf,size_t size);
+static int ctl_compress_store(const char *buf,size_t size);
+static int ctl_dedup_show(char *buf,size_t size);
+
+static int ctl_size_show(char *buf,size_t size){
+	// ceiling in MB, what it can be raised to, and blocks in use
+	long used = __atomic_load_n(&disk->fenceBlocks,__ATOMIC_RELAXED)-__atomic_load_n(&disk->freeBlocks,__ATOMIC_RELAXED);
+	return snprintf(buf,size,"%ld\nmax %ld\nused %ld\n",disk->memorysize/(1024*1024),disk->maxBlocks*disk->blocksize/(1024*1024),used*disk->blocksize/(1024*1024));
+}
+
+static int ctl_size_store(const char *buf,size_t size){
+	// new ceiling in MB
+	char text[32],*end;
+	if(size>=sizeof(text))
+		return -EINVAL;
+	memcpy(text,buf,size);
+	text[size] = '\0';
+	long mb = strtol(text,&end,10);
+	if((end==text)||((*end!='\0')&&(*end!='\n'))||(mb<=0))
+		return -EINVAL;
+	return disk_resize(mb*1024*1024/disk->blocksize);
+}
+
+struct ctlFile ctlFiles[] = {
+	{ "size", ctl_size_show, ctl_size_store },
+	{ "compress", ctl_compress_show, ctl_compress_store },
+	{ "dedup", ctl_dedup_show, NULL },
+	{ "stats", ctl_stats_show, NULL },
+};
+#define CTLCOUNT (int)(sizeof(ctlFiles)/sizeof(ctlFiles[0]))
+
+static int ctl_find(const char *path){
+	// CTL_DIR for the directory, the ctlFiles index for a file, else CTL_NONE
+	int i,len = strlen(CTLDIR);
+	if((path==NULL)||strncmp(path,CTLDIR,len))
+		return CTL_NONE;
+	if(path[len]=='\0')
+		return CTL_DIR;
+	if(path[len]!='/')
+		return CTL_NONE;
+	for(i=0;i<CTLCOUNT;i++){
+		if(!strcmp(path+len+1,ctlFiles[i].name))
+			return i;
+	}
+	return CTL_NONE;
+}
+
+static int ctl_find_at(rd_ino_t dir,const char *name){
+	// ctl_find for name inside the directory numbered dir
+	int i;
+	if(dir==RD_ROOT_INO)
+		return strcmp(name,CTLDIR+1) ? CTL_NONE : CTL_DIR;
+	if(dir==CTLINO){
+		for(i=0;i<CTLCOUNT;i++){
+			if(!strcmp(name,ctlFiles[i].name))
+				return i;
+		}
+	}
+	return CTL_NONE;
+}
+
+static rd_ino_t ctl_ino(int c){
+	return CTLINO+1+c;
+}
+
+static int ino_ctl(rd_ino_t ino){
+	// CTL_DIR or the ctlFiles index ino numbers, else CTL_NONE
+	if((ino<CTLINO)||(ino>CTLINO+CTLCOUNT))
+		return CTL_NONE;
+	return (int)(ino-CTLINO)-1;
+}
+
+static int ctl_getattr(int c,struct stat *stbuf){
+	memset(stbuf, 0, sizeof(struct stat));
+	stbuf->st_ino = ctl_ino(c);
+	stbuf->st_uid = disk->uid;
+	stbuf->st_gid = disk->gid;
+	if(c==CTL_DIR){
+		stbuf->st_mode = S_IFDIR | 0555;
+		stbuf->st_nlink = 2;
+	}else{
+		stbuf->st_mode = S_IFREG | (ctlFiles[c].store ? 0644 : 0444);
+		stbuf->st_nlink = 1;
+	}
+	return 0;
+}
+
+static int ctl_readdir(rd_filler_t filler, void *arg){
+	struct stat st;
+	int i;
+	memset(&st,0,sizeof(st));
+	st.st_mode = S_IFDIR;
+	st.st_ino = CTLINO;
+	if(filler(arg, ".", &st))
+		return 0;
+	st.st_ino = RD_ROOT_INO;
+	if(filler(arg, "..", &st))
+		return 0;
+	st.st_mode = S_IFREG;
+	for(i=0;i<CTLCOUNT;i++){
+		st.st_ino = ctl_ino(i);
+		if(filler(arg, ctlFiles[i].name, &st))
+			break;
+	}
+	return 0;
+}
+
+static int ctl_read(int c,char *buf,size_t size,off_t offset){
+	char text[CTLBUFSIZE];
+	int len = ctlFiles[c].show(text,sizeof(text));
+	if(len>=CTLBUFSIZE)
+		len = CTLBUFSIZE-1;
+	if(offset>=len)
+		return 0;
+	if(size > len-offset)
+		size = len-offset;
+	memcpy(buf,text+offset,size);
+	return (int)size;
+}
+
+static int ctl_write(int c,const char *buf,size_t size,off_t offset){
+	// settings are taken whole from a single write at offset 0
+	if(ctlFiles[c].store==NULL)
+		return -EACCES;
+	if(offset!=0)
+		return -EINVAL;
+	int res = ctlFiles[c].store(buf,size);
+	return res ? res : (int)size;
+}
+
+static mode_t type_bits(int i){
+	switch(INODE(i)->type){
+	case 'd':
+		return S_IFDIR;
+	case 'l':
+		return S_IFLNK;
+	}
+	return S_IFREG;
+}
+
+static void time_spec(int64_t *t,struct timespec *ts){
+	int64_t v = __atomic_load_n(t,__ATOMIC_RELAXED);
+	ts->tv_sec = v/1000000000;
+	ts->tv_nsec = v%1000000000;
+}
+
+static void fill_stat(int i, struct stat *stbuf){
+	// everything comes from the record, caller holds the namespace lock
+	struct inode *n = INODE(i);
+	stbuf->st_ino = SLOT_INO(i);
+	stbuf->st_mode = type_bits(i) | n->mode;
+	stbuf->st_uid = n->uid;
+	stbuf->st_gid = n->gid;
+	stbuf->st_nlink = n->nlink;
+	time_spec(&n->atime,&stbuf->st_atim);
+	time_spec(&n->mtime,&stbuf->st_mtim);
+	time_spec(&n->ctime,&stbuf->st_ctim);
+	stbuf->st_blksize = disk->blocksize;
+	if(n->type=='d'){
+		stbuf->st_size = 4096;
+	}else{
+		stbuf->st_size = __atomic_load_n(&n->size,__ATOMIC_RELAXED);
+		stbuf->st_blocks = __atomic_load_n(&n->blocks,__ATOMIC_RELAXED)*(disk->blocksize/512);
+	}
+}
+
+static int do_getattr(const char *path, struct stat *stbuf)
+{
+	int res = 0;
+	log_write(LOG_TRACE,"ramdisk_getattr called with path : %s",path);
+
+	memset(stbuf, 0, sizeof(struct stat));
+	
+	if (strcmp(path, "/") == 0) {
+		fill_stat(ROOTDIR,stbuf);
+		return res;
+	}
+
+	int c = ctl_find(path);
+	if(c!=CTL_NONE)
+		return ctl_getattr(c,stbuf);
+	
+	int i = lookup_path(path);
+	if(i>=0){
+		//found path
+		fill_stat(i,stbuf);
+		log_write(LOG_TRACE,"FOUND path [%s] at index : %d",path,i);
+		return res;
+	}
+	log_write(LOG_TRACE,"Couldn't find path [%s]",path);
+	
+	return i;
+}
+
+static int ramdisk_stat(const char *path, struct stat *stbuf)
+{
+	ns_read_lock();
+	int res = do_getattr(path,stbuf);
+	ns_read_unlock();
+	return res;
+}
+
+static int dir_list(int dir, rd_filler_t filler, void *arg){
+	// ".", ".." and every entry of dir with its number and type
+	struct stat st;
+	int i;
+	memset(&st,0,sizeof(st));
+	st.st_mode = S_IFDIR;
+	st.st_ino = SLOT_INO(dir);
+	if(filler(arg, ".", &st))
+		return 0;
+	st.st_ino = SLOT_INO((INODE(dir)->parent==-1) ? dir : INODE(dir)->parent);
+	if(filler(arg, "..", &st))
+		return 0;
+	struct childList *list = &INODE(dir)->children;
+	for(i=0;i<list->count;i++){
+		int c = list->child[i],t = entry_target(c);
+		st.st_ino = SLOT_INO(t);
+		st.st_mode = type_bits(t);
+		if(filler(arg, base_name(c), &st))
+			break;
+	}
+	inode_accessed(dir);
+	return 0;
+}
+
+static int do_readdir(const char *path, rd_filler_t filler, void *arg){
+	log_write(LOG_TRACE,"ramdisk_readdir called with path : %s",path);
+
+	int dir;
+	if(path==NULL)
+		return -ENOENT;
+	if(ctl_find(path)==CTL_DIR)
+		return ctl_readdir(filler,arg);
+	if(!strcmp(path, "/")){
+		dir = ROOTDIR;
+	}else{
+		dir = lookup_path(path);
+		// check if directory exists
+		if(dir<0)
+			return dir;
+		if(INODE(dir)->type!='d')
+			return -ENOTDIR;
+	}
+	return dir_list(dir,filler,arg);
+}
+
+static struct openFile *fd_get(int fd);
+
+static int ramdisk_fstat(int fd, struct stat *stbuf)
+{
+	struct openFile *f = fd_get(fd);
+	if(f==NULL)
+		return -EBADF;
+	if(f->ctl!=CTL_NONE)
+		return ctl_getattr(f->ctl,stbuf);
+	memset(stbuf, 0, sizeof(struct stat));
+	fill_stat(f->index,stbuf);
+	return 0;
+}
+
+static int ramdisk_readdir(const char *path, rd_filler_t filler, void *arg){
+	ns_read_lock();
+	int res = do_readdir(path,filler,arg);
+	ns_read_unlock();
+	return res;
+}
+
+static int dir_create(int parent,const char *name,int len,mode_t mode){
+	// a new directory name inside parent, returns its slot or -errno.
+	// caller holds the namespace write lock
+	if(INODE(parent)->unlinked)
+		return -ENOENT;
+	if(lookup_child(parent,name,len)!=-1)
+		return -EEXIST;
+
+	int i = inode_alloc('d');
+	if(i==-1){
+		return -ENOMEM;
+	}
+	INODE(i)->mode = mode & 07777;
+	
+	int res = entry_add(parent,i,name,len);
+	if(res){
+		inode_free(i);
+		return res;
+	}
+	wal_create(i,name,len);
+	return i;
+}
+
+static int do_mkdir(const char *path, mode_t mode){
+	log_write(LOG_TRACE,"ramdisk_mkdir called with path : %s",path);
+	int i = lookup_path(path);
+	if(i>=0)
+		return -EEXIST;
+	if(i==-ENOTDIR)
+		return i;
+
+	const char *name;
+	int len;
+	int parent = lookup_parent(path,&name,&len);
+	if(parent<0)
+		return parent;
+	int res = dir_create(parent,name,len,mode);
+	return (res<0) ? res : 0;
+}
+
+static int ramdisk_mkdir(const char *path, mode_t mode){
+	if(ctl_find(path)!=CTL_NONE)
+		return -EEXIST;
+	ns_write_lock();
+	int res = do_mkdir(path,mode);
+	ns_write_unlock();
+	return res;
+}
+
+static void bitmap_fill(long start,long count,int set){
+	// set or clear count bits from start, whole words at a time where possible
+	while(count>0){
+		int bit = start&63;
+		long run = 64-bit;
+		if(run > count)
+			run = count;
+		uint64_t mask = (run==64) ? ~0ULL : (((1ULL<<run)-1) << bit);
+		if(set)
+			disk->bitMap[start>>6] |= mask;
+		else
+			disk->bitMap[start>>6] &= ~mask;
+		start += run;
+		count -= run;
+	}
+}
+
+static int bitmap_init(){
+	// every block free up to fenceBlocks, fenced from there to maxBlocks
+	// and on the padding bits of the last word
+	disk->bitMapWords = (disk->maxBlocks+63)/64;
+	disk->bitMap = (uint64_t*) calloc(disk->bitMapWords,sizeof(uint64_t));
+	disk->chunkBlocks = CHUNKSIZE/disk->blocksize;
+	disk->chunkCount = (disk->maxBlocks+disk->chunkBlocks-1)/disk->chunkBlocks;
+	disk->chunkUsed = (int*) calloc(disk->chunkCount,sizeof(int));
+	disk->chunkResident = (char*) calloc(disk->chunkCount,1);
+	if((disk->bitMap==NULL)||(disk->chunkUsed==NULL)||(disk->chunkResident==NULL))
+		return -ENOMEM;
+	bitmap_fill(disk->fenceBlocks,disk->bitMapWords*64-disk->fenceBlocks,1);
+	disk->freeBlocks = disk->fenceBlocks;
+	disk->nextFitHint = 0;
+	disk->emptyResident = 0;
+	return 0;
+}
+
+static void data_release(long offset,long len){
+	// give the pages behind part of the data region back to the OS, they
+	// read back as zeros. madvise only unmaps shared memfd pages, so
+	// those are punched out of the file instead
+	if(disk->dataFd!=-1)
+		fallocate(disk->dataFd,FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE,offset,len);
+	else
+		madvise(disk->memoffset+offset,len,MADV_DONTNEED);
+}
+
+static void data_commit(long offset,long len){
+	// fault a range in up front rather than one page at a time on first
+	// write, best effort
+#ifdef MADV_POPULATE_WRITE
+	madvise(disk->memoffset+offset,len,MADV_POPULATE_WRITE);
+#endif
+}
+
+#ifdef COPY_X86
+// the stores proper : the head up to the first aligned address and the
+// tail are left to libc, the fence orders the streamed stores before
+// whatever the caller does next, such as dropping the file's lock
+__attribute__((target("sse2"))) static void store_sse2(char *dst,const char *src,size_t len){
+	size_t head = (-(uintptr_t)dst) & 15;
+	if(head>len)
+		head = len;
+	memcpy(dst,src,head);
+	dst += head;
+	src += head;
+	len -= head;
+	for(;len>=64;len-=64,dst+=64,src+=64){
+		__m128i a = _mm_loadu_si128((const __m128i *)src),b = _mm_loadu_si128((const __m128i *)(src+16));
+		__m128i c = _mm_loadu_si128((const __m128i *)(src+32)),d = _mm_loadu_si128((const __m128i *)(src+48));
+		_mm_stream_si128((__m128i *)dst,a);
+		_mm_stream_si128((__m128i *)(dst+16),b);
+		_mm_stream_si128((__m128i *)(dst+32),c);
+		_mm_stream_si128((__m128i *)(dst+48),d);
+	}
+	_mm_sfence();
+	memcpy(dst,src,len);
+}
+
+__attribute__((target("sse2"))) static void clear_sse2(char *dst,size_t len){
+	size_t head = (-(uintptr_t)dst) & 15;
+	if(head>len)
+		head = len;
+	__m128i z = _mm_setzero_si128();
+	memset(dst,0,head);
+	dst += head;
+	len -= head;
+	for(;len>=64;len-=64,dst+=64){
+		_mm_stream_si128((__m128i *)dst,z);
+		_mm_stream_si128((__m128i *)(dst+16),z);
+		_mm_stream_si128((__m128i *)(dst+32),z);
+		_mm_stream_si128((__m128i *)(dst+48),z);
+	}
+	_mm_sfence();
+	memset(dst,0,len);
+}
+
+__attribute__((target("avx2"))) static void store_avx2(char *dst,const char *src,size_t len){
+	size_t head = (-(uintptr_t)dst) & 31;
+	if(head>len)
+		head = len;
+	memcpy(dst,src,head);
+	dst += head;
+	src += head;
+	len -= head;
+	for(;len>=128;len-=128,dst+=128,src+=128){
+		__m256i a = _mm256_loadu_si256((const __m256i *)src),b = _mm256_loadu_si256((const __m256i *)(src+32));
+		__m256i c = _mm256_loadu_si256((const __m256i *)(src+64)),d = _mm256_loadu_si256((const __m256i *)(src+96));
+		_mm256_stream_si256((__m256i *)dst,a);
+		_mm256_stream_si256((__m256i *)(dst+32),b);
+		_mm256_stream_si256((__m256i *)(dst+64),c);
+		_mm256_stream_si256((__m256i *)(dst+96),d);
+	}
+	_mm_sfence();
+	memcpy(dst,src,len);
+}
+
+__attribute__((target("avx2"))) static void clear_avx2(char *dst,size_t len){
+	size_t head = (-(uintptr_t)dst) & 31;
+	if(head>len)
+		head = len;
+	__m256i z = _mm256_setzero_si256();
+	memset(dst,0,head);
+	dst += head;
+	len -= head;
+	for(;len>=128;len-=128,dst+=128){
+		_mm256_stream_si256((__m256i *)dst,z);
+		_mm256_stream_si256((__m256i *)(dst+32),z);
+		_mm256_stream_si256((__m256i *)(dst+64),z);
+		_mm256_stream_si256((__m256i *)(dst+96),z);
+	}
+	_mm_sfence();
+	memset(dst,0,len);
+}
+#endif
+
+static const struct copyEngine copyEngines[] = {
+	{ "libc", NULL, NULL },
+#ifdef COPY_X86
+	{ "sse2", store_sse2, clear_sse2 },
+	{ "avx2", store_avx2, clear_avx2 },
+#endif
+};
+
+static const struct copyEngine *copy_engine(int kind){
+	// the stores kind names, NULL when the CPU lacks them
+#ifdef COPY_X86
+	__builtin_cpu_init();
+	int sse2 = __builtin_cpu_supports("sse2"),avx2 = __builtin_cpu_supports("avx2");
+	if(kind==COPY_AUTO)
+		kind = avx2 ? COPY_AVX2 : (sse2 ? COPY_SSE2 : COPY_LIBC);
+	if(((kind==COPY_SSE2)&&!sse2)||((kind==COPY_AVX2)&&!avx2))
+		return NULL;
+#else
+	if(kind==COPY_AUTO)
+		kind = COPY_LIBC;
+	if(kind!=COPY_LIBC)
+		return NULL;
+#endif
+	return &copyEngines[kind-COPY_LIBC];
+}
+
+static void block_store(char *dst,const char *src,size_t len,size_t whole){
+	// len bytes into the blocks, part of a store of whole bytes
+	if((whole>=COPYSTREAM)&&disk->copy->store)
+		disk->copy->store(dst,src,len);
+	else
+		memcpy(dst,src,len);
+}
+
+static void block_clear(char *dst,size_t len,size_t whole){
+	if((whole>=COPYSTREAM)&&disk->copy->clear)
+		disk->copy->clear(dst,len);
+	else
+		memset(dst,0,len);
+}
+
+static void data_zero(long start,long count){
+	// zero a run of blocks. released pages read back as zeros, but not
+	// under a mapped image, which shows through, nor on huge pages, which
+	// cannot be given back a block at a time
+	char *p = disk->memoffset+start*disk->blocksize;
+	if((count<=2)||(disk->dataBacking==BACKING_IMAGE)||(disk->dataBacking==BACKING_HUGETLB))
+		block_clear(p,count*disk->blocksize,count*disk->blocksize);
+	else
+		data_release(start*disk->blocksize,count*disk->blocksize);
+	mark_dirty(p,count*disk->blocksize);
+}
+
+static void chunk_empty(long c){
+	// a chunk just lost its last block, caller holds allocLock
+	if(disk->emptyResident < disk->keepChunks){
+		disk->emptyResident++;
+	}else{
+		data_release(c*CHUNKSIZE,CHUNKSIZE);
+		disk->chunkResident[c] = 0;
+	}
+}
+
+static int chunk_take(long start,long count){
+	// account a run handed out by the allocator, caller holds allocLock.
+	// returns 1 when part of the run lies in chunks not committed yet
+	long c,end = start+count;
+	int fresh = 0;
+	for(c=start/disk->chunkBlocks;c*disk->chunkBlocks<end;c++){
+		long lo = (c*disk->chunkBlocks > start) ? c*disk->chunkBlocks : start;
+		long hi = ((c+1)*disk->chunkBlocks < end) ? (c+1)*disk->chunkBlocks : end;
+		if(!disk->chunkResident[c]){
+			disk->chunkResident[c] = 1;
+			fresh = 1;
+		}else if(disk->chunkUsed[c]==0){
+			disk->emptyResident--;
+		}
+		disk->chunkUsed[c] += hi-lo;
+	}
+	return fresh;
+}
+
+static void chunk_give(long start,long count){
+	// account a freed run, caller holds allocLock
+	long c,end = start+count;
+	for(c=start/disk->chunkBlocks;c*disk->chunkBlocks<end;c++){
+		long lo = (c*disk->chunkBlocks > start) ? c*disk->chunkBlocks : start;
+		long hi = ((c+1)*disk->chunkBlocks < end) ? (c+1)*disk->chunkBlocks : end;
+		disk->chunkUsed[c] -= hi-lo;
+		if(disk->chunkUsed[c]==0)
+			chunk_empty(c);
+	}
+}
+
+static void bitmap_recount(){
+	// rebuild the free counter and the chunk usage after a bitmap is
+	// loaded from disk. fence bits count as used, they are not in chunks.
+	// every chunk is taken as resident, the empty ones then go through
+	// the usual release policy
+	long i,used=0;
+	for(i=0;i<disk->bitMapWords;i++)
+		used += __builtin_popcountll(disk->bitMap[i]);
+	disk->freeBlocks = disk->bitMapWords*64 - used;
+	disk->nextFitHint = 0;
+	disk->emptyResident = 0;
+	for(i=0;i<disk->chunkCount;i++){
+		long b,end = (i+1)*disk->chunkBlocks;
+		if(end>disk->fenceBlocks)
+			end = disk->fenceBlocks;
+		disk->chunkUsed[i] = 0;
+		for(b=i*disk->chunkBlocks;b<end;b++)
+			disk->chunkUsed[i] += (disk->bitMap[b>>6] >> (b&63)) & 1;
+		disk->chunkResident[i] = (i*disk->chunkBlocks < disk->fenceBlocks);
+		if(disk->chunkResident[i] && (disk->chunkUsed[i]==0))
+			chunk_empty(i);
+	}
+}
+
+// cold block compression (-o compress=SECONDS) : a scanner thread deflates
+// the blocks of files nobody touched for a while into malloc'd buffers and
+// gives their pages back. every access sets a block's hot bit and each
+// pass clears them, so a block still clear on the next pass went a whole
+// period untouched. an access that finds the cold bit set inflates the
+// block back in place before it goes on. with compression on the fence
+// moves to maxBlocks and the ceiling bounds memory instead of blocks :
+// the resident blocks plus the pool must fit under it, so the disk holds
+// as much more than memorysize as its data compresses
+#define DEFAULTCOMPRESSRATIO 50	// percent of a block its deflated copy must fit in
+#define DEFAULTCOMPRESSHIGH 90	// percent of the ceiling resident that starts a pass early
+#define COMPRESSRESERVE 4	// default reservation in ceilings when compress is on
+#define TIERCHUNKBITS 12	// pool slots per table part
+#define TIERCHUNK (1L<<TIERCHUNKBITS)
+#define TIERBATCH 64		// blocks compressed per lock hold
+#define TIERPRESSUREMS 200	// least time between passes under memory pressure
+#define TIERWAIT 2		// s an allocation waits on a full ceiling for a pass
+struct coldBlock {
+	uint32_t length;
+	char data[];
+};
+
+static int tier_is_cold(long b){
+	return disk->coldMap && ((__atomic_load_n(&disk->coldMap[b>>6],__ATOMIC_SEQ_CST) >> (b&63)) & 1);
+}
+
+static long tier_resident(){
+	// blocks worth of memory the disk holds : blocks in use that are not
+	// cold, plus the pool
+	long used = __atomic_load_n(&disk->fenceBlocks,__ATOMIC_RELAXED)-__atomic_load_n(&disk->freeBlocks,__ATOMIC_RELAXED);
+	long pool = (__atomic_load_n(&disk->poolBytes,__ATOMIC_RELAXED)+disk->blocksize-1)/disk->blocksize;
+	return used-__atomic_load_n(&disk->coldBlocks,__ATOMIC_RELAXED)+pool;
+}
+
+static void tier_wake(){
+	// start a pass early, memory is running short
+	pthread_mutex_lock(&disk->tierLock);
+	disk->tierKick = 1;
+	pthread_cond_signal(&disk->tierWake);
+	pthread_mutex_unlock(&disk->tierLock);
+}
+
+static void tier_wait(){
+	// the ceiling is full : kick a pass and wait for it to end, so a
+	// write only fails once compressing did not make room
+	struct timespec until;
+	pthread_mutex_lock(&disk->tierLock);
+	uint64_t target = disk->tierPasses+(disk->tierScanning ? 2 : 1);
+	disk->tierKick = 1;
+	pthread_cond_signal(&disk->tierWake);
+	clock_gettime(CLOCK_REALTIME,&until);
+	until.tv_sec += TIERWAIT;
+	while((disk->tierPasses<target)&&!disk->tierStop){
+		if(pthread_cond_timedwait(&disk->tierDone,&disk->tierLock,&until))
+			break;
+	}
+	pthread_mutex_unlock(&disk->tierLock);
+}
+
+static void tier_forget(long b){
+	// drop block b's deflated copy, caller holds tierLock
+	struct coldBlock **slot = &disk->coldPool[b>>TIERCHUNKBITS][b&(TIERCHUNK-1)];
+	__atomic_sub_fetch(&disk->poolBytes,(long)(*slot)->length,__ATOMIC_RELAXED);
+	__atomic_sub_fetch(&disk->coldBlocks,1,__ATOMIC_RELAXED);
+	free(*slot);
+	*slot = NULL;
+	__atomic_fetch_and(&disk->coldMap[b>>6],~(1ULL<<(b&63)),__ATOMIC_SEQ_CST);
+}
+
+static void tier_drop(long start,long count){
+	// forget the deflated copies of a freed run, caller holds allocLock
+	long b;
+	if(disk->coldMap==NULL)
+		return;
+	pthread_mutex_lock(&disk->tierLock);
+	for(b=start;b<start+count;b++){
+		if(disk->coldMap[b>>6]==0)
+			b |= 63;
+		else if((disk->coldMap[b>>6] >> (b&63)) & 1)
+			tier_forget(b);
+	}
+	pthread_mutex_unlock(&disk->tierLock);
+}
+
+// block dedup (-o dedup) : the blocks a write fills whole are hashed and
+// looked up in an index of block contents, and a block found there with
+// the same bytes is shared instead of kept. shareCount holds the owners
+// of a block beyond the first, it goes with the last one, and a write
+// to a shared block copies it first. a block leaves the index before it
+// is written or freed. blocks an image shares stay shared when it is
+// loaded, but only go into the index once they are written again
+#define DEDUPINDEXBITS 12	// initial index size, log2
+#define DEDUPBATCH 64		// blocks hashed per lock hold
+
+static int share_init(){
+	if(disk->shareCount==NULL)
+		disk->shareCount = (uint32_t *) calloc(disk->maxBlocks,sizeof(uint32_t));
+	return disk->shareCount ? 0 : -ENOMEM;
+}
+
+#define HASHPRIME1 0x9e3779b185ebca87ULL
+#define HASHPRIME2 0xc2b2ae3d27d4eb4fULL
+#define ROTL(x,r) (((x)<<(r))|((x)>>(64-(r))))
+static uint64_t block_hash(const char *data){
+	// every block a write fills is hashed, so unlike checksum this runs
+	// four lanes whose multiplies overlap, one multiply per word, and a
+	// final mix to bring the high bits down. never 0
+	const uint64_t *w = (const uint64_t *)data;
+	uint64_t a = CHECKSEED,b = HASHPRIME1,c = HASHPRIME2,d = 0;
+	long i,n = disk->blocksize/8;
+	for(i=0;i<n;i+=4){
+		a = (a^w[i])*HASHPRIME1;
+		b = (b^w[i+1])*HASHPRIME1;
+		c = (c^w[i+2])*HASHPRIME1;
+		d = (d^w[i+3])*HASHPRIME1;
+	}
+	uint64_t h = ROTL(a,1)+ROTL(b,7)+ROTL(c,12)+ROTL(d,18);
+	h = (h^(h>>33))*HASHPRIME2;
+	h = (h^(h>>29))*HASHPRIME1;
+	return (h^(h>>32))|1;
+}
+
+static unsigned long dedup_slot(uint64_t h){
+	// fibonacci hashing, the low bits of the hash alone mix poorly
+	return (unsigned long)((h*0x9e3779b97f4a7c15ULL) >> (64-disk->dedupBits));
+}
+
+static int dedup_grow(){
+	// double the index, caller holds allocLock
+	int bits = disk->dedupBits ? disk->dedupBits+1 : DEDUPINDEXBITS;
+	unsigned long i,s,oldSize = disk->dedupIndex ? 1UL<<disk->dedupBits : 0;
+	unsigned long mask = (1UL<<bits)-1;
+	long *old = disk->dedupIndex;
+	long *index = (long *) calloc(1UL<<bits,sizeof(long));
+	if(index==NULL)
+		return -ENOMEM;
+	disk->dedupIndex = index;
+	disk->dedupBits = bits;
+	for(i=0;i<oldSize;i++){
+		if(!old[i])
+			continue;
+		for(s=dedup_slot(disk->blockHash[old[i]-1]);index[s];s=(s+1)&mask);
+		index[s] = old[i];
+	}
+	free(old);
+	return 0;
+}
+
+static void dedup_insert(long b,uint64_t h){
+	// index block b under h, caller holds allocLock. when the index cannot
+	// grow the block is simply not indexed
+	unsigned long s;
+	if(((disk->dedupUsed+1)*2 > (1L<<disk->dedupBits))&&dedup_grow())
+		return;
+	for(s=dedup_slot(h);disk->dedupIndex[s];s=(s+1)&((1UL<<disk->dedupBits)-1));
+	disk->dedupIndex[s] = b+1;
+	disk->blockHash[b] = h;
+	disk->dedupUsed++;
+}
+
+static void dedup_remove(long b){
+	// take block b out of the index, caller holds allocLock. the entries
+	// after it shift back so no probe run is cut short
+	unsigned long mask = (1UL<<disk->dedupBits)-1;
+	unsigned long i,j,k;
+	for(i=dedup_slot(disk->blockHash[b]);disk->dedupIndex[i]!=b+1;i=(i+1)&mask);
+	disk->blockHash[b] = 0;
+	disk->dedupUsed--;
+	disk->dedupIndex[i] = 0;
+	for(j=(i+1)&mask;disk->dedupIndex[j];j=(j+1)&mask){
+		k = dedup_slot(disk->blockHash[disk->dedupIndex[j]-1]);
+		if((i<=j) ? ((i<k)&&(k<=j)) : ((i<k)||(k<=j)))
+			continue;	// still reachable from its home slot
+		disk->dedupIndex[i] = disk->dedupIndex[j];
+		disk->dedupIndex[j] = 0;
+		i = j;
+	}
+}
+
+static long dedup_find(uint64_t h,long b){
+	// a block other than b with the same bytes, or -1. caller holds
+	// allocLock, which keeps the candidates from going cold meanwhile
+	unsigned long s;
+	for(s=dedup_slot(h);disk->dedupIndex[s];s=(s+1)&((1UL<<disk->dedupBits)-1)){
+		long p = disk->dedupIndex[s]-1;
+		if((p!=b)&&(disk->blockHash[p]==h)&&(disk->shareCount[p]<UINT32_MAX)&&!tier_is_cold(p)&&
+			!memcmp(disk->memoffset+p*disk->blocksize,disk->memoffset+b*disk->blocksize,disk->blocksize))
+			return p;
+	}
+	return -1;
+}
+
+static int dedup_init(){
+	disk->blockHash = (uint64_t *) calloc(disk->maxBlocks,sizeof(uint64_t));
+	if((disk->blockHash==NULL)||share_init()||dedup_grow())
+		return -ENOMEM;
+	return 0;
+}
+
+static long alloc_run(long want,long *got){
+	// allocate up to want contiguous blocks, next-fit from nextFitHint
+	// returns the first block and stores the run length in got,
+	// or -1 when the disk is full
+	long w,scanned;
+	int pressure = 0;
+	*got = 0;
+	if(want<=0)
+		return -1;
+	pthread_mutex_lock(&disk->allocLock);
+	if(disk->coldAge&&disk->tierBudget){
+		// with compression on the ceiling is a memory budget, a full one
+		// waits for a pass before the allocation fails. replaying a
+		// journal is not held to it, the scanner is not running yet and
+		// the blocks were already there when the disk went down
+		long room = disk->blockcount-tier_resident();
+		if((room<=0)&&disk->tierRunning){
+			pthread_mutex_unlock(&disk->allocLock);
+			tier_wait();
+			pthread_mutex_lock(&disk->allocLock);
+			room = disk->blockcount-tier_resident();
+		}
+		if(room<=0){
+			pthread_mutex_unlock(&disk->allocLock);
+			return -1;
+		}
+		if(want > room)
+			want = room;
+		pressure = (disk->blockcount-room+want)*100 >= disk->blockcount*disk->coldHigh;
+	}
+	w = disk->nextFitHint;
+	scanned = (disk->freeBlocks==0) ? disk->bitMapWords : 0;
+	for(;scanned<disk->bitMapWords;scanned++){
+		if(disk->bitMap[w] != ~0ULL)
+			break;
+		w = (w+1==disk->bitMapWords) ? 0 : w+1;
+	}
+	if(scanned==disk->bitMapWords){
+		pthread_mutex_unlock(&disk->allocLock);
+		return -1;
+	}
+
+	long start = w*64 + __builtin_ctzll(~disk->bitMap[w]);
+	long block = start,n = 0;
+	while(n<want){
+		uint64_t *word = &disk->bitMap[block>>6];
+		int bit = block&63;
+		uint64_t freeBits = (~*word) >> bit;
+		int run = (freeBits==~0ULL) ? 64 : __builtin_ctzll(~freeBits);
+		if(run > 64-bit)
+			run = 64-bit;
+		if(run > want-n)
+			run = want-n;
+		if(run==0)
+			break;
+		*word |= (run==64) ? ~0ULL : (((1ULL<<run)-1) << bit);
+		n += run;
+		block += run;
+		if(((block&63)!=0)||(block>=disk->fenceBlocks))
+			break;	// stopped on a used bit inside the word or at the end
+	}
+	__atomic_sub_fetch(&disk->freeBlocks,n,__ATOMIC_RELAXED);
+	disk->nextFitHint = ((block>>6) < disk->bitMapWords) ? (block>>6) : 0;
+	int fresh = chunk_take(start,n);
+	pthread_mutex_unlock(&disk->allocLock);
+	// the run is ours now, nothing can release its chunks under us
+	if(fresh)
+		data_commit(start*disk->blocksize,n*disk->blocksize);
+	if(pressure)
+		tier_wake();
+	*got = n;
+	return start;
+}
+
+static void free_run_locked(long start,long count){
+	tier_drop(start,count);
+	__atomic_add_fetch(&disk->freeBlocks,count,__ATOMIC_RELAXED);
+	bitmap_fill(start,count,0);
+	chunk_give(start,count);
+}
+
+static void free_run(long start,long count,int punch){
+	// drop an owner of each block of a run : a shared block only loses
+	// the owner, the others leave the index, have their pages punched
+	// when punch is set and are freed. while a checkpoint copies blocks a
+	// freed run is held back, so the blocks its metadata still maps
+	// cannot be handed to another file
+	long b;
+	pthread_mutex_lock(&disk->allocLock);
+	while(count>0){
+		long n = 1;
+		if(disk->shareCount && disk->shareCount[start]){
+			// atomic as tier_scan and file_unshare read it unlocked
+			__atomic_sub_fetch(&disk->shareCount[start],1,__ATOMIC_RELAXED);
+			disk->sharedRefs--;
+		}else{
+			if(disk->shareCount==NULL)
+				n = count;
+			while((n<count)&&!disk->shareCount[start+n])
+				n++;
+			if(disk->blockHash){
+				for(b=start;b<start+n;b++){
+					if(disk->blockHash[b])
+						dedup_remove(b);
+				}
+			}
+			if(punch)
+				data_release(start*disk->blocksize,n*disk->blocksize);
+			if(!disk->ckptActive || ext_append(&disk->ckptDeferred,disk->ckptDeferredBlocks,start,n))
+				free_run_locked(start,n);
+			else
+				disk->ckptDeferredBlocks += n;
+		}
+		start += n;
+		count -= n;
+	}
+	pthread_mutex_unlock(&disk->allocLock);
+}
+
+static int disk_resize(long blocks){
+	// move the ceiling to blocks. raising clears the fence up to it,
+	// lowering needs every block past the new ceiling free and gives the
+	// empty chunks there back to the OS. with compression on the fence
+	// stays at maxBlocks and lowering only needs the memory in use to fit
+	long b,c;
+	int res = 0;
+	if((blocks<=0)||(blocks>disk->maxBlocks))
+		return -ENOSPC;
+	pthread_mutex_lock(&disk->allocLock);
+	if(disk->coldAge){
+		if(tier_resident()>blocks)
+			res = -EBUSY;
+	}else if(blocks>disk->blockcount){
+		bitmap_fill(disk->blockcount,blocks-disk->blockcount,0);
+		__atomic_add_fetch(&disk->freeBlocks,blocks-disk->blockcount,__ATOMIC_RELAXED);
+	}else if(blocks<disk->blockcount){
+		for(b=blocks;(b<disk->blockcount)&&!res;b++){
+			if((disk->bitMap[b>>6] >> (b&63)) & 1)
+				res = -EBUSY;
+		}
+		if(!res){
+			bitmap_fill(blocks,disk->blockcount-blocks,1);
+			__atomic_sub_fetch(&disk->freeBlocks,disk->blockcount-blocks,__ATOMIC_RELAXED);
+			for(c=(blocks+disk->chunkBlocks-1)/disk->chunkBlocks;c<disk->chunkCount;c++){
+				if(disk->chunkResident[c]){
+					data_release(c*CHUNKSIZE,CHUNKSIZE);
+					disk->chunkResident[c] = 0;
+					disk->emptyResident--;
+				}
+			}
+		}
+	}
+	if(!res){
+		disk->blockcount = blocks;
+		disk->memorysize = blocks*disk->blocksize;
+		if(!disk->coldAge)
+			__atomic_store_n(&disk->fenceBlocks,blocks,__ATOMIC_RELAXED);
+		wal_append(WAL_CEILING,-1,-1,blocks,NULL,0);
+	}
+	pthread_mutex_unlock(&disk->allocLock);
+	log_write(LOG_INFO,"disk_resize : %ld blocks, res %d",blocks,res);
+	return res;
+}
+
+static int ext_find(struct extentList *list,long lblock){
+	// binary search for the extent holding lblock, -1 if unmapped
+	int lo=0,hi=list->count-1;
+	while(lo<=hi){
+		int mid = (lo+hi)/2;
+		struct extent *e = &list->ext[mid];
+		if(lblock < e->lblock)
+			hi = mid-1;
+		else if(lblock >= e->lblock+e->count)
+			lo = mid+1;
+		else
+			return mid;
+	}
+	return -1;
+}
+
+static int ext_seek(struct extentList *list,long lblock,int hint){
+	// sequential access lands in the hinted extent or the one after it,
+	// anything else falls back to the binary search
+	if((hint>=0)&&(hint<list->count)){
+		struct extent *e = &list->ext[hint];
+		if((lblock>=e->lblock)&&(lblock<e->lblock+e->count))
+			return hint;
+		if((hint+1<list->count)&&(lblock>=e[1].lblock)&&(lblock<e[1].lblock+e[1].count))
+			return hint+1;
+	}
+	return ext_find(list,lblock);
+}
+
+static int ext_room(struct extentList *list,int more){
+	// make room for more extents
+	if(list->count+more > list->cap){
+		int cap = list->cap ? list->cap*2 : 4;
+		struct extent *ext = (struct extent*) realloc(list->ext,cap*sizeof(struct extent));
+		if(ext==NULL)
+			return -ENOMEM;
+		list->ext = ext;
+		list->cap = cap;
+	}
+	return 0;
+}
+
+static int ext_append(struct extentList *list,long lblock,long pblock,long count){
+	// add a run after the last extent, merging when it continues it on disk
+	if(list->count){
+		struct extent *last = &list->ext[list->count-1];
+		if((last->lblock+last->count==lblock)&&(last->pblock+last->count==pblock)){
+			last->count += count;
+			return 0;
+		}
+	}
+	if(ext_room(list,1))
+		return -ENOMEM;
+	list->ext[list->count].lblock = lblock;
+	list->ext[list->count].pblock = pblock;
+	list->ext[list->count].count = count;
+	list->count++;
+	return 0;
+}
+
+static void ext_insert(struct extentList *list,int pos,long lblock,long pblock,long count){
+	// the caller made room with ext_room
+	memmove(&list->ext[pos+1],&list->ext[pos],(list->count-pos)*sizeof(struct extent));
+	list->ext[pos].lblock = lblock;
+	list->ext[pos].pblock = pblock;
+	list->ext[pos].count = count;
+	list->count++;
+}
+
+static int ext_next(struct extentList *list,long lblock){
+	// the first extent ending past lblock, list->count if none : the one
+	// holding lblock, or the one after the hole lblock is in
+	int lo=0,hi=list->count;
+	while(lo<hi){
+		int mid = (lo+hi)/2;
+		if(list->ext[mid].lblock+list->ext[mid].count <= lblock)
+			lo = mid+1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static int ext_place(struct extentList *list,int pos,long lblock,long pblock,long count){
+	// map a run into the hole before extent pos, merging with a neighbour
+	// it continues on disk
+	struct extent *x = list->ext+pos;
+	if((pos>0)&&(x[-1].lblock+x[-1].count==lblock)&&(x[-1].pblock+x[-1].count==pblock)){
+		x[-1].count += count;
+		if((pos<list->count)&&(lblock+count==x->lblock)&&(pblock+count==x->pblock)){
+			x[-1].count += x->count;
+			memmove(x,x+1,(list->count-pos-1)*sizeof(struct extent));
+			list->count--;
+		}
+		return 0;
+	}
+	if((pos<list->count)&&(lblock+count==x->lblock)&&(pblock+count==x->pblock)){
+		x->lblock = lblock;
+		x->pblock = pblock;
+		x->count += count;
+		return 0;
+	}
+	if(ext_room(list,1))
+		return -ENOMEM;
+	ext_insert(list,pos,lblock,pblock,count);
+	return 0;
+}
+
+static int file_fill(int index,long first,long end,off_t from,off_t to){
+	// map the holes between blocks first and end, taking the largest
+	// contiguous runs available. a new block the caller does not write
+	// whole, the bytes from to to, is zeroed. blocks already mapped cost
+	// one search, so preallocated files never reach the allocator here.
+	// caller holds the file's write lock
+	struct extentList *list = &INODE(index)->ext;
+	long whole = (from+disk->blocksize-1)/disk->blocksize,wholeEnd = to/disk->blocksize;
+	long l = first;
+	while(l<end){
+		int e = ext_next(list,l);
+		if((e<list->count)&&(list->ext[e].lblock<=l)){
+			l = list->ext[e].lblock+list->ext[e].count;
+			continue;
+		}
+		long got,hole = ((e<list->count)&&(list->ext[e].lblock<end)) ? list->ext[e].lblock : end;
+		long start = alloc_run(hole-l,&got);
+		if(start==-1)
+			return -ENOSPC;
+		if(ext_place(list,e,l,start,got)){
+			free_run(start,got,0);
+			return -ENOMEM;
+		}
+		__atomic_add_fetch(&INODE(index)->blocks,got,__ATOMIC_RELAXED);
+		long lo = (l>whole) ? l : whole,hi = (l+got<wholeEnd) ? l+got : wholeEnd;
+		if(lo>=hi){
+			data_zero(start,got);
+		}else{
+			if(lo>l)
+				data_zero(start,lo-l);
+			if(hi<l+got)
+				data_zero(start+hi-l,l+got-hi);
+		}
+		l += got;
+	}
+	return 0;
+}
+
+static void drop_run(int index,long start,long count){
+	// give a run back to the allocator. while the file is open a spliced
+	// read may still hold these blocks' pages in its pipe, so the blocks
+	// freed are punched out of the memfd : the pipe keeps the old pages
+	// and the next owner of the blocks faults in fresh zeroed ones
+	free_run(start,count,(disk->dataFd!=-1)&&__atomic_load_n(&INODE(index)->openCount,__ATOMIC_RELAXED));
+}
+
+static int file_unmap(int index,long first,long end){
+	// release the blocks between first and end, leaving a hole. -ENOMEM
+	// when an extent has to be split and the list cannot grow
+	struct extentList *list = &INODE(index)->ext;
+	int e = ext_next(list,first);
+	while((e<list->count)&&(list->ext[e].lblock<end)){
+		struct extent *x = &list->ext[e];
+		long xEnd = x->lblock+x->count;
+		long lo = (first>x->lblock) ? first : x->lblock,hi = (end<xEnd) ? end : xEnd;
+		long pblock = x->pblock+lo-x->lblock;
+		if((lo>x->lblock)&&(hi<xEnd)){
+			if(ext_room(list,1))
+				return -ENOMEM;
+			x = &list->ext[e];
+			ext_insert(list,e+1,hi,x->pblock+hi-x->lblock,xEnd-hi);
+			x->count = lo-x->lblock;
+			e += 2;
+		}else if(lo>x->lblock){
+			x->count = lo-x->lblock;
+			e++;
+		}else if(hi<xEnd){
+			x->pblock += hi-lo;
+			x->lblock = hi;
+			x->count -= hi-lo;
+		}else{
+			memmove(x,x+1,(list->count-e-1)*sizeof(struct extent));
+			list->count--;
+		}
+		drop_run(index,pblock,hi-lo);
+		__atomic_sub_fetch(&INODE(index)->blocks,hi-lo,__ATOMIC_RELAXED);
+	}
+	return 0;
+}
+
+static void file_shrink(int index,long nblocks){
+	// release every block at or past nblocks, never needs a split
+	file_unmap(index,nblocks,LONG_MAX);
+}
+
+static int ext_remap(struct extentList *list,int e,long lblock,long pblock){
+	// point lblock, inside extent e, at pblock : a neighbour continuing
+	// onto pblock on disk takes it over, else e is split around it.
+	// -ENOMEM leaves the list as it was
+	struct extent *x = &list->ext[e];
+	long at = lblock-x->lblock;
+	if((at==0)&&(e>0)&&(x[-1].lblock+x[-1].count==lblock)&&(x[-1].pblock+x[-1].count==pblock)){
+		x[-1].count++;
+		x->lblock++;
+		x->pblock++;
+	}else if((at==x->count-1)&&(e+1<list->count)&&(x[1].lblock==lblock+1)&&(x[1].pblock==pblock+1)){
+		x[1].lblock--;
+		x[1].pblock--;
+		x[1].count++;
+	}else if(x->count==1){
+		x->pblock = pblock;
+		return 0;
+	}else{
+		if(ext_room(list,2))
+			return -ENOMEM;
+		x = &list->ext[e];
+		if(at==0){
+			x->lblock++;
+			x->pblock++;
+			x->count--;
+			ext_insert(list,e,lblock,pblock,1);
+		}else{
+			long tail = x->count-at-1;
+			x->count = at;
+			ext_insert(list,e+1,lblock,pblock,1);
+			if(tail)
+				ext_insert(list,e+2,lblock+1,list->ext[e].pblock+at+1,tail);
+		}
+		return 0;
+	}
+	if(--x->count==0){
+		memmove(x,x+1,(list->count-e-1)*sizeof(struct extent));
+		list->count--;
+	}
+	return 0;
+}
+
+static int file_unshare(int index,off_t offset,size_t size){
+	// make the blocks a write of size bytes at offset lands on the file's
+	// own : shared blocks are copied to new ones, the others leave the
+	// index. caller holds the file's write lock
+	struct extentList *list = &INODE(index)->ext;
+	long l,first = offset/disk->blocksize,end = (offset+size+disk->blocksize-1)/disk->blocksize;
+	int e,shared = 0;
+	if((disk->shareCount==NULL)||(size==0))
+		return 0;
+	pthread_mutex_lock(&disk->allocLock);
+	for(l=first,e=ext_find(list,first);(e!=-1)&&(e<list->count)&&(l<end);e++){
+		struct extent *x = &list->ext[e];
+		if(l<x->lblock)
+			l = x->lblock;
+		for(;(l<x->lblock+x->count)&&(l<end);l++){
+			long b = x->pblock+l-x->lblock;
+			if(disk->shareCount[b])
+				shared = 1;
+			else if(disk->blockHash && disk->blockHash[b])
+				dedup_remove(b);
+		}
+	}
+	pthread_mutex_unlock(&disk->allocLock);
+	for(l=first;shared&&(l<end);l++){
+		long got,copy;
+		if((e = ext_find(list,l))==-1)
+			continue;	// a hole, the write maps it fresh
+		long b = list->ext[e].pblock+l-list->ext[e].lblock;
+		if(!__atomic_load_n(&disk->shareCount[b],__ATOMIC_RELAXED))
+			continue;	// the other owners went meanwhile
+		if((copy = alloc_run(1,&got))==-1)
+			return -ENOSPC;
+		memcpy(disk->memoffset+copy*disk->blocksize,disk->memoffset+b*disk->blocksize,disk->blocksize);
+		if(ext_remap(list,e,l,copy)){
+			free_run(copy,1,0);
+			return -ENOMEM;
+		}
+		free_run(b,1,0);
+		__atomic_add_fetch(&disk->dedupCopies,1,__ATOMIC_RELAXED);
+	}
+	return 0;
+}
+
+static void file_dedup(int index,off_t offset,size_t size){
+	// share the blocks a write of size bytes at offset filled whole with
+	// blocks already on disk holding the same bytes, index the others.
+	// caller holds the file's write lock
+	struct extentList *list = &INODE(index)->ext;
+	long first = (offset+disk->blocksize-1)/disk->blocksize,end = (offset+size)/disk->blocksize;
+	uint64_t hash[DEDUPBATCH];
+	long pblock[DEDUPBATCH],match[DEDUPBATCH];
+	struct timespec t0,t1;
+	int i,e;
+	if(!disk->useDedup)
+		return;
+	while(first<end){
+		int n = (end-first<DEDUPBATCH) ? end-first : DEDUPBATCH;
+		clock_gettime(CLOCK_MONOTONIC,&t0);
+		for(i=0,e=-1;i<n;i++){
+			if((e = ext_seek(list,first+i,e))==-1)
+				return;
+			pblock[i] = list->ext[e].pblock+first+i-list->ext[e].lblock;
+			hash[i] = block_hash(disk->memoffset+pblock[i]*disk->blocksize);
+		}
+		clock_gettime(CLOCK_MONOTONIC,&t1);
+		pthread_mutex_lock(&disk->allocLock);
+		disk->dedupHashed += n;
+		disk->dedupHashNs += (t1.tv_sec-t0.tv_sec)*1000000000ULL+t1.tv_nsec-t0.tv_nsec;
+		for(i=0;i<n;i++){
+			match[i] = dedup_find(hash[i],pblock[i]);
+			if(match[i]!=-1){
+				__atomic_add_fetch(&disk->shareCount[match[i]],1,__ATOMIC_RELAXED);
+				disk->sharedRefs++;
+				disk->dedupHits++;
+			}else if(!disk->blockHash[pblock[i]]){
+				dedup_insert(pblock[i],hash[i]);
+			}
+		}
+		pthread_mutex_unlock(&disk->allocLock);
+		for(i=0;i<n;i++){
+			if(match[i]==-1)
+				continue;
+			e = ext_find(list,first+i);
+			if(ext_remap(list,e,first+i,match[i]))
+				free_run(match[i],1,0);
+			else
+				free_run(pblock[i],1,0);
+		}
+		first += n;
+	}
+}
+
+static int ctl_dedup_show(char *buf,size_t size){
+	// blocks in use, the owners they save and what the hashing costs
+	if(disk->shareCount==NULL)
+		return snprintf(buf,size,"off\n");
+	pthread_mutex_lock(&disk->allocLock);
+	long used = disk->fenceBlocks-disk->freeBlocks;
+	long saved = disk->sharedRefs;
+	long indexed = disk->dedupUsed;
+	uint64_t hashed = disk->dedupHashed,hits = disk->dedupHits,ns = disk->dedupHashNs;
+	pthread_mutex_unlock(&disk->allocLock);
+	return snprintf(buf,size,"used %ld\nsaved %ld\nratio %.2f\nindexed %ld\nhashed %llu\nhits %llu\ncopies %llu\nhash_ns %llu\n",
+		used,saved,used ? (double)(used+saved)/used : 1.0,indexed,(unsigned long long)hashed,(unsigned long long)hits,
+		(unsigned long long)__atomic_load_n(&disk->dedupCopies,__ATOMIC_RELAXED),(unsigned long long)(hashed ? ns/hashed : 0));
+}
+
+static int tier_inflate(long b,char *to){
+	// inflate block b's copy into to, caller holds tierLock
+	struct coldBlock *c = disk->coldPool[b>>TIERCHUNKBITS][b&(TIERCHUNK-1)];
+	inflateReset(&disk->tierInflate);
+	disk->tierInflate.next_in = (Bytef *)c->data;
+	disk->tierInflate.avail_in = c->length;
+	disk->tierInflate.next_out = (Bytef *)to;
+	disk->tierInflate.avail_out = disk->blocksize;
+	if((inflate(&disk->tierInflate,Z_FINISH)!=Z_STREAM_END)||disk->tierInflate.avail_out){
+		log_write(LOG_ERROR,"tier_inflate : block %ld is damaged",b);
+		return -EIO;
+	}
+	return 0;
+}
+
+static void tier_restore(long b){
+	// bring block b back from the pool into its place
+	struct timespec t0,t1;
+	pthread_mutex_lock(&disk->tierLock);
+	if(tier_is_cold(b)){
+		clock_gettime(CLOCK_MONOTONIC,&t0);
+		tier_inflate(b,disk->memoffset+b*disk->blocksize);
+		tier_forget(b);
+		clock_gettime(CLOCK_MONOTONIC,&t1);
+		__atomic_add_fetch(&disk->tierRestored,1,__ATOMIC_RELAXED);
+		__atomic_add_fetch(&disk->tierRestoreNs,(t1.tv_sec-t0.tv_sec)*1000000000ULL+t1.tv_nsec-t0.tv_nsec,__ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&disk->tierLock);
+}
+
+static void tier_touch(long b,long n){
+	// n blocks from b are about to be used : mark them hot, then restore
+	// the cold ones. the scanner sets the cold bit before it looks at the
+	// hot bit, so one of the two always sees the other
+	int restored = 0;
+	while(n>0){
+		int bit = b&63;
+		long run = 64-bit;
+		if(run > n)
+			run = n;
+		uint64_t mask = (run==64) ? ~0ULL : (((1ULL<<run)-1) << bit);
+		if((__atomic_load_n(&disk->hotMap[b>>6],__ATOMIC_RELAXED) & mask)!=mask)
+			__atomic_fetch_or(&disk->hotMap[b>>6],mask,__ATOMIC_SEQ_CST);
+		uint64_t cold = __atomic_load_n(&disk->coldMap[b>>6],__ATOMIC_SEQ_CST) & mask;
+		for(;cold;cold &= cold-1){
+			tier_restore((b&~63L)+__builtin_ctzll(cold));
+			restored = 1;
+		}
+		b += run;
+		n -= run;
+	}
+	if(restored && (tier_resident()*100 >= disk->blockcount*disk->coldHigh))
+		tier_wake();
+}
+
+static void tier_copy(long b,long n,char *to){
+	// copy n blocks from b into to, inflating the cold ones. the caller
+	// keeps blocks from going cold meanwhile (tierGate or no scanner)
+	long i;
+	if(disk->coldMap==NULL){
+		memcpy(to,disk->memoffset+b*disk->blocksize,n*disk->blocksize);
+		return;
+	}
+	for(i=0;i<n;i++){
+		char *dst = to+i*disk->blocksize;
+		if(tier_is_cold(b+i)){
+			pthread_mutex_lock(&disk->tierLock);
+			int cold = tier_is_cold(b+i);
+			if(cold && tier_inflate(b+i,dst))
+				memset(dst,0,disk->blocksize);
+			pthread_mutex_unlock(&disk->tierLock);
+			if(cold)
+				continue;
+		}
+		memcpy(dst,disk->memoffset+(b+i)*disk->blocksize,disk->blocksize);
+	}
+}
+
+static struct coldBlock *tier_deflate(long b,z_stream *zs,char *scratch){
+	// deflate block b, NULL when it does not shrink to coldRatio percent
+	struct timespec t0,t1;
+	long limit = disk->blocksize*__atomic_load_n(&disk->coldRatio,__ATOMIC_RELAXED)/100;
+	struct coldBlock *c = NULL;
+	clock_gettime(CLOCK_MONOTONIC,&t0);
+	deflateReset(zs);
+	zs->next_in = (Bytef *)(disk->memoffset+b*disk->blocksize);
+	zs->avail_in = disk->blocksize;
+	zs->next_out = (Bytef *)scratch;
+	zs->avail_out = limit;
+	if(deflate(zs,Z_FINISH)==Z_STREAM_END){
+		c = (struct coldBlock *) malloc(sizeof(struct coldBlock)+limit-zs->avail_out);
+		if(c!=NULL){
+			c->length = limit-zs->avail_out;
+			memcpy(c->data,scratch,c->length);
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC,&t1);
+	__atomic_add_fetch(&disk->tierCompressNs,(t1.tv_sec-t0.tv_sec)*1000000000ULL+t1.tv_nsec-t0.tv_nsec,__ATOMIC_RELAXED);
+	return c;
+}
+
+static int tier_commit(long b,struct coldBlock *c){
+	// swap block b for its copy unless it was freed, shared or touched
+	// since it was deflated, caller holds the owner's write lock,
+	// allocLock and tierLock. returns 0 when the copy was taken
+	uint64_t bit = 1ULL<<(b&63);
+	struct coldBlock ***part = &disk->coldPool[b>>TIERCHUNKBITS];
+	if(!(disk->bitMap[b>>6] & bit)||(disk->shareCount && disk->shareCount[b]))
+		return -1;
+	if((*part==NULL)&&((*part = (struct coldBlock **) calloc(TIERCHUNK,sizeof(struct coldBlock *)))==NULL))
+		return -1;
+	__atomic_fetch_or(&disk->coldMap[b>>6],bit,__ATOMIC_SEQ_CST);
+	if(__atomic_load_n(&disk->hotMap[b>>6],__ATOMIC_SEQ_CST) & bit){
+		__atomic_fetch_and(&disk->coldMap[b>>6],~bit,__ATOMIC_SEQ_CST);
+		return -1;
+	}
+	(*part)[b&(TIERCHUNK-1)] = c;
+	__atomic_add_fetch(&disk->poolBytes,(long)c->length,__ATOMIC_RELAXED);
+	__atomic_add_fetch(&disk->coldBlocks,1,__ATOMIC_RELAXED);
+	__atomic_add_fetch(&disk->tierCompressed,1,__ATOMIC_RELAXED);
+	data_release(b*disk->blocksize,disk->blocksize);
+	return 0;
+}
+
+static int tier_scan(int slot,long *next,int force,z_stream *zs,char *scratch){
+	// one batch of a pass over the file at slot, from logical block next
+	// on : clear the hot bits, deflate up to TIERBATCH blocks that were
+	// not hot (or any, when force is set) under the read lock, then swap
+	// them out under the write lock, which waits out accesses still
+	// running. a file whose lock is taken is skipped, its writer may be
+	// waiting on this pass. returns 1 while the file has blocks left, -1
+	// past the last slot
+	struct coldBlock *out[TIERBATCH];
+	long pblock[TIERBATCH];
+	int i,n = 0,more = 0;
+	pthread_mutex_lock(&disk->tierGate);
+	ns_read_lock();
+	if(slot>=disk->inodeSlots){
+		ns_read_unlock();
+		pthread_mutex_unlock(&disk->tierGate);
+		return -1;
+	}
+	struct inode *node = INODE(slot);
+	if(pthread_rwlock_tryrdlock(&node->lock)){
+		ns_read_unlock();
+		pthread_mutex_unlock(&disk->tierGate);
+		return 0;
+	}
+	if(node->type=='r'){
+		struct extentList *list = &node->ext;
+		int e = ext_find(list,*next);
+		if(e==-1)
+			for(e=0;(e<list->count)&&(list->ext[e].lblock+list->ext[e].count<=*next);e++);
+		for(;(e<list->count)&&(n<TIERBATCH);e++){
+			struct extent *x = &list->ext[e];
+			long l = (*next > x->lblock) ? *next : x->lblock;
+			for(;(l<x->lblock+x->count)&&(n<TIERBATCH);l++){
+				long b = x->pblock+l-x->lblock;
+				uint64_t bit = 1ULL<<(b&63);
+				*next = l+1;
+				if(__atomic_load_n(&disk->hotMap[b>>6],__ATOMIC_RELAXED) & bit){
+					__atomic_fetch_and(&disk->hotMap[b>>6],~bit,__ATOMIC_SEQ_CST);
+					disk->rejectMap[b>>6] &= ~bit;
+					if(!force)
+						continue;
+				}
+				if((__atomic_load_n(&disk->coldMap[b>>6],__ATOMIC_RELAXED)|disk->rejectMap[b>>6]) & bit)
+					continue;
+				if(disk->shareCount && __atomic_load_n(&disk->shareCount[b],__ATOMIC_RELAXED))
+					continue;	// other owners' readers are not held off by this lock
+				if((out[n] = tier_deflate(b,zs,scratch))==NULL){
+					disk->rejectMap[b>>6] |= bit;
+					__atomic_add_fetch(&disk->tierRejected,1,__ATOMIC_RELAXED);
+					continue;
+				}
+				pblock[n++] = b;
+			}
+		}
+		more = list->count && (*next < list->ext[list->count-1].lblock+list->ext[list->count-1].count);
+	}
+	pthread_rwlock_unlock(&node->lock);
+	if(n && pthread_rwlock_trywrlock(&node->lock)){
+		for(i=0;i<n;i++)
+			free(out[i]);
+	}else if(n){
+		pthread_mutex_lock(&disk->allocLock);
+		pthread_mutex_lock(&disk->tierLock);
+		for(i=0;i<n;i++){
+			if(tier_commit(pblock[i],out[i]))
+				free(out[i]);
+		}
+		pthread_mutex_unlock(&disk->tierLock);
+		pthread_mutex_unlock(&disk->allocLock);
+		pthread_rwlock_unlock(&node->lock);
+	}
+	ns_read_unlock();
+	pthread_mutex_unlock(&disk->tierGate);
+	return more;
+}
+
+static void *tier_thread(void *arg){
+	disk = (struct ramdisk *)arg;
+	// a pass every coldAge seconds, or early when memory runs short. a
+	// pass that starts over the ceiling takes recently used blocks too
+	z_stream zs;
+	char *scratch = (char *) malloc(disk->blocksize);
+	int slot,force;
+	long next;
+	memset(&zs,0,sizeof(zs));
+	if((scratch==NULL)||(deflateInit2(&zs,Z_BEST_SPEED,Z_DEFLATED,-15,8,Z_DEFAULT_STRATEGY)!=Z_OK)){
+		log_write(LOG_ERROR,"tier_thread : no memory, nothing will be compressed");
+		free(scratch);
+		return NULL;
+	}
+	pthread_mutex_lock(&disk->tierLock);
+	while(!disk->tierStop){
+		if(!disk->tierKick){
+			struct timespec until;
+			clock_gettime(CLOCK_REALTIME,&until);
+			until.tv_sec += disk->coldAge;
+			pthread_cond_timedwait(&disk->tierWake,&disk->tierLock,&until);
+		}
+		if(disk->tierStop)
+			break;
+		disk->tierKick = 0;
+		disk->tierScanning = 1;
+		pthread_mutex_unlock(&disk->tierLock);
+		force = tier_resident() >= disk->blockcount;
+		for(slot=0;!__atomic_load_n(&disk->tierStop,__ATOMIC_RELAXED);slot++){
+			int res;
+			next = 0;
+			while((res = tier_scan(slot,&next,force,&zs,scratch))==1);
+			if(res==-1)
+				break;
+		}
+		log_write(LOG_INFO,"tier_thread : %ld blocks cold in %ld bytes",disk->coldBlocks,disk->poolBytes);
+		pthread_mutex_lock(&disk->tierLock);
+		disk->tierScanning = 0;
+		disk->tierPasses++;
+		pthread_cond_broadcast(&disk->tierDone);
+		pthread_mutex_unlock(&disk->tierLock);
+		usleep(TIERPRESSUREMS*1000);
+		pthread_mutex_lock(&disk->tierLock);
+	}
+	pthread_mutex_unlock(&disk->tierLock);
+	deflateEnd(&zs);
+	free(scratch);
+	return NULL;
+}
+
+static int tier_init(){
+	// the maps and the pool table, the scanner starts with rd_start
+	disk->hotMap = (uint64_t *) calloc(disk->bitMapWords,sizeof(uint64_t));
+	disk->coldMap = (uint64_t *) calloc(disk->bitMapWords,sizeof(uint64_t));
+	disk->rejectMap = (uint64_t *) calloc(disk->bitMapWords,sizeof(uint64_t));
+	disk->coldPool = (struct coldBlock ***) calloc((disk->maxBlocks+TIERCHUNK-1)/TIERCHUNK,sizeof(struct coldBlock **));
+	if((disk->hotMap==NULL)||(disk->coldMap==NULL)||(disk->rejectMap==NULL)||(disk->coldPool==NULL)||(inflateInit2(&disk->tierInflate,-15)!=Z_OK))
+		return -ENOMEM;
+	disk->tierInflateReady = 1;
+	return 0;
+}
+
+static void tier_start(){
+	if(!disk->coldAge||disk->tierRunning)
+		return;
+	disk->tierStop = 0;
+	disk->tierKick = tier_resident() >= disk->blockcount;	// a replay left it over the ceiling
+	if(pthread_create(&disk->tierThread,NULL,tier_thread,disk))
+		log_write(LOG_ERROR,"tier_start : no scanner thread, nothing will be compressed");
+	else
+		disk->tierRunning = 1;
+}
+
+static void tier_stop(){
+	// blocks stay where they are, cold ones are read through the pool
+	if(!disk->tierRunning)
+		return;
+	pthread_mutex_lock(&disk->tierLock);
+	__atomic_store_n(&disk->tierStop,1,__ATOMIC_RELAXED);	// the scan reads it without the lock
+	pthread_cond_signal(&disk->tierWake);
+	pthread_cond_broadcast(&disk->tierDone);
+	pthread_mutex_unlock(&disk->tierLock);
+	pthread_join(disk->tierThread,NULL);
+	disk->tierRunning = 0;
+}
+
+static int ctl_compress_show(char *buf,size_t size){
+	// settings, then what the pool holds and what it costs
+	if(!disk->coldAge)
+		return snprintf(buf,size,"off\n");
+	long cold = __atomic_load_n(&disk->coldBlocks,__ATOMIC_RELAXED);
+	long pool = __atomic_load_n(&disk->poolBytes,__ATOMIC_RELAXED);
+	uint64_t compressed = __atomic_load_n(&disk->tierCompressed,__ATOMIC_RELAXED),rejected = __atomic_load_n(&disk->tierRejected,__ATOMIC_RELAXED);
+	uint64_t back = __atomic_load_n(&disk->tierRestored,__ATOMIC_RELAXED),done = compressed+rejected;
+	uint64_t compressNs = __atomic_load_n(&disk->tierCompressNs,__ATOMIC_RELAXED),restoreNs = __atomic_load_n(&disk->tierRestoreNs,__ATOMIC_RELAXED);
+	return snprintf(buf,size,"age %ld\nratio %ld\nhigh %ld\ncold %ld\npool %ld\nfactor %.2f\nresident %ld\ncompressed %llu\nrejected %llu\nrestored %llu\ncompress_ns %llu\nrestore_ns %llu\n",
+		disk->coldAge,disk->coldRatio,disk->coldHigh,cold,pool,pool ? (double)cold*disk->blocksize/pool : 0.0,tier_resident(),
+		(unsigned long long)compressed,(unsigned long long)rejected,(unsigned long long)back,
+		(unsigned long long)(done ? compressNs/done : 0),(unsigned long long)(back ? restoreNs/back : 0));
+}
+
+static int ctl_compress_store(const char *buf,size_t size){
+	// "age SECONDS", "ratio PERCENT" or "high PERCENT"
+	char text[32],name[8];
+	long value;
+	if(!disk->coldAge)
+		return -EINVAL;
+	if(size>=sizeof(text))
+		return -EINVAL;
+	memcpy(text,buf,size);
+	text[size] = '\0';
+	if(sscanf(text,"%7s %ld",name,&value)!=2)
+		return -EINVAL;
+	if(!strcmp(name,"age")&&(value>0))
+		disk->coldAge = value;
+	else if(!strcmp(name,"ratio")&&(value>0)&&(value<100))
+		disk->coldRatio = value;
+	else if(!strcmp(name,"high")&&(value>0)&&(value<=100))
+		disk->coldHigh = value;
+	else
+		return -EINVAL;
+	return 0;
+}
+
+#define IO_READ  0
+#define IO_WRITE 1
+#define IO_ZERO  2
+
+#define MAPBATCH 16	// segments file_map fills per call in the copy loops
+
+static int file_map(int index,off_t offset,size_t size,struct iovec *seg,int maxSeg,int *cursor){
+	// describe up to size bytes at offset as pointers into the data
+	// region, one segment per extent, returns the number of segments.
+	// stops early at unmapped blocks or when seg is full. cursor, when
+	// given, is the extent to try first and is left on the last extent used
+	struct extentList *list = &INODE(index)->ext;
+	int e = ext_seek(list,offset/disk->blocksize,cursor ? __atomic_load_n(cursor,__ATOMIC_RELAXED) : -1);
+	size_t done = 0;
+	int n = 0;
+	if(e==-1)
+		return 0;
+	while((done<size)&&(e<list->count)&&(n<maxSeg)){
+		struct extent *ext = &list->ext[e];
+		off_t extStart = (off_t)ext->lblock*disk->blocksize;
+		off_t extEnd = extStart + (off_t)ext->count*disk->blocksize;
+		if(offset<extStart)
+			break;
+		size_t len = extEnd-offset;
+		if(len > size-done)
+			len = size-done;
+		seg[n].iov_base = disk->memoffset + ext->pblock*disk->blocksize + (offset-extStart);
+		seg[n].iov_len = len;
+		if(disk->hotMap)
+			tier_touch(ext->pblock+(offset-extStart)/disk->blocksize,(offset-extStart+len-1)/disk->blocksize-(offset-extStart)/disk->blocksize+1);
+		n++;
+		done += len;
+		offset += len;
+		if(cursor)
+			__atomic_store_n(cursor,e,__ATOMIC_RELAXED);
+		e++;
+	}
+	return n;
+}
+
+static off_t file_data(int index,off_t offset){
+	// the first mapped byte at or past offset, -1 if there is none
+	struct extentList *list = &INODE(index)->ext;
+	int e = ext_next(list,offset/disk->blocksize);
+	if(e==list->count)
+		return -1;
+	off_t at = (off_t)list->ext[e].lblock*disk->blocksize;
+	return (at>offset) ? at : offset;
+}
+
+static size_t file_io(int index,char *buf,size_t size,off_t offset,int mode,int *cursor){
+	// move size bytes at offset between buf and the file's blocks, one
+	// memcpy per extent. holes read as zeros and IO_ZERO passes over them,
+	// IO_WRITE stops at the first. returns the number of bytes done
+	struct iovec seg[MAPBATCH];
+	size_t done = 0;
+	while(done<size){
+		int i,n = file_map(index,offset+done,size-done,seg,MAPBATCH,cursor);
+		if(n==0){
+			if(mode==IO_WRITE)
+				break;
+			off_t next = file_data(index,offset+done);
+			size_t gap = ((next<0)||(next-(offset+done) > (off_t)(size-done))) ? size-done : (size_t)(next-(offset+done));
+			if(mode==IO_READ)
+				memset(buf+done,0,gap);
+			done += gap;
+			continue;
+		}
+		for(i=0;i<n;i++){
+			if(mode==IO_READ)
+				memcpy(buf+done,seg[i].iov_base,seg[i].iov_len);
+			else if(mode==IO_WRITE)
+				block_store((char *)seg[i].iov_base,buf+done,seg[i].iov_len,size);
+			else
+				block_clear((char *)seg[i].iov_base,seg[i].iov_len,size);
+			if(mode!=IO_READ)
+				mark_dirty(seg[i].iov_base,seg[i].iov_len);
+			done += seg[i].iov_len;
+		}
+	}
+	return done;
+}
+
+static void journal_write(int index,off_t offset,size_t size,int *cursor){
+	// queue size bytes at offset as they now stand in the file's blocks,
+	// caller holds the file's write lock
+	struct iovec seg[MAPBATCH];
+	size_t done = 0;
+	if(!disk->walActive)
+		return;
+	while(done<size){
+		int i,n = file_map(index,offset+done,size-done,seg,MAPBATCH,cursor);
+		if(n==0)
+			break;
+		wal_append(WAL_WRITE,index,-1,offset+done,seg,n);
+		for(i=0;i<n;i++)
+			done += seg[i].iov_len;
+	}
+}
+
+static int file_zero(int index,off_t offset,off_t end){
+	// zero the mapped bytes from offset to end, caller holds the write lock
+	if(end<=offset)
+		return 0;
+	if(file_unshare(index,offset,end-offset))
+		return -ENOSPC;
+	file_io(index,NULL,end-offset,offset,IO_ZERO,NULL);
+	return 0;
+}
+
+static int file_extend(int index,off_t length){
+	// the size is about to grow to length : what the old last block holds
+	// past the old end is stale and has to read as zeros. blocks after it
+	// are holes or were zeroed when mapped
+	off_t size = INODE(index)->size;
+	off_t end = (size+disk->blocksize-1)/disk->blocksize*disk->blocksize;
+	return file_zero(index,size,(end<length) ? end : length);
+}
+
+static int file_write_prepare(int index,size_t size,off_t offset){
+	// map the blocks a write of size bytes at offset lands on. a write
+	// past the end leaves the gap reading as zeros, a hole where it spans
+	// whole blocks
+	log_write(LOG_TRACE,"ramdisk_write offsetchecksum offset : [%lld], filesize : [%lld]",(long long)offset,(long long)INODE(index)->size);
+	if((offset>MAXFILESIZE)||((off_t)size>MAXFILESIZE-offset))
+		return -EFBIG;
+	if(file_extend(index,offset)||file_fill(index,offset/disk->blocksize,(offset+size+disk->blocksize-1)/disk->blocksize,offset,offset+size))
+		return -ENOSPC;
+	return file_unshare(index,offset,size);
+}
+
+static void file_write_done(int index,size_t size,off_t offset){
+	off_t end = offset+size;
+	file_dedup(index,offset,size);
+	if(end>INODE(index)->size)
+		__atomic_store_n(&INODE(index)->size,end,__ATOMIC_RELAXED);
+	inode_touch(index,TOUCH_MTIME|TOUCH_CTIME);
+	notify_inode(index,offset,size);
+}
+
+static int file_write(int index,const char *buf,size_t size,off_t offset,int *cursor){
+	// caller holds the file's write lock
+	int res = file_write_prepare(index,size,offset);
+	if(res)
+		return res;
+	file_io(index,(char *)buf,size,offset,IO_WRITE,cursor);
+	file_write_done(index,size,offset);
+	journal_write(index,offset,size,cursor);
+	return (int)size;
+}
+
+static int file_read(int index,char *buf,size_t size,off_t offset,int *cursor){
+	// caller holds the file's read lock
+	if(offset>=INODE(index)->size)
+		return 0;
+	if(size > INODE(index)->size-offset)
+		size = INODE(index)->size-offset;
+	return (int)file_io(index,buf,size,offset,IO_READ,cursor);
+}
+
+static off_t file_seek(int index,off_t offset,int whence){
+	// SEEK_DATA and SEEK_HOLE over the extent map, the end of file counts
+	// as a hole. -ENXIO at or past the end. caller holds the file's lock
+	struct extentList *list = &INODE(index)->ext;
+	off_t size = INODE(index)->size;
+	if((offset<0)||(offset>=size))
+		return -ENXIO;
+	if(whence==SEEK_DATA){
+		off_t at = file_data(index,offset);
+		return ((at<0)||(at>=size)) ? -ENXIO : at;
+	}
+	int e = ext_next(list,offset/disk->blocksize);
+	while((e<list->count)&&((off_t)list->ext[e].lblock*disk->blocksize<=offset)){
+		offset = (off_t)(list->ext[e].lblock+list->ext[e].count)*disk->blocksize;
+		e++;
+	}
+	return (offset<size) ? offset : size;
+}
+
+static struct openFile *fd_get(int fd){
+	// the open descriptor fd, NULL when it is not one
+	if((fd<0)||(fd>=__atomic_load_n(&disk->fdSlots,__ATOMIC_ACQUIRE)))
+		return NULL;
+	struct openFile *f = OPENFILE(fd);
+	return (__atomic_load_n(&f->ctl,__ATOMIC_ACQUIRE)==FD_FREE) ? NULL : f;
+}
+
+static struct openFile *fd_access(int fd,int write){
+	// the descriptor fd when it is open for reading, or for writing
+	struct openFile *f = fd_get(fd);
+	if(f==NULL)
+		return NULL;
+	int mode = f->flags & O_ACCMODE;
+	return ((mode==O_RDWR)||(mode==(write ? O_WRONLY : O_RDONLY))) ? f : NULL;
+}
+
+static int fd_alloc(int index,int ctl,int flags){
+	// a descriptor on slot index, or on control file ctl with index -1,
+	// -EMFILE when the table is full. caller holds the namespace lock so
+	// the slot cannot go before openCount pins it
+	struct openFile *f;
+	int fd;
+	pthread_mutex_lock(&disk->fdLock);
+	fd = disk->fdFree;
+	if(fd!=-1){
+		disk->fdFree = OPENFILE(fd)->nextFree;
+	}else{
+		fd = disk->fdSlots;
+		if(fd>=MAXFDCHUNKS*FDCHUNK){
+			pthread_mutex_unlock(&disk->fdLock);
+			return -EMFILE;
+		}
+		if(disk->fdChunks[fd>>FDCHUNKBITS]==NULL){
+			disk->fdChunks[fd>>FDCHUNKBITS] = (struct openFile *) calloc(FDCHUNK,sizeof(struct openFile));
+			if(disk->fdChunks[fd>>FDCHUNKBITS]==NULL){
+				pthread_mutex_unlock(&disk->fdLock);
+				return -ENOMEM;
+			}
+		}
+	}
+	f = OPENFILE(fd);
+	f->index = index;
+	f->cursor = -1;
+	f->flags = flags;
+	f->pos = 0;
+	__atomic_store_n(&f->ctl,ctl,__ATOMIC_RELEASE);
+	if(fd==disk->fdSlots)
+		__atomic_store_n(&disk->fdSlots,fd+1,__ATOMIC_RELEASE);
+	pthread_mutex_unlock(&disk->fdLock);
+	if(index>=0)
+		__atomic_add_fetch(&INODE(index)->openCount,1,__ATOMIC_RELAXED);
+	return fd;
+}
+
+static int fd_free(int fd){
+	// close fd, returns the slot it had open, -1 for a control file, or
+	// -EBADF when it was not open
+	pthread_mutex_lock(&disk->fdLock);
+	struct openFile *f = fd_get(fd);
+	if(f==NULL){
+		pthread_mutex_unlock(&disk->fdLock);
+		return -EBADF;
+	}
+	int index = f->index;
+	__atomic_store_n(&f->ctl,FD_FREE,__ATOMIC_RELEASE);
+	f->nextFree = disk->fdFree;
+	disk->fdFree = fd;
+	pthread_mutex_unlock(&disk->fdLock);
+	return index;
+}
+
+static int fd_read(struct openFile *f,char *buf,size_t size,off_t *offset){
+	// read at *offset and move it past the bytes read
+	int res;
+	if(size>MAXIO)
+		size = MAXIO;
+	if(f->ctl!=CTL_NONE){
+		res = ctl_read(f->ctl,buf,size,*offset);
+	}else{
+		pthread_rwlock_rdlock(&INODE(f->index)->lock);
+		res = file_read(f->index,buf,size,*offset,&f->cursor);
+		pthread_rwlock_unlock(&INODE(f->index)->lock);
+		inode_accessed(f->index);
+	}
+	if(res>0)
+		*offset += res;
+	return res;
+}
+
+static int fd_write(struct openFile *f,const char *buf,size_t size,off_t *offset,int append){
+	// write at *offset, or at the end of file when append, and move
+	// *offset past the bytes written
+	int res;
+	if(size>MAXIO)
+		size = MAXIO;
+	if(f->ctl!=CTL_NONE){
+		res = ctl_write(f->ctl,buf,size,*offset);
+	}else{
+		pthread_rwlock_wrlock(&INODE(f->index)->lock);
+		if(append)
+			*offset = INODE(f->index)->size;
+		res = file_write(f->index,buf,size,*offset,&f->cursor);
+		pthread_rwlock_unlock(&INODE(f->index)->lock);
+	}
+	if(res>0)
+		*offset += res;
+	return res;
+}
+
+static ssize_t ramdisk_pread(int fd, void *buf, size_t size, off_t offset){
+	log_write(LOG_TRACE,"ramdisk_read called with fd : [%d], size:[%zu], offset : [%lld]",fd,size,(long long)offset);
+	struct openFile *f = fd_access(fd,0);
+	if(f==NULL)
+		return -EBADF;
+	if(offset<0)
+		return -EINVAL;
+	return fd_read(f,buf,size,&offset);
+}
+
+static ssize_t ramdisk_read(int fd, void *buf, size_t size){
+	struct openFile *f = fd_access(fd,0);
+	if(f==NULL)
+		return -EBADF;
+	return fd_read(f,buf,size,&f->pos);
+}
+
+static ssize_t ramdisk_pwrite(int fd, const void *buf, size_t size, off_t offset){
+	log_write(LOG_TRACE,"ramdisk_write called with fd : [%d] , buf : [], size: [%zu] and offset:[%lld]",fd,size,(long long)offset);
+	struct openFile *f = fd_access(fd,1);
+	if(f==NULL)
+		return -EBADF;
+	if(offset<0)
+		return -EINVAL;
+	return fd_write(f,buf,size,&offset,0);
+}
+
+static ssize_t ramdisk_write(int fd, const void *buf, size_t size){
+	struct openFile *f = fd_access(fd,1);
+	if(f==NULL)
+		return -EBADF;
+	return fd_write(f,buf,size,&f->pos,f->flags & O_APPEND);
+}
+
+static ssize_t ramdisk_pwrite_with(int fd, size_t size, off_t offset, rd_source_t source, void *arg){
+	// copy the request straight into the blocks it lands on, one source
+	// call per extent, so a spliced request is read from its pipe into
+	// place instead of through a bounce buffer
+	log_write(LOG_TRACE,"ramdisk_write_buf called with fd : [%d] , size: [%zu] and offset:[%lld]",fd,size,(long long)offset);
+	struct openFile *f = fd_access(fd,1);
+	int res;
+	if(f==NULL)
+		return -EBADF;
+	if(offset<0)
+		return -EINVAL;
+	if(size>MAXIO)
+		size = MAXIO;
+	if(f->ctl!=CTL_NONE){
+		char text[CTLBUFSIZE];
+		ssize_t got = source(arg,text,size<sizeof(text) ? size : sizeof(text));
+		return (got<0) ? got : ctl_write(f->ctl,text,got,offset);
+	}
+	int index = f->index;
+	pthread_rwlock_wrlock(&INODE(index)->lock);
+	res = file_write_prepare(index,size,offset);
+	if(res==0){
+		struct iovec seg[MAPBATCH];
+		size_t done = 0;
+		int more = 1;
+		while(more&&(done<size)){
+			int i,n = file_map(index,offset+done,size-done,seg,MAPBATCH,&f->cursor);
+			more = (n>0);
+			for(i=0;more&&(i<n);i++){
+				ssize_t got = source(arg,seg[i].iov_base,seg[i].iov_len);
+				if(got<0){
+					res = (int)got;
+					more = 0;
+				}else{
+					mark_dirty(seg[i].iov_base,got);
+					done += got;
+					more = ((size_t)got==seg[i].iov_len);
+				}
+			}
+		}
+		if(res==0){
+			file_write_done(index,done,offset);
+			journal_write(index,offset,done,&f->cursor);
+			res = (int)done;
+		}
+	}
+	pthread_rwlock_unlock(&INODE(index)->lock);
+	return res;
+}
+
+static int file_create(const char *pathStr,mode_t mode);
+static int file_resize(int index, off_t length);
+static void release_blocks(int index);
+
+static int ctl_open(int c,int flags){
+	if((flags & O_CREAT) && (flags & O_EXCL))
+		return -EEXIST;
+	return (c==CTL_DIR) ? -EISDIR : fd_alloc(-1,c,flags);
+}
+
+static int open_slot(int index,int flags){
+	// the checks and O_TRUNC of opening the existing entry at index,
+	// returns index or -errno. caller holds the namespace lock
+	int res = index;
+	if((flags & O_CREAT) && (flags & O_EXCL)){
+		res = -EEXIST;
+	}else if(INODE(index)->type=='d'){
+		res = -EISDIR;
+	}else if(INODE(index)->type=='l'){
+		res = -ELOOP;
+	}else if((flags & O_TRUNC) && ((flags & O_ACCMODE)!=O_RDONLY)){
+		pthread_rwlock_wrlock(&INODE(index)->lock);
+		res = file_resize(index,0);
+		pthread_rwlock_unlock(&INODE(index)->lock);
+		if(res==0)
+			res = index;
+	}
+	return res;
+}
+
+static int ramdisk_open(const char *path, int flags, mode_t mode){
+	// O_CREAT takes the namespace write lock, anything else the read lock
+	log_write(LOG_TRACE,"ramdisk_open called with path : %s",path);
+	int res,create = flags & O_CREAT;
+	if((flags & O_ACCMODE)==O_ACCMODE)
+		return -EINVAL;
+	int c = ctl_find(path);
+	if(c!=CTL_NONE)
+		return ctl_open(c,flags);
+	if(create)
+		ns_write_lock();
+	else
+		ns_read_lock();
+	int index = lookup_path(path);
+	if(index<0)
+		res = (create&&(index==-ENOENT)) ? file_create(path,mode) : index;
+	else
+		res = open_slot(index,flags);
+	if(res>=0)
+		res = fd_alloc(res,CTL_NONE,flags);
+	if(create)
+		ns_write_unlock();
+	else
+		ns_read_unlock();
+	return res;
+}
+
+static void inode_release(int index){
+	// free a removed slot once the last descriptor and lookup reference
+	// on it are gone. whoever drops the last one calls this, more than one
+	// may, and the first frees it
+	ns_write_lock();
+	struct inode *n = INODE(index);
+	if(n->type && n->unlinked && (n->openCount==0) && (n->lookups==0)){
+		if(n->type=='r')
+			release_blocks(index);
+		inode_free(index);
+	}
+	ns_write_unlock();
+}
+
+static int ramdisk_close(int fd){
+	int index = fd_free(fd);
+	if(index<0)
+		return (index==-1) ? 0 : index;
+
+	// the namespace read lock orders this against unlink marking the slot
+	ns_read_lock();
+	struct inode *n = INODE(index);
+	int last = (__atomic_sub_fetch(&n->openCount,1,__ATOMIC_ACQ_REL)==0)&&n->unlinked&&(__atomic_load_n(&n->lookups,__ATOMIC_ACQUIRE)==0);
+	ns_read_unlock();
+	if(last)
+		inode_release(index);
+	return 0;
+}
+
+static off_t ramdisk_lseek(int fd, off_t offset, int whence){
+	// SEEK_DATA and SEEK_HOLE go by the extent map, a control file has
+	// neither
+	struct openFile *f = fd_get(fd);
+	off_t at;
+	if(f==NULL)
+		return -EBADF;
+	switch(whence){
+	case SEEK_SET:
+		at = offset;
+		break;
+	case SEEK_CUR:
+		at = f->pos+offset;
+		break;
+	case SEEK_END:
+		at = ((f->ctl==CTL_NONE) ? __atomic_load_n(&INODE(f->index)->size,__ATOMIC_RELAXED) : 0)+offset;
+		break;
+	case SEEK_DATA:
+	case SEEK_HOLE:
+		if(f->ctl!=CTL_NONE)
+			return -ENXIO;
+		pthread_rwlock_rdlock(&INODE(f->index)->lock);
+		at = file_seek(f->index,offset,whence);
+		pthread_rwlock_unlock(&INODE(f->index)->lock);
+		if(at<0)
+			return at;
+		break;
+	default:
+		return -EINVAL;
+	}
+	if(at<0)
+		return -EINVAL;
+	f->pos = at;
+	return at;
+}
+
+static size_t file_splice(int index,int pipeFd,size_t size,off_t offset,int *cursor){
+	// splice size bytes at offset from the memfd into pipeFd, returns the
+	// number of bytes moved. the pipe takes references on the pages, so
+	// what it holds no longer depends on the blocks
+	struct iovec seg[MAPBATCH];
+	size_t done = 0;
+	while(done<size){
+		int i,n = file_map(index,offset+done,size-done,seg,MAPBATCH,cursor);
+		if(n==0)
+			return done;
+		for(i=0;i<n;i++){
+			loff_t pos = (char *)seg[i].iov_base - disk->memoffset;
+			size_t len = seg[i].iov_len;
+			while(len){
+				ssize_t got = splice(disk->dataFd,&pos,pipeFd,NULL,len,0);
+				if(got<=0)
+					return done;
+				len -= got;
+				done += got;
+			}
+		}
+	}
+	return done;
+}
+
+static ssize_t ramdisk_splice(int fd, int pipeFd, size_t size, off_t offset){
+	// splice the blocks themselves into pipeFd under the file lock. the
+	// pipe keeps its pages even when the file is truncated afterwards, as
+	// drop_run punches the blocks of an open file rather than reusing them
+	log_write(LOG_TRACE,"ramdisk_splice called with fd : [%d], size:[%zu], offset : [%lld]",fd,size,(long long)offset);
+	struct openFile *f = fd_access(fd,0);
+	if(f==NULL)
+		return -EBADF;
+	if(offset<0)
+		return -EINVAL;
+	if((disk->dataFd==-1)||(f->ctl!=CTL_NONE))
+		return -EOPNOTSUPP;
+	if(size>MAXIO)
+		size = MAXIO;
+	int index = f->index;
+	pthread_rwlock_rdlock(&INODE(index)->lock);
+	if(offset>=INODE(index)->size)
+		size = 0;
+	else if(size > INODE(index)->size-offset)
+		size = INODE(index)->size-offset;
+	size_t done = file_splice(index,pipeFd,size,offset,&f->cursor);
+	pthread_rwlock_unlock(&INODE(index)->lock);
+	inode_accessed(index);
+	return (done==size) ? (ssize_t)size : -EIO;
+}
+
+static int file_resize(int index, off_t length){
+	// caller holds the file's write lock
+	off_t size = INODE(index)->size;
+	long nblocks = (length+disk->blocksize-1)/disk->blocksize;
+	if(length>MAXFILESIZE)
+		return -EFBIG;
+	if(length<size){
+		file_shrink(index,nblocks);
+	}else if(length>size){
+		// the extension is a hole, nothing is allocated
+		if(file_extend(index,length))
+			return -ENOSPC;
+	}
+	__atomic_store_n(&INODE(index)->size,length,__ATOMIC_RELAXED);
+	inode_touch(index,TOUCH_MTIME|TOUCH_CTIME);
+	notify_inode(index,(length<size) ? length : size,0);
+	wal_append(WAL_TRUNCATE,index,-1,length,NULL,0);
+	return 0;
+}
+
+static int file_punch(int index,off_t offset,off_t end){
+	// zero from offset to end, the whole blocks between become a hole
+	long first = (offset+disk->blocksize-1)/disk->blocksize,last = end/disk->blocksize;
+	if(first>last)
+		return file_zero(index,offset,end);
+	if(file_zero(index,offset,(off_t)first*disk->blocksize)||file_zero(index,(off_t)last*disk->blocksize,end))
+		return -ENOSPC;
+	return file_unmap(index,first,last);
+}
+
+static int file_allocate(int index,int mode,off_t offset,off_t length){
+	// fallocate : reserve the blocks from offset for length bytes as
+	// zeros in the largest contiguous runs there are, growing the size
+	// unless FALLOC_FL_KEEP_SIZE, or punch them out. caller holds the
+	// file's write lock
+	off_t size = INODE(index)->size,end = offset+length;
+	int res;
+	if((offset<0)||(length<=0)||(end<offset))
+		return -EINVAL;
+	if(end>MAXFILESIZE)
+		return -EFBIG;
+	if(mode==(FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE)){
+		if((res = file_punch(index,offset,end)))
+			return res;
+		inode_touch(index,TOUCH_MTIME|TOUCH_CTIME);
+		notify_inode(index,offset,length);
+	}else if((mode & ~FALLOC_FL_KEEP_SIZE)==0){
+		if(file_fill(index,offset/disk->blocksize,(end+disk->blocksize-1)/disk->blocksize,0,0))
+			return -ENOSPC;
+		if(!(mode & FALLOC_FL_KEEP_SIZE)&&(end>size)){
+			if(file_extend(index,end))
+				return -ENOSPC;
+			__atomic_store_n(&INODE(index)->size,end,__ATOMIC_RELAXED);
+			inode_touch(index,TOUCH_MTIME|TOUCH_CTIME);
+			notify_inode(index,-1,0);
+		}
+	}else{
+		return -EOPNOTSUPP;
+	}
+	int64_t len = length;
+	struct iovec seg = { &len, sizeof(len) };
+	wal_append(WAL_ALLOCATE,index,mode,offset,&seg,1);
+	return 0;
+}
+
+static int file_create_at(int parent,const char *name,int len,mode_t mode){
+	// a new empty file name inside parent, which it is not in yet,
+	// returns its slot or -errno. caller holds the namespace write lock
+	if(INODE(parent)->unlinked)
+		return -ENOENT;
+	// blocks are mapped on first write
+	int slot = inode_alloc('r');
+	if(slot==-1)
+		return -ENOMEM;
+	log_write(LOG_TRACE,"Found index %d free",slot);
+	INODE(slot)->mode = mode & 07777;
+	int res = entry_add(parent,slot,name,len);
+	if(res){
+		inode_free(slot);
+		return res;
+	}
+	wal_create(slot,name,len);
+	return slot;
+}
+
+static int file_create(const char *pathStr,mode_t mode){
+	// create an empty file or truncate an existing one, caller holds the
+	// namespace write lock
+	int index,dirExists=0,fileExists=0;
+
+	index = lookup_path(pathStr);
+	if(index==-ENOTDIR)
+		return index;
+	if(index>=0){
+		fileExists=1;
+		if(INODE(index)->type=='d')
+			return -EISDIR;
+		if(INODE(index)->type=='l')
+			return -ELOOP;
+	}
+
+	const char *name;
+	int len;
+	int parent = lookup_parent(pathStr,&name,&len);
+	dirExists = (parent>=0);
+
+	log_write(LOG_TRACE,"fileExists=%d and dirExists=%d",fileExists,dirExists);
+
+	if(!dirExists)
+		return parent;
+
+	if(fileExists){
+		int res = file_resize(index,0);
+		return res ? res : index;
+	}
+
+	log_write(LOG_TRACE,"NEW file");
+	return file_create_at(parent,name,len,mode);
+}
+
+static int ramdisk_truncate(const char *pathStr, off_t length)
+{
+	log_write(LOG_TRACE,"ramdisk_truncate called with path : %s",pathStr);
+
+	int res = ctl_find(pathStr);
+	if(res!=CTL_NONE)
+		return (res==CTL_DIR) ? -EISDIR : 0;	// O_TRUNC before a write
+	if(length<0)
+		return -EINVAL;
+	ns_read_lock();
+	int index = lookup_path(pathStr);
+	if(index<0){
+		res = index;
+	}else if(INODE(index)->type=='d'){
+		res = -EISDIR;
+	}else if(INODE(index)->type=='l'){
+		res = -EINVAL;
+	}else{
+		pthread_rwlock_wrlock(&INODE(index)->lock);
+		res = file_resize(index,length);
+		pthread_rwlock_unlock(&INODE(index)->lock);
+	}
+	ns_read_unlock();
+	return res;
+}
+
+static int ramdisk_ftruncate(int fd, off_t length)
+{
+	struct openFile *f = fd_get(fd);
+	if(f==NULL)
+		return -EBADF;
+	if((f->flags & O_ACCMODE)==O_RDONLY)
+		return -EINVAL;
+	if(f->ctl!=CTL_NONE)
+		return 0;
+	if(length<0)
+		return -EINVAL;
+	pthread_rwlock_wrlock(&INODE(f->index)->lock);
+	int res = file_resize(f->index,length);
+	pthread_rwlock_unlock(&INODE(f->index)->lock);
+	return res;
+}
+
+static int ramdisk_fallocate(int fd, int mode, off_t offset, off_t length)
+{
+	log_write(LOG_TRACE,"ramdisk_fallocate called with fd : [%d], mode : [%d], offset : [%lld], length : [%lld]",fd,mode,(long long)offset,(long long)length);
+	struct openFile *f = fd_access(fd,1);
+	if(f==NULL)
+		return -EBADF;
+	if(f->ctl!=CTL_NONE)
+		return -EOPNOTSUPP;
+	pthread_rwlock_wrlock(&INODE(f->index)->lock);
+	int res = file_allocate(f->index,mode,offset,length);
+	pthread_rwlock_unlock(&INODE(f->index)->lock);
+	return res;
+}
+
+static void release_blocks(int index){
+	file_shrink(index,0);
+	free(INODE(index)->ext.ext);
+	INODE(index)->ext.ext = NULL;
+	INODE(index)->ext.cap = 0;
+	INODE(index)->size=0;
+}
+
+static int free_file(int index,int journal){
+	// drop the name at index of a file or symbolic link. with its last
+	// name go its blocks and slot, now or at the last release if it is
+	// still open or looked up. the file's own slot keeps its number : when
+	// its name goes while hard links remain, it trades names with the
+	// first of them, which goes instead. journal is 0 when the caller's
+	// record implies the drop
+	struct inode *n = INODE(index);
+	if(n->type=='h'){
+		entry_remove(index);
+		if(journal)
+			wal_append(WAL_REMOVE,index,-1,0,NULL,0);
+		alias_drop(index);
+		inode_free(index);
+		return 0;
+	}
+	if(n->link!=-1){
+		int alias = n->link;
+		entry_swap(index,alias);
+		if(journal)
+			wal_append(WAL_EXCHANGE,index,-1,alias,NULL,0);
+		return free_file(alias,journal);
+	}
+	entry_remove(index);
+	if(journal)
+		wal_append(WAL_REMOVE,index,-1,0,NULL,0);
+	if(n->openCount||n->lookups){
+		n->unlinked=1;
+	}else{
+		release_blocks(index);
+		inode_free(index);
+	}
+	return 0;
+}
+
+static int do_unlink(const char *path) {
+	log_write(LOG_TRACE,"ramdisk_unlink called with path : %s",path);
+	int index = lookup_entry(path);
+	if(index<0)
+		return index;
+	if(INODE(index)->type=='d')
+		return -EISDIR;
+
+	log_write(LOG_TRACE,"in ramdisk_unlink found path [%s] at index [%d]",path,index);
+	return free_file(index,1);
+}
+
+static int ramdisk_unlink(const char *path) {
+	if(ctl_find(path)!=CTL_NONE)
+		return -EPERM;
+	ns_write_lock();
+	int res = do_unlink(path);
+	ns_write_unlock();
+	return res;
+}
+
+
+static int ramdisk_access(const char* path,int mask){
+	log_write(LOG_TRACE,"in ramdisk_access with path : %s, mask: %d",path,mask);
+	if(!strcmp(path,"/")||(ctl_find(path)!=CTL_NONE))
+		return 0;
+	ns_read_lock();
+	int res = lookup_path(path);
+	ns_read_unlock();
+	return (res<0) ? res : 0;
+}
+
+static int free_dir(int index,int journal);
+
+static int move_entry(int index,int parent,const char *name,int len,int flags){
+	// rename the name at index to name inside parent, as renameat2 does.
+	// a directory moves with everything below it by relinking its one
+	// entry, as names are keyed by their parent's slot, not by path.
+	// whatever is replaced goes with the rename's own record, so replay
+	// never finds one without the other. names of the same file are left
+	// as they are. caller holds the namespace write lock
+	if(INODE(parent)->unlinked)
+		return -ENOENT;
+	if(index==ROOTDIR)
+		return -EBUSY;
+	if((flags & ~(RENAME_NOREPLACE|RENAME_EXCHANGE))||((flags & RENAME_NOREPLACE)&&(flags & RENAME_EXCHANGE)))
+		return -EINVAL;
+	int target = lookup_child(parent,name,len);
+	int dir = (INODE(index)->type=='d');
+	if(flags & RENAME_EXCHANGE){
+		if(target==-1)
+			return -ENOENT;
+		if(target==index)
+			return 0;
+		if((dir && dir_contains(index,parent))||((INODE(target)->type=='d') && dir_contains(target,INODE(index)->parent)))
+			return -EINVAL;
+		entry_swap(index,target);
+		wal_append(WAL_EXCHANGE,index,-1,target,NULL,0);
+		return 0;
+	}
+	if((target!=-1)&&(flags & RENAME_NOREPLACE))
+		return -EEXIST;
+	if(dir && dir_contains(index,parent))
+		return -EINVAL;
+	if(target!=-1){
+		if(entry_target(target)==entry_target(index))
+			return 0;
+		if(dir && (INODE(target)->type!='d'))
+			return -ENOTDIR;
+		if(!dir && (INODE(target)->type=='d'))
+			return -EISDIR;
+		if(INODE(target)->children.count)
+			return -ENOTEMPTY;
+	}
+	// the two share the name for a moment, until target goes
+	int res = entry_move(index,parent,name,len);
+	if(res)
+		return res;
+	if(target!=-1){
+		if(dir)
+			free_dir(target,0);
+		else
+			free_file(target,0);
+	}
+	wal_name(WAL_RENAME,index,parent,(target!=-1) ? WAL_REPLACE : 0,name,len);
+	return 0;
+}
+
+static int do_rename(const char *from, const char *to,int flags)
+{
+	log_write(LOG_TRACE,"ramdisk_rename called with from: [%s] and to [%s]",from,to);
+	const char *name;
+	int len;
+	int index = lookup_entry(from);
+	if(index<0)
+		return index;
+	int parent = lookup_parent(to,&name,&len);
+	if(parent<0)
+		return parent;
+	if(len==0)
+		return -EBUSY;	// onto the root
+	return move_entry(index,parent,name,len,flags);
+}
+
+static int ramdisk_rename(const char *from, const char *to)
+{
+	if((ctl_find(from)!=CTL_NONE)||(ctl_find(to)!=CTL_NONE))
+		return -EPERM;
+	ns_write_lock();
+	int res = do_rename(from,to,0);
+	ns_write_unlock();
+	return res;
+}
+
+static int free_dir(int index,int journal){
+	// remove the empty directory at index, its slot stays until the last
+	// lookup reference goes
+	if(INODE(index)->children.count){
+		log_write(LOG_TRACE,"ramdisk_rmdir return enotempty cause file [%s] exists",base_name(INODE(index)->children.child[0]));
+		return -ENOTEMPTY;
+	}
+
+	// delete the folder
+	entry_remove(index);
+	if(journal)
+		wal_append(WAL_REMOVE,index,-1,0,NULL,0);
+	dir_free(index);
+	if(INODE(index)->lookups)
+		INODE(index)->unlinked=1;
+	else
+		inode_free(index);
+	return 0;
+}
+
+static int do_rmdir(const char *path)
+{
+	log_write(LOG_TRACE,"ramdisk_rmdir called with path: %s",path);
+
+	if(!strcmp(path, "/")){
+		log_write(LOG_TRACE,"ramdisk_rmdir return ebusy");
+		return -EBUSY;
+	}
+
+	// check if directory exists
+	int index = lookup_path(path);
+	if(index<0){
+		log_write(LOG_TRACE,"ramdisk_rmdir return %d",index);
+		return index;
+	}
+	if(INODE(index)->type!='d'){
+		log_write(LOG_TRACE,"ramdisk_rmdir return enotdir");
+		return -ENOTDIR;
+	}
+	return free_dir(index,1);
+}
+
+static int ramdisk_rmdir(const char *path)
+{
+	if(ctl_find(path)!=CTL_NONE)
+		return -EPERM;
+	ns_write_lock();
+	int res = do_rmdir(path);
+	ns_write_unlock();
+	return res;
+}
+
+
+static int ramdisk_statfs(struct statvfs *stbuf)
+{
+	// blocks below the fence : the ceiling, or maxsize with compression on
+	// where data can outgrow the ceiling. a block shared by dedup counts once
+	log_write(LOG_TRACE,"ramdisk_statfs called");
+	memset(stbuf, 0, sizeof(struct statvfs));
+	stbuf->f_bsize = disk->blocksize;
+	stbuf->f_frsize = disk->blocksize;
+	stbuf->f_blocks = __atomic_load_n(&disk->fenceBlocks,__ATOMIC_RELAXED);
+	stbuf->f_bfree = __atomic_load_n(&disk->freeBlocks,__ATOMIC_RELAXED);
+	stbuf->f_bavail = stbuf->f_bfree;
+	stbuf->f_files = (fsfilcnt_t)MAXINODECHUNKS*INODECHUNK;
+	stbuf->f_ffree = stbuf->f_files-__atomic_load_n(&disk->inodeCount,__ATOMIC_RELAXED);
+	stbuf->f_favail = stbuf->f_ffree;
+	stbuf->f_namemax = NAME_MAX;
+	return 0;
+}
+
+// attributes : mode, owner and times live in the record and are
+// journaled whole on every change. the disk checks no permission, the
+// kernel does it with -o default_permissions
+#define ATTR_MODE 1
+#define ATTR_OWNER 2
+#define ATTR_TIMES 4
+struct attrChange {
+	int what;
+	mode_t mode;
+	uid_t uid;	// -1 to keep
+	gid_t gid;
+	const struct timespec *times;	// atime and mtime, or UTIME_NOW or UTIME_OMIT
+};
+
+static int time_valid(const struct timespec *t){
+	return (t->tv_nsec==UTIME_NOW)||(t->tv_nsec==UTIME_OMIT)||((t->tv_nsec>=0)&&(t->tv_nsec<1000000000));
+}
+
+static void time_set(int64_t *field,const struct timespec *t,int64_t now){
+	if(t->tv_nsec==UTIME_NOW)
+		__atomic_store_n(field,now,__ATOMIC_RELAXED);
+	else if(t->tv_nsec!=UTIME_OMIT)
+		__atomic_store_n(field,(int64_t)t->tv_sec*1000000000+t->tv_nsec,__ATOMIC_RELAXED);
+}
+
+static int attr_change(int slot,const struct attrChange *c){
+	// caller holds the namespace lock
+	struct inode *n = INODE(slot);
+	if((c->what & ATTR_TIMES)&&(!time_valid(&c->times[0])||!time_valid(&c->times[1])))
+		return -EINVAL;
+	int64_t now = time_now();
+	pthread_rwlock_wrlock(&n->lock);
+	if(c->what & ATTR_MODE)
+		n->mode = c->mode & 07777;
+	if((c->what & ATTR_OWNER)&&(c->uid!=(uid_t)-1))
+		n->uid = c->uid;
+	if((c->what & ATTR_OWNER)&&(c->gid!=(gid_t)-1))
+		n->gid = c->gid;
+	if(c->what & ATTR_TIMES){
+		time_set(&n->atime,&c->times[0],now);
+		time_set(&n->mtime,&c->times[1],now);
+	}
+	__atomic_store_n(&n->ctime,now,__ATOMIC_RELAXED);
+	wal_attr(slot);
+	pthread_rwlock_unlock(&n->lock);
+	notify_inode(slot,-1,0);
+	return 0;
+}
+
+static int path_attr(const char *path,const struct attrChange *c){
+	log_write(LOG_TRACE,"ramdisk attributes of path : %s",path);
+	if(ctl_find(path)!=CTL_NONE)
+		return -EPERM;
+	ns_read_lock();
+	int slot = lookup_path(path);
+	int res = (slot<0) ? slot : attr_change(slot,c);
+	ns_read_unlock();
+	return res;
+}
+
+static int ramdisk_chmod(const char *path, mode_t mode){
+	struct attrChange c = { ATTR_MODE, mode, 0, 0, NULL };
+	return path_attr(path,&c);
+}
+
+static int ramdisk_chown(const char *path, uid_t uid, gid_t gid){
+	struct attrChange c = { ATTR_OWNER, 0, uid, gid, NULL };
+	return path_attr(path,&c);
+}
+
+static int ramdisk_utimens(const char *path, const struct timespec times[2]){
+	struct timespec now[2] = { { 0, UTIME_NOW }, { 0, UTIME_NOW } };
+	struct attrChange c = { ATTR_TIMES, 0, 0, 0, times ? times : now };
+	return path_attr(path,&c);
+}
+
+// links : a hard link is a slot of type 'h' that names the file it links
+// to, so the file keeps its one number. a symlink keeps its target in the
+// arena and is never followed here, the kernel resolves it
+static int link_create_at(int index,int parent,const char *name,int len){
+	// a new name inside parent for the file at index, returns the file's
+	// slot or -errno. caller holds the namespace write lock
+	if(INODE(index)->type=='d')
+		return -EPERM;
+	if(INODE(index)->unlinked||INODE(parent)->unlinked)
+		return -ENOENT;
+	if(lookup_child(parent,name,len)!=-1)
+		return -EEXIST;
+	int slot = inode_alloc('h');
+	if(slot==-1)
+		return -ENOMEM;
+	alias_add(slot,index);
+	int res = entry_add(parent,slot,name,len);
+	if(res){
+		alias_drop(slot);
+		inode_free(slot);
+		return res;
+	}
+	wal_name(WAL_LINK,slot,parent,index,name,len);
+	return index;
+}
+
+static int symlink_create_at(const char *target,int parent,const char *name,int len){
+	// returns the new link's slot or -errno. caller holds the namespace
+	// write lock
+	size_t size = strlen(target);
+	if(size==0)
+		return -ENOENT;
+	if(size>=PATH_MAX)
+		return -ENAMETOOLONG;
+	if(INODE(parent)->unlinked)
+		return -ENOENT;
+	if(lookup_child(parent,name,len)!=-1)
+		return -EEXIST;
+	int slot = inode_alloc('l');
+	if(slot==-1)
+		return -ENOMEM;
+	struct inode *n = INODE(slot);
+	n->mode = 0777;
+	n->target = name_alloc(target,size);
+	if(n->target==-1){
+		inode_free(slot);
+		return -ENOMEM;
+	}
+	n->size = size;
+	int res = entry_add(parent,slot,name,len);
+	if(res){
+		inode_free(slot);
+		return res;
+	}
+	wal_create(slot,name,len);
+	return slot;
+}
+
+static ssize_t link_read(int slot,char *buf,size_t size){
+	// the target as readlink(2) gives it, without a NUL
+	struct inode *n = INODE(slot);
+	if(n->type!='l')
+		return -EINVAL;
+	if(size>(size_t)n->size)
+		size = n->size;
+	memcpy(buf,name_str(n->target),size);
+	inode_accessed(slot);
+	return size;
+}
+
+static int ramdisk_link(const char *from, const char *to){
+	log_write(LOG_TRACE,"ramdisk_link called with from: [%s] and to [%s]",from,to);
+	if((ctl_find(from)!=CTL_NONE)||(ctl_find(to)!=CTL_NONE))
+		return -EPERM;
+	const char *name;
+	int len,res;
+	ns_write_lock();
+	int index = lookup_path(from);
+	int parent = lookup_parent(to,&name,&len);
+	if(index<0)
+		res = index;
+	else if(parent<0)
+		res = parent;
+	else
+		res = link_create_at(index,parent,name,len);
+	ns_write_unlock();
+	return (res<0) ? res : 0;
+}
+
+static int ramdisk_symlink(const char *target, const char *path){
+	log_write(LOG_TRACE,"ramdisk_symlink called with path : %s",path);
+	if(ctl_find(path)!=CTL_NONE)
+		return -EEXIST;
+	const char *name;
+	int len,res;
+	ns_write_lock();
+	int parent = lookup_parent(path,&name,&len);
+	res = (parent<0) ? parent : symlink_create_at(target,parent,name,len);
+	ns_write_unlock();
+	return (res<0) ? res : 0;
+}
+
+static ssize_t ramdisk_readlink(const char *path, char *buf, size_t size){
+	if(ctl_find(path)!=CTL_NONE)
+		return -EINVAL;
+	ns_read_lock();
+	int slot = lookup_path(path);
+	ssize_t res = (slot<0) ? slot : link_read(slot,buf,size);
+	ns_read_unlock();
+	return res;
+}
+
+// inode calls : the operations above keyed by a directory's number and
+// one name, for a server that holds inodes itself and never builds a
+// path. a number stays good while its holder has a lookup reference on
+// it, as the slot behind it is not freed and so not reused in between
+static int ino_slot(rd_ino_t ino){
+	// the live slot ino numbers, or -1. caller holds the namespace lock
+	if((ino==0)||(ino>(rd_ino_t)disk->inodeSlots))
+		return -1;
+	int slot = (int)(ino-1);
+	return (INODE(slot)->type && (INODE(slot)->type!='h')) ? slot : -1;
+}
+
+static int ino_dir(rd_ino_t ino){
+	// the slot of a directory still in the tree, or -errno
+	int slot = ino_slot(ino);
+	if(slot==-1)
+		return -ENOENT;
+	if(INODE(slot)->type!='d')
+		return -ENOTDIR;
+	return INODE(slot)->unlinked ? -ENOENT : slot;
+}
+
+static int name_check(const char *name){
+	// the length of a single component, or -errno
+	size_t len = strlen(name);
+	if((len==0)||strchr(name,'/')||!strcmp(name,".")||!strcmp(name,".."))
+		return -EINVAL;
+	return (len>NAME_MAX) ? -ENAMETOOLONG : (int)len;
+}
+
+static void entry_ref(int slot,struct stat *st){
+	// a lookup reference on slot, with its attributes in st. caller holds
+	// the namespace lock, which keeps unlink from looking at lookups
+	memset(st,0,sizeof(struct stat));
+	fill_stat(slot,st);
+	__atomic_add_fetch(&INODE(slot)->lookups,1,__ATOMIC_RELAXED);
+}
+
+static int ramdisk_lookup(rd_ino_t dir, const char *name, struct stat *st){
+	log_write(LOG_TRACE,"ramdisk_lookup called with dir : %lu, name : %s",dir,name);
+	int c = ctl_find_at(dir,name);
+	if(c!=CTL_NONE)
+		return ctl_getattr(c,st);
+	if(ino_ctl(dir)!=CTL_NONE)
+		return (ino_ctl(dir)==CTL_DIR) ? -ENOENT : -ENOTDIR;
+	int len = name_check(name);
+	if(len<0)
+		return len;
+	ns_read_lock();
+	int res = ino_dir(dir);
+	if(res>=0){
+		int slot = entry_target(lookup_child(res,name,len));
+		if(slot==-1){
+			res = -ENOENT;
+		}else{
+			entry_ref(slot,st);
+			res = 0;
+		}
+	}
+	ns_read_unlock();
+	return res;
+}
+
+static void ramdisk_forget(rd_ino_t ino, unsigned long n){
+	// control entries are never freed and hold no count
+	if(ino_ctl(ino)!=CTL_NONE)
+		return;
+	ns_read_lock();
+	int last = 0,slot = ino_slot(ino);
+	if(slot!=-1){
+		struct inode *i = INODE(slot);
+		last = (__atomic_sub_fetch(&i->lookups,(long)n,__ATOMIC_ACQ_REL)==0)&&i->unlinked&&(__atomic_load_n(&i->openCount,__ATOMIC_ACQUIRE)==0);
+	}
+	ns_read_unlock();
+	if(last)
+		inode_release(slot);
+}
+
+static int ramdisk_stat_ino(rd_ino_t ino, struct stat *st){
+	int c = ino_ctl(ino);
+	if(c!=CTL_NONE)
+		return ctl_getattr(c,st);
+	ns_read_lock();
+	int slot = ino_slot(ino);
+	if(slot!=-1){
+		memset(st,0,sizeof(struct stat));
+		fill_stat(slot,st);
+	}
+	ns_read_unlock();
+	return (slot==-1) ? -ENOENT : 0;
+}
+
+static int ramdisk_truncate_ino(rd_ino_t ino, off_t length){
+	int res = ino_ctl(ino);
+	if(res!=CTL_NONE)
+		return (res==CTL_DIR) ? -EISDIR : 0;
+	if(length<0)
+		return -EINVAL;
+	ns_read_lock();
+	int index = ino_slot(ino);
+	if(index==-1){
+		res = -ENOENT;
+	}else if(INODE(index)->type=='d'){
+		res = -EISDIR;
+	}else if(INODE(index)->type=='l'){
+		res = -EINVAL;
+	}else{
+		pthread_rwlock_wrlock(&INODE(index)->lock);
+		res = file_resize(index,length);
+		pthread_rwlock_unlock(&INODE(index)->lock);
+	}
+	ns_read_unlock();
+	return res;
+}
+
+static int ramdisk_open_ino(rd_ino_t ino, int flags){
+	log_write(LOG_TRACE,"ramdisk_open_ino called with ino : %lu",ino);
+	if((flags & O_ACCMODE)==O_ACCMODE)
+		return -EINVAL;
+	flags &= ~(O_CREAT|O_EXCL);
+	int c = ino_ctl(ino);
+	if(c!=CTL_NONE)
+		return ctl_open(c,flags);
+	ns_read_lock();
+	int res = ino_slot(ino);
+	res = (res==-1) ? -ENOENT : open_slot(res,flags);
+	if(res>=0)
+		res = fd_alloc(res,CTL_NONE,flags);
+	ns_read_unlock();
+	return res;
+}
+
+static int ramdisk_openat(rd_ino_t dir, const char *name, int flags, mode_t mode, struct stat *st){
+	// rd_open of name inside dir, O_CREAT takes the namespace write lock
+	log_write(LOG_TRACE,"ramdisk_openat called with dir : %lu, name : %s",dir,name);
+	int res,create = flags & O_CREAT;
+	if((flags & O_ACCMODE)==O_ACCMODE)
+		return -EINVAL;
+	int c = ctl_find_at(dir,name);
+	if(c!=CTL_NONE){
+		res = ctl_open(c,flags);
+		if((res>=0)&&st)
+			ctl_getattr(c,st);
+		return res;
+	}
+	int len = name_check(name);
+	if(len<0)
+		return len;
+	if(create)
+		ns_write_lock();
+	else
+		ns_read_lock();
+	res = ino_dir(dir);
+	if(res>=0){
+		int index = entry_target(lookup_child(res,name,len));
+		if(index==-1)
+			res = create ? file_create_at(res,name,len,mode) : -ENOENT;
+		else
+			res = open_slot(index,flags);
+	}
+	if(res>=0){
+		int slot = res;
+		res = fd_alloc(slot,CTL_NONE,flags);
+		if((res>=0)&&st)
+			entry_ref(slot,st);
+	}
+	if(create)
+		ns_write_unlock();
+	else
+		ns_read_unlock();
+	return res;
+}
+
+static int ramdisk_mkdirat(rd_ino_t dir, const char *name, mode_t mode, struct stat *st){
+	log_write(LOG_TRACE,"ramdisk_mkdirat called with dir : %lu, name : %s",dir,name);
+	if(ctl_find_at(dir,name)!=CTL_NONE)
+		return -EEXIST;
+	int len = name_check(name);
+	if(len<0)
+		return len;
+	ns_write_lock();
+	int res = ino_dir(dir);
+	if(res>=0)
+		res = dir_create(res,name,len,mode);
+	if((res>=0)&&st)
+		entry_ref(res,st);
+	ns_write_unlock();
+	return (res<0) ? res : 0;
+}
+
+static int ramdisk_unlinkat(rd_ino_t dir, const char *name, int flags){
+	log_write(LOG_TRACE,"ramdisk_unlinkat called with dir : %lu, name : %s",dir,name);
+	if(ctl_find_at(dir,name)!=CTL_NONE)
+		return -EPERM;
+	int len = name_check(name);
+	if(len<0)
+		return len;
+	ns_write_lock();
+	int res = ino_dir(dir);
+	if(res>=0){
+		int index = lookup_child(res,name,len);
+		if(index==-1){
+			res = -ENOENT;
+		}else if(flags & AT_REMOVEDIR){
+			res = (INODE(index)->type=='d') ? free_dir(index,1) : -ENOTDIR;
+		}else if(INODE(index)->type=='d'){
+			res = -EISDIR;
+		}else{
+			res = free_file(index,1);
+		}
+	}
+	ns_write_unlock();
+	return res;
+}
+
+static int ramdisk_renameat(rd_ino_t olddir, const char *oldname, rd_ino_t newdir, const char *newname, int flags){
+	log_write(LOG_TRACE,"ramdisk_renameat called with from : %lu/%s, to : %lu/%s",olddir,oldname,newdir,newname);
+	if((ctl_find_at(olddir,oldname)!=CTL_NONE)||(ctl_find_at(newdir,newname)!=CTL_NONE))
+		return -EPERM;
+	int oldLen = name_check(oldname),newLen = name_check(newname);
+	if(oldLen<0)
+		return oldLen;
+	if(newLen<0)
+		return newLen;
+	ns_write_lock();
+	int from = ino_dir(olddir),to = ino_dir(newdir),res;
+	if(from<0){
+		res = from;
+	}else if(to<0){
+		res = to;
+	}else{
+		int index = lookup_child(from,oldname,oldLen);
+		res = (index==-1) ? -ENOENT : move_entry(index,to,newname,newLen,flags);
+	}
+	ns_write_unlock();
+	return res;
+}
+
+static int ino_attr(rd_ino_t ino,const struct attrChange *c){
+	if(ino_ctl(ino)!=CTL_NONE)
+		return -EPERM;
+	ns_read_lock();
+	int slot = ino_slot(ino);
+	int res = (slot==-1) ? -ENOENT : attr_change(slot,c);
+	ns_read_unlock();
+	return res;
+}
+
+static int ramdisk_chmod_ino(rd_ino_t ino, mode_t mode){
+	struct attrChange c = { ATTR_MODE, mode, 0, 0, NULL };
+	return ino_attr(ino,&c);
+}
+
+static int ramdisk_chown_ino(rd_ino_t ino, uid_t uid, gid_t gid){
+	struct attrChange c = { ATTR_OWNER, 0, uid, gid, NULL };
+	return ino_attr(ino,&c);
+}
+
+static int ramdisk_utimens_ino(rd_ino_t ino, const struct timespec times[2]){
+	struct timespec now[2] = { { 0, UTIME_NOW }, { 0, UTIME_NOW } };
+	struct attrChange c = { ATTR_TIMES, 0, 0, 0, times ? times : now };
+	return ino_attr(ino,&c);
+}
+
+static int ramdisk_linkat(rd_ino_t ino, rd_ino_t newdir, const char *newname, struct stat *st){
+	log_write(LOG_TRACE,"ramdisk_linkat called with ino : %lu, to : %lu/%s",ino,newdir,newname);
+	if((ino_ctl(ino)!=CTL_NONE)||(ctl_find_at(newdir,newname)!=CTL_NONE))
+		return -EPERM;
+	int len = name_check(newname);
+	if(len<0)
+		return len;
+	ns_write_lock();
+	int index = ino_slot(ino),res = ino_dir(newdir);
+	if(index==-1)
+		res = -ENOENT;
+	else if(res>=0)
+		res = link_create_at(index,res,newname,len);
+	if((res>=0)&&st)
+		entry_ref(res,st);
+	ns_write_unlock();
+	return (res<0) ? res : 0;
+}
+
+static int ramdisk_symlinkat(const char *target, rd_ino_t dir, const char *name, struct stat *st){
+	log_write(LOG_TRACE,"ramdisk_symlinkat called with dir : %lu, name : %s",dir,name);
+	if(ctl_find_at(dir,name)!=CTL_NONE)
+		return -EEXIST;
+	int len = name_check(name);
+	if(len<0)
+		return len;
+	ns_write_lock();
+	int res = ino_dir(dir);
+	if(res>=0)
+		res = symlink_create_at(target,res,name,len);
+	if((res>=0)&&st)
+		entry_ref(res,st);
+	ns_write_unlock();
+	return (res<0) ? res : 0;
+}
+
+static ssize_t ramdisk_readlink_ino(rd_ino_t ino, char *buf, size_t size){
+	if(ino_ctl(ino)!=CTL_NONE)
+		return -EINVAL;
+	ns_read_lock();
+	int slot = ino_slot(ino);
+	ssize_t res = (slot==-1) ? -ENOENT : link_read(slot,buf,size);
+	ns_read_unlock();
+	return res;
+}
+
+static int ramdisk_readdir_ino(rd_ino_t ino, rd_filler_t filler, void *arg){
+	int res = ino_ctl(ino);
+	if(res==CTL_DIR)
+		return ctl_readdir(filler,arg);
+	if(res!=CTL_NONE)
+		return -ENOTDIR;
+	ns_read_lock();
+	res = ino_slot(ino);
+	if(res==-1)
+		res = -ENOENT;
+	else if(INODE(res)->type!='d')
+		res = -ENOTDIR;
+	else
+		res = dir_list(res,filler,arg);
+	ns_read_unlock();
+	return res;
+}
+
+static int write_all(int fd,const char *buf,size_t len,off_t offset){
+	// pwrite everything, or append when offset is -1
+	while(len){
+		ssize_t n = (offset==-1) ? write(fd,buf,len) : pwrite(fd,buf,len,offset);
+		if(n<0){
+			if(errno==EINTR)
+				continue;
+			return -errno;
+		}
+		buf += n;
+		len -= n;
+		if(offset!=-1)
+			offset += n;
+	}
+	return 0;
+}
+
+static int read_all(int fd,char *buf,size_t len,off_t offset){
+	while(len){
+		ssize_t n = pread(fd,buf,len,offset);
+		if(n<0){
+			if(errno==EINTR)
+				continue;
+			return -errno;
+		}
+		if(n==0)
+			return -EIO;
+		buf += n;
+		len -= n;
+		offset += n;
+	}
+	return 0;
+}
+
+static int persist_init(){
+	// the dirty map and the checkpoint's copies, sized like the bitmap
+	disk->dirtyMap = (uint64_t*) calloc(disk->bitMapWords,sizeof(uint64_t));
+	disk->ckptDirty = (uint64_t*) calloc(disk->bitMapWords,sizeof(uint64_t));
+	disk->ckptBitmap = (uint64_t*) calloc(disk->bitMapWords,sizeof(uint64_t));
+	if((disk->dirtyMap==NULL)||(disk->ckptDirty==NULL)||(disk->ckptBitmap==NULL))
+		return -ENOMEM;
+	return 0;
+}
+
+#define WALPATHMAX (PATH_MAX+32)
+
+static void wal_path(char *path,uint64_t seq){
+	snprintf(path,WALPATHMAX,"%s.wal.%llu",disk->persistPath,(unsigned long long)seq);
+}
+
+static int wal_open(uint64_t seq){
+	char path[WALPATHMAX];
+	wal_path(path,seq);
+	int fd = open(path,O_WRONLY|O_CREAT|O_APPEND|O_CLOEXEC,0644);
+	if(fd==-1)
+		log_write(LOG_ERROR,"wal_open : cannot open [%s] : %s",path,strerror(errno));
+	return fd;
+}
+
+static int wal_seq_cmp(const void *a,const void *b){
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return (x>y) - (x<y);
+}
+
+static int wal_list(uint64_t **seqs){
+	// the starting sequences of the journals next to the image, sorted,
+	// returns how many or -errno
+	char dir[PATH_MAX];
+	strcpy(dir,disk->persistPath);
+	char *slash = strrchr(dir,'/');
+	const char *base = slash ? slash+1 : dir;
+	char prefix[WALPATHMAX];
+	snprintf(prefix,sizeof(prefix),"%s.wal.",base);
+	if(slash)
+		*slash = (slash==dir) ? (slash[1]=0,'/') : 0;
+	else
+		strcpy(dir,".");
+	DIR *d = opendir(dir);
+	if(d==NULL)
+		return -errno;
+	struct dirent *e;
+	int count = 0,cap = 0;
+	size_t plen = strlen(prefix);
+	*seqs = NULL;
+	while((e = readdir(d))!=NULL){
+		char *end;
+		if(strncmp(e->d_name,prefix,plen)||!e->d_name[plen])
+			continue;
+		unsigned long long seq = strtoull(e->d_name+plen,&end,10);
+		if(*end)
+			continue;
+		if(count==cap){
+			cap = cap ? cap*2 : 8;
+			uint64_t *list = (uint64_t*) realloc(*seqs,cap*sizeof(uint64_t));
+			if(list==NULL){
+				closedir(d);
+				free(*seqs);
+				return -ENOMEM;
+			}
+			*seqs = list;
+		}
+		(*seqs)[count++] = seq;
+	}
+	closedir(d);
+	if(count)
+		qsort(*seqs,count,sizeof(uint64_t),wal_seq_cmp);	// *seqs is NULL without any
+	return count;
+}
+
+static void wal_prune(uint64_t keep){
+	// remove the journals that start before keep, a checkpoint holds them
+	uint64_t *seqs;
+	char path[WALPATHMAX];
+	int i,count = wal_list(&seqs);
+	for(i=0;i<count;i++){
+		if(seqs[i]<keep){
+			wal_path(path,seqs[i]);
+			unlink(path);
+		}
+	}
+	if(count>0)
+		free(seqs);
+}
+
+static size_t wal_split(const char *queue,size_t len,uint64_t seq){
+	// bytes of queue taken by records up to seq
+	size_t pos = 0;
+	while(pos<len){
+		const struct walRecord *r = (const struct walRecord *)(queue+pos);
+		if(r->seq>seq)
+			break;
+		pos += r->length;
+	}
+	return pos;
+}
+
+static int wal_out(int fd,const char *queue,size_t len){
+	if(len==0)
+		return 0;
+	if((fd==-1)||write_all(fd,queue,len,-1)||fdatasync(fd))
+		return -EIO;
+	__atomic_add_fetch(&disk->walBytes,len,__ATOMIC_RELAXED);
+	return 0;
+}
+
+static void *wal_thread(void *arg){
+	disk = (struct ramdisk *)arg;
+	// write the queue out every walFlushMs, or sooner when asked. the
+	// queue is swapped for the spare buffer so writers carry on meanwhile
+	int fd = wal_open(disk->walFileSeq);
+	pthread_mutex_lock(&disk->walLock);
+	for(;;){
+		if(!disk->walUrgent && !disk->walStop){
+			if(disk->walFlushMs){
+				struct timespec until;
+				clock_gettime(CLOCK_REALTIME,&until);
+				until.tv_sec += disk->walFlushMs/1000;
+				until.tv_nsec += (disk->walFlushMs%1000)*1000000L;
+				if(until.tv_nsec>=1000000000L){
+					until.tv_sec++;
+					until.tv_nsec -= 1000000000L;
+				}
+				pthread_cond_timedwait(&disk->walWake,&disk->walLock,&until);
+			}else{
+				pthread_cond_wait(&disk->walWake,&disk->walLock);
+			}
+		}
+		disk->walUrgent = 0;
+		if(!disk->walLen && !disk->walRotate){
+			if(!disk->walError)
+				disk->walDurable = disk->walSeq;
+			pthread_cond_broadcast(&disk->walDone);
+			if(disk->walStop)
+				break;
+			continue;
+		}
+		char *queue = disk->walQueue;
+		size_t cap = disk->walCap,len = disk->walLen;
+		uint64_t seq = disk->walSeq,rotateSeq = disk->walRotateSeq;
+		int rotate = disk->walRotate;
+		disk->walQueue = disk->walSpare;
+		disk->walCap = disk->walSpareCap;
+		disk->walLen = 0;
+		disk->walRotate = 0;
+		pthread_mutex_unlock(&disk->walLock);
+
+		size_t head = rotate ? wal_split(queue,len,rotateSeq) : len;
+		int err = wal_out(fd,queue,head);
+		if(rotate){
+			// records after rotateSeq start the next journal
+			if(fd!=-1)
+				close(fd);
+			fd = wal_open(rotateSeq);
+			__atomic_store_n(&disk->walBytes,0,__ATOMIC_RELAXED);
+		}
+		err |= wal_out(fd,queue+head,len-head);
+		int full = (__atomic_load_n(&disk->walBytes,__ATOMIC_RELAXED) >= disk->walLimit);
+
+		pthread_mutex_lock(&disk->walLock);
+		disk->walSpare = queue;
+		disk->walSpareCap = cap;
+		if(rotate)
+			disk->walFileSeq = rotateSeq;
+		if(err){
+			if(!disk->walError)
+				log_write(LOG_ERROR,"wal_thread : journal write failed");
+			disk->walError = EIO;
+		}else{
+			disk->walDurable = seq;
+		}
+		pthread_cond_broadcast(&disk->walDone);
+		if(full){
+			pthread_mutex_lock(&disk->ckptWaitLock);
+			disk->ckptKick = 1;
+			pthread_cond_signal(&disk->ckptWake);
+			pthread_mutex_unlock(&disk->ckptWaitLock);
+		}
+	}
+	pthread_mutex_unlock(&disk->walLock);
+	if(fd!=-1)
+		close(fd);
+	return NULL;
+}
+
+static int wal_sync(){
+	// wait until every record queued so far is on disk
+	int res = 0;
+	if(!disk->walActive)
+		return 0;
+	pthread_mutex_lock(&disk->walLock);
+	uint64_t target = disk->walSeq;
+	while((disk->walDurable<target)&&!disk->walError&&disk->persistRunning){
+		disk->walUrgent = 1;
+		pthread_cond_signal(&disk->walWake);
+		pthread_cond_wait(&disk->walDone,&disk->walLock);
+	}
+	if(disk->walError)
+		res = -EIO;
+	pthread_mutex_unlock(&disk->walLock);
+	return res;
+}
+
+static int image_header_write(struct imageHeader *h){
+	char slot[IMAGEHEADER];
+	h->check = 0;
+	h->check = checksum(h,sizeof(*h),CHECKSEED);
+	memset(slot,0,sizeof(slot));
+	memcpy(slot,h,sizeof(*h));
+	if(write_all(disk->imageFd,slot,sizeof(slot),(h->generation&1)*IMAGEHEADER)||fdatasync(disk->imageFd))
+		return -EIO;
+	return 0;
+}
+
+static int image_header_read(int fd,struct imageHeader *h){
+	// the newer of the two slots that check out, -1 if neither does
+	struct imageHeader slot[2];
+	int i,best = -1;
+	for(i=0;i<2;i++){
+		struct imageHeader *c = &slot[i];
+		uint64_t check;
+		if(pread(fd,c,sizeof(*c),i*IMAGEHEADER)!=sizeof(*c))
+			continue;
+		check = c->check;
+		c->check = 0;
+		if(memcmp(c->magic,IMAGEMAGIC,sizeof(IMAGEMAGIC))||(checksum(c,sizeof(*c),CHECKSEED)!=check))
+			continue;
+		c->check = check;
+		if((best==-1)||(c->generation>slot[best].generation))
+			best = i;
+	}
+	if(best==-1)
+		return -1;
+	*h = slot[best];
+	return 0;
+}
+
+static void ckpt_finish(){
+	// let the runs freed while blocks were copied go
+	int i;
+	pthread_mutex_lock(&disk->allocLock);
+	disk->ckptActive = 0;
+	for(i=0;i<disk->ckptDeferred.count;i++)
+		free_run_locked(disk->ckptDeferred.ext[i].pblock,disk->ckptDeferred.ext[i].count);
+	disk->ckptDeferred.count = 0;
+	disk->ckptDeferredBlocks = 0;
+	pthread_mutex_unlock(&disk->allocLock);
+}
+
+static int ckpt_blocks(long *written){
+	// copy the dirty blocks that were in use into the image, punch the
+	// dirty ones that were free out of it. cold blocks are inflated one
+	// at a time, and none goes cold while the copy runs
+	long b = 0;
+	int res = 0;
+	char *bounce = NULL;
+	*written = 0;
+	if(disk->coldMap!=NULL){
+		bounce = (char *) malloc(disk->blocksize);
+		if(bounce==NULL)
+			return -ENOMEM;
+		pthread_mutex_lock(&disk->tierGate);
+	}
+	while((b<disk->maxBlocks)&&!res){
+		if(disk->ckptDirty[b>>6]==0){
+			b = (b|63)+1;
+			continue;
+		}
+		if(!((disk->ckptDirty[b>>6] >> (b&63)) & 1)){
+			b++;
+			continue;
+		}
+		int used = (disk->ckptBitmap[b>>6] >> (b&63)) & 1;
+		int cold = used && tier_is_cold(b);
+		long e = b+1;
+		while(!cold&&(e<disk->maxBlocks)&&(e-b<CKPTRUN)&&((disk->ckptDirty[e>>6] >> (e&63)) & 1)&&((int)((disk->ckptBitmap[e>>6] >> (e&63)) & 1)==used)&&!(used && tier_is_cold(e)))
+			e++;
+		off_t offset = disk->image.dataOffset + (off_t)b*disk->blocksize;
+		if(cold){
+			tier_copy(b,1,bounce);
+			if(write_all(disk->imageFd,bounce,disk->blocksize,offset))
+				res = -EIO;
+			*written += 1;
+		}else if(used){
+			if(write_all(disk->imageFd,disk->memoffset+b*disk->blocksize,(e-b)*disk->blocksize,offset))
+				res = -EIO;
+			*written += e-b;
+		}else{
+			fallocate(disk->imageFd,FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE,offset,(e-b)*disk->blocksize);
+		}
+		b = e;
+	}
+	if(disk->coldMap!=NULL)
+		pthread_mutex_unlock(&disk->tierGate);
+	free(bounce);
+	return res;
+}
+
+static int checkpoint(int rotate){
+	// bring the image up to date. the metadata, the bitmap and the dirty
+	// map are taken together under the namespace write lock at journal
+	// sequence seq : records up to seq are in what was taken, later ones
+	// are replayed over it and repeat cleanly. blocks are copied after
+	// the lock is dropped, so they may hold newer data of the same file,
+	// but none can change owner before the header is written. rotate
+	// starts a new journal at seq through the flusher
+	long i,written = 0;
+	char *meta = NULL;
+	size_t metaLen = 0;
+	struct timespec t0,t1;
+	clock_gettime(CLOCK_MONOTONIC,&t0);
+
+	ns_write_lock();
+	pthread_mutex_lock(&disk->walLock);
+	uint64_t seq = disk->walSeq;
+	if(rotate && (seq!=disk->image.seq)){
+		disk->walRotate = 1;
+		disk->walRotateSeq = seq;
+		disk->walUrgent = 1;
+		pthread_cond_signal(&disk->walWake);
+	}
+	pthread_mutex_unlock(&disk->walLock);
+	if((seq==disk->image.seq)&&(disk->image.generation!=0)){
+		ns_write_unlock();
+		return 0;
+	}
+	pthread_mutex_lock(&disk->allocLock);
+	disk->ckptActive = 1;
+	memcpy(disk->ckptBitmap,disk->bitMap,disk->bitMapWords*sizeof(uint64_t));
+	long ceiling = disk->blockcount;
+	pthread_mutex_unlock(&disk->allocLock);
+	for(i=0;i<disk->bitMapWords;i++)
+		disk->ckptDirty[i] = __atomic_exchange_n(&disk->dirtyMap[i],0,__ATOMIC_RELAXED);
+	FILE *metaFile = open_memstream(&meta,&metaLen);
+	if(metaFile!=NULL){
+		ns_save(metaFile);
+		if(fclose(metaFile))
+			metaFile = NULL;
+	}
+	ns_write_unlock();
+
+	int res = (metaFile==NULL) ? -ENOMEM : ckpt_blocks(&written);
+	struct imageHeader next = disk->image;
+	uint64_t low = (disk->image.dataOffset + (uint64_t)disk->maxBlocks*disk->blocksize + IMAGEALIGN-1) & ~(uint64_t)(IMAGEALIGN-1);
+	if(res==0){
+		if(disk->image.metaOffset==0)
+			next.metaOffset = low;
+		else if((disk->image.metaOffset!=low)&&(metaLen <= disk->image.metaOffset-low))
+			next.metaOffset = low;
+		else
+			next.metaOffset = (disk->image.metaOffset + disk->image.metaLength + IMAGEALIGN-1) & ~(uint64_t)(IMAGEALIGN-1);
+		next.metaLength = metaLen;
+		next.metaCheck = checksum(meta,metaLen,CHECKSEED);
+		next.generation++;
+		next.version = IMAGEVERSION;
+		next.seq = seq;
+		next.blockcount = ceiling;
+		if(write_all(disk->imageFd,meta,metaLen,next.metaOffset)||fdatasync(disk->imageFd)||image_header_write(&next))
+			res = -EIO;
+	}
+	if(res==0){
+		// a copy just after the data section leaves the older one past
+		// it unused
+		if(next.metaOffset==low)
+			ftruncate(disk->imageFd,next.metaOffset+next.metaLength);
+		disk->image = next;
+	}else{
+		// the blocks go out again with the next checkpoint
+		for(i=0;i<disk->bitMapWords;i++){
+			if(disk->ckptDirty[i])
+				__atomic_fetch_or(&disk->dirtyMap[i],disk->ckptDirty[i],__ATOMIC_RELAXED);
+		}
+		log_write(LOG_ERROR,"checkpoint : writing [%s] failed",disk->persistPath);
+	}
+	ckpt_finish();
+	free(meta);
+
+	if((res==0)&&rotate){
+		// the journals before seq are in the image once the flusher has
+		// moved on to the next one
+		pthread_mutex_lock(&disk->walLock);
+		while((disk->walFileSeq<seq)&&!disk->walError&&disk->persistRunning){
+			disk->walUrgent = 1;
+			pthread_cond_signal(&disk->walWake);
+			pthread_cond_wait(&disk->walDone,&disk->walLock);
+		}
+		int moved = (disk->walFileSeq>=seq);
+		pthread_mutex_unlock(&disk->walLock);
+		if(moved)
+			wal_prune(seq);
+	}
+	clock_gettime(CLOCK_MONOTONIC,&t1);
+	if(res==0)
+		log_write(LOG_INFO,"checkpoint : seq %llu, %ld blocks and %zu bytes of metadata in %ld ms",(unsigned long long)seq,written,metaLen,(t1.tv_sec-t0.tv_sec)*1000+(t1.tv_nsec-t0.tv_nsec)/1000000);
+	return res;
+}
+
+static void *ckpt_thread(void *arg){
+	disk = (struct ramdisk *)arg;
+	pthread_mutex_lock(&disk->ckptWaitLock);
+	while(!disk->ckptStop){
+		if(!disk->ckptKick){
+			if(disk->ckptInterval){
+				struct timespec until;
+				clock_gettime(CLOCK_REALTIME,&until);
+				until.tv_sec += disk->ckptInterval;
+				pthread_cond_timedwait(&disk->ckptWake,&disk->ckptWaitLock,&until);
+			}else{
+				pthread_cond_wait(&disk->ckptWake,&disk->ckptWaitLock);
+			}
+		}
+		if(disk->ckptStop)
+			break;
+		disk->ckptKick = 0;
+		pthread_mutex_unlock(&disk->ckptWaitLock);
+		checkpoint(1);
+		pthread_mutex_lock(&disk->ckptWaitLock);
+	}
+	pthread_mutex_unlock(&disk->ckptWaitLock);
+	return NULL;
+}
+
+static int image_create(){
+	// a fresh image for a fresh disk, written out as checkpoint 1
+	disk->imageFd = open(disk->persistPath,O_RDWR|O_CREAT|O_EXCL|O_CLOEXEC,0644);
+	if(disk->imageFd==-1){
+		log_write(LOG_ERROR,"image_create : cannot create [%s] : %s",disk->persistPath,strerror(errno));
+		return -1;
+	}
+	memset(&disk->image,0,sizeof(disk->image));
+	memcpy(disk->image.magic,IMAGEMAGIC,sizeof(IMAGEMAGIC));
+	disk->image.version = IMAGEVERSION;
+	disk->image.headerSize = sizeof(disk->image);
+	disk->image.blocksize = disk->blocksize;
+	disk->image.blockcount = disk->blockcount;
+	disk->image.maxBlocks = disk->maxBlocks;
+	disk->image.dataOffset = IMAGEDATA;
+	if(persist_init()||ftruncate(disk->imageFd,disk->image.dataOffset+(off_t)disk->maxBlocks*disk->blocksize)||checkpoint(0))
+		return -1;
+	wal_prune(~0ULL);	// stale journals of an image that was removed
+	disk->walFileSeq = 0;
+	disk->walActive = 1;
+	return 0;
+}
+
+static void attr_apply(int slot,const struct walAttr *a){
+	struct inode *n = INODE(slot);
+	n->mode = a->owner.mode & 07777;
+	n->uid = a->owner.uid;
+	n->gid = a->owner.gid;
+	n->atime = a->atime;
+	n->mtime = a->mtime;
+	n->ctime = a->ctime;
+}
+
+static int wal_apply_create(struct walRecord *r,const char *data){
+	// a journal from before WAL_OWNED has the name alone, and the
+	// defaults it was shown with
+	int slot = r->slot;
+	char type = (char)(r->value & 0xff);
+	size_t len = r->dataLen,targetLen = 0;
+	const char *target = NULL;
+	struct walOwner o = { (type=='d') ? 0755 : 0644, disk->uid, disk->gid, 0 };
+	if((r->parent<0)||(r->parent>=disk->inodeSlots)||(INODE(r->parent)->type!='d')||(slot<0))
+		return -EIO;
+	if(r->value & WAL_OWNED){
+		if(len<sizeof(o))
+			return -EIO;
+		memcpy(&o,data,sizeof(o));
+		data += sizeof(o);
+		len -= sizeof(o);
+		if(type=='l'){
+			const char *nul = (const char *) memchr(data,'\0',len);
+			if((nul==NULL)||(nul+1==data+len)||(data+len-nul > PATH_MAX))
+				return -EIO;
+			target = nul+1;
+			targetLen = data+len-target;
+			len = nul-data;
+		}
+	}
+	if(((type!='d')&&(type!='r')&&(type!='l'))||((type=='l')&&(target==NULL))||inode_claim(slot,type))
+		return -EIO;
+	struct inode *n = INODE(slot);
+	n->mode = o.mode & 07777;
+	n->uid = o.uid;
+	n->gid = o.gid;
+	if(target){
+		if((n->target = name_alloc(target,targetLen))==-1)
+			return -ENOMEM;
+		n->size = targetLen;
+	}
+	return entry_add(r->parent,slot,data,len);
+}
+
+static int wal_apply_rename(struct walRecord *r,const char *data){
+	// the name a replacing rename takes is dropped here, as it was live
+	int slot = r->slot;
+	if((slot<0)||(slot>=disk->inodeSlots)||!INODE(slot)->type||(slot==ROOTDIR)||
+		(r->parent<0)||(r->parent>=disk->inodeSlots)||(INODE(r->parent)->type!='d'))
+		return -EIO;
+	int target = (r->value & WAL_REPLACE) ? lookup_child(r->parent,data,r->dataLen) : -1;
+	int res = entry_move(slot,r->parent,data,r->dataLen);
+	if(res||(target==-1)||(target==slot))
+		return res;
+	return (INODE(target)->type=='d') ? free_dir(target,0) : free_file(target,0);
+}
+
+static int wal_apply(struct walRecord *r,const char *data){
+	// redo one record, the namespace is whatever replay built so far
+	int slot = r->slot;
+	int live = (slot>=0)&&(slot<disk->inodeSlots)&&INODE(slot)->type;
+	switch(r->type){
+	case WAL_WRITE:
+		if(!live||(INODE(slot)->type!='r'))
+			return 0;	// written after it was unlinked
+		return (file_write(slot,data,r->dataLen,r->value,NULL)<0) ? -ENOSPC : 0;
+	case WAL_TRUNCATE:
+		if(!live||(INODE(slot)->type!='r'))
+			return 0;
+		return file_resize(slot,r->value);
+	case WAL_CREATE:
+		return wal_apply_create(r,data);
+	case WAL_REMOVE:
+		if(!live||(slot==ROOTDIR))
+			return -EIO;
+		entry_remove(slot);
+		if(INODE(slot)->type=='d'){
+			dir_free(slot);
+		}else if(INODE(slot)->type=='h'){
+			alias_drop(slot);
+		}else{
+			release_blocks(slot);
+		}
+		inode_free(slot);
+		return 0;
+	case WAL_RENAME:
+		return wal_apply_rename(r,data);
+	case WAL_EXCHANGE:
+		if(!live||(r->value<0)||(r->value>=disk->inodeSlots)||!INODE(r->value)->type||
+			(INODE(slot)->parent==-1)||(INODE(r->value)->parent==-1)||(slot==r->value))
+			return -EIO;
+		entry_swap(slot,(int)r->value);
+		return 0;
+	case WAL_CEILING:
+		return disk_resize(r->value);
+	case WAL_ALLOCATE:
+		if(r->dataLen!=sizeof(int64_t))
+			return -EIO;
+		if(!live||(INODE(slot)->type!='r'))
+			return 0;
+		return file_allocate(slot,r->parent,r->value,*(const int64_t *)data);
+	case WAL_ATTR:
+		if(r->dataLen!=sizeof(struct walAttr))
+			return -EIO;
+		if(!live)
+			return 0;
+		attr_apply(slot,(const struct walAttr *)data);
+		return 0;
+	case WAL_LINK:
+		if((r->parent<0)||(r->parent>=disk->inodeSlots)||(INODE(r->parent)->type!='d')||(slot<0)||
+			(r->value<0)||(r->value>=disk->inodeSlots)||((INODE(r->value)->type!='r')&&(INODE(r->value)->type!='l')))
+			return -EIO;
+		if(inode_claim(slot,'h'))
+			return -EIO;
+		alias_add(slot,(int)r->value);
+		return entry_add(r->parent,slot,data,r->dataLen);
+	}
+	return -EIO;
+}
+
+static int wal_replay(){
+	// apply the records after the checkpoint from every journal in order.
+	// a journal ends at its first record that does not check out, the
+	// tail of a write cut short by a crash
+	uint64_t *seqs;
+	int i,count = wal_list(&seqs),res = 0;
+	long applied = 0;
+	char *buf = NULL;
+	size_t cap = 0;
+	if(count<0)
+		return count;
+	for(i=0;(i<count)&&!res;i++){
+		char path[WALPATHMAX];
+		wal_path(path,seqs[i]);
+		int fd = open(path,O_RDONLY|O_CLOEXEC);
+		if(fd==-1)
+			continue;
+		off_t pos = 0;
+		struct walRecord r;
+		while(!res && (pread(fd,&r,sizeof(r),pos)==sizeof(r))){
+			if((r.magic!=WALMAGIC)||(r.length<sizeof(r))||(r.length&7)||(r.dataLen>r.length-sizeof(r)))
+				break;
+			if(r.length>cap){
+				char *b = (char *) realloc(buf,r.length);
+				if(b==NULL){
+					res = -ENOMEM;
+					break;
+				}
+				buf = b;
+				cap = r.length;
+			}
+			if(read_all(fd,buf,r.length,pos))
+				break;
+			struct walRecord *rec = (struct walRecord *)buf;
+			uint64_t check = rec->check;
+			rec->check = 0;
+			if(checksum(buf,r.length,CHECKSEED)!=check)
+				break;
+			pos += r.length;
+			if(r.seq<=disk->walSeq)
+				continue;
+			res = wal_apply(rec,buf+sizeof(r));
+			if(res)
+				log_write(LOG_ERROR,"wal_replay : record %llu of [%s] does not apply",(unsigned long long)r.seq,path);
+			disk->walSeq = r.seq;
+			applied++;
+		}
+		close(fd);
+	}
+	free(buf);
+	if(count>0)
+		free(seqs);
+	log_write(LOG_INFO,"wal_replay : %ld records replayed, at seq %llu",applied,(unsigned long long)disk->walSeq);
+	return res;
+}
+
+static void persist_start(){
+	// the flusher and the checkpoint thread, started by rd_start after
+	// the daemon has forked
+	if(!disk->usePersist||disk->useSnapshot||disk->persistRunning)
+		return;
+	disk->walStop = 0;
+	disk->ckptStop = 0;
+	if(pthread_create(&disk->walThread,NULL,wal_thread,disk)){
+		log_write(LOG_ERROR,"persist_start : no flusher thread");
+		return;
+	}
+	disk->persistRunning = 1;
+	if(pthread_create(&disk->ckptThread,NULL,ckpt_thread,disk))
+		log_write(LOG_ERROR,"persist_start : no checkpoint thread, checkpoints only at unmount");
+	else
+		disk->persistRunning = 2;
+}
+
+static void persist_stop(){
+	// a last checkpoint, then the journals go : a clean unmount leaves
+	// only the image
+	if(!disk->persistRunning)
+		return;
+	if(disk->persistRunning==2){
+		pthread_mutex_lock(&disk->ckptWaitLock);
+		disk->ckptStop = 1;
+		pthread_cond_signal(&disk->ckptWake);
+		pthread_mutex_unlock(&disk->ckptWaitLock);
+		pthread_join(disk->ckptThread,NULL);
+	}
+	int res = checkpoint(1);
+	pthread_mutex_lock(&disk->walLock);
+	disk->walStop = 1;
+	pthread_cond_signal(&disk->walWake);
+	pthread_mutex_unlock(&disk->walLock);
+	pthread_join(disk->walThread,NULL);
+	disk->persistRunning = 0;
+	if((res==0)&&!disk->walError)
+		wal_prune(disk->walSeq+1);
+	close(disk->imageFd);
+	disk->imageFd = -1;
+}
+
+static int ramdisk_sync(){
+	// the journal is the only thing to wait for, with or without data
+	return wal_sync();
+}
+
+static int ramdisk_fsync(int fd){
+	return fd_get(fd) ? ramdisk_sync() : -EBADF;
+}
+
+static char *data_region_map(int fd,off_t offset,long size,int shared){
+	// map size bytes 2M aligned : reserve the address space with one huge
+	// page to spare, trim it, then map over it. fd -1 gives anonymous
+	// memory, otherwise fd is mapped from offset, shared or copy-on-write.
+	// nothing is committed or charged until pages are touched
+	char *raw = mmap(NULL,size+HUGEPAGESIZE,PROT_NONE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE,-1,0);
+	if(raw == MAP_FAILED)
+		return NULL;
+	long head = ((HUGEPAGESIZE - ((uintptr_t)raw & (HUGEPAGESIZE-1))) & (HUGEPAGESIZE-1));
+	if(head)
+		munmap(raw,head);
+	if(HUGEPAGESIZE-head)
+		munmap(raw+head+size,HUGEPAGESIZE-head);
+	char *region;
+	if(fd!=-1)
+		region = mmap(raw+head,size,PROT_READ|PROT_WRITE,(shared ? MAP_SHARED : MAP_PRIVATE|MAP_NORESERVE)|MAP_FIXED,fd,offset);
+	else
+		region = mmap(raw+head,size,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE|MAP_FIXED,-1,0);
+	if(region == MAP_FAILED){
+		munmap(raw+head,size);
+		return NULL;
+	}
+	return region;
+}
+
+static int data_image_map(){
+	// copy-on-write over the image : blocks fault in from the image's
+	// data section on first touch, writes land in private pages and the
+	// image only changes when a checkpoint copies dirty blocks into it.
+	// blocks given back with MADV_DONTNEED read as their image copy again,
+	// which is fine for free blocks. there is no memfd to splice from,
+	// so reads are copied
+	if(disk->image.dataOffset % sysconf(_SC_PAGESIZE))
+		return -1;
+	disk->memoffset = data_region_map(disk->imageFd,disk->image.dataOffset,disk->mappedsize,0);
+	if(disk->memoffset==NULL)
+		return -1;
+	disk->dataFd = -1;
+	disk->dataBacking = BACKING_IMAGE;
+	log_write(LOG_INFO,"data region : %ld bytes mapped copy-on-write from the image",disk->mappedsize);
+	return 0;
+}
+
+static int data_region_alloc(){
+	// back the data region with huge pages to keep TLB misses down on
+	// large disks: explicit hugetlb pages if reserved, otherwise a 2M
+	// aligned mapping advised for transparent huge pages, otherwise
+	// plain pages. the region lives in a memfd when the kernel has them
+	// so rd_splice can hand blocks out by descriptor, else in anonymous
+	// memory. both come zeroed so no memset is needed. the whole maxBlocks
+	// reservation is mapped, hugetlb pages only when the pool covers it.
+	// a disk loaded from an image maps the image's data section instead
+	disk->mappedsize = (disk->maxBlocks*disk->blocksize+HUGEPAGESIZE-1) & ~((long)HUGEPAGESIZE-1);
+	if((disk->imageFd!=-1)&&!data_image_map())
+		return 0;
+#ifdef MFD_HUGETLB
+	disk->dataFd = memfd_create("ramdisk",MFD_CLOEXEC|MFD_HUGETLB);
+	if(disk->dataFd!=-1){
+		// hugetlb pages are reserved at mmap time, so this fails cleanly
+		// when the pool is too small
+		if(!ftruncate(disk->dataFd,disk->mappedsize)){
+			disk->memoffset = mmap(NULL,disk->mappedsize,PROT_READ|PROT_WRITE,MAP_SHARED,disk->dataFd,0);
+			if(disk->memoffset != MAP_FAILED){
+				disk->dataBacking = BACKING_HUGETLB;
+				log_write(LOG_INFO,"data region : %ld bytes on hugetlb pages, memfd backed",disk->mappedsize);
+				return 0;
+			}
+		}
+		close(disk->dataFd);
+	}
+#endif
+#ifdef MAP_HUGETLB
+	disk->memoffset = mmap(NULL,disk->mappedsize,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB,-1,0);
+	if(disk->memoffset != MAP_FAILED){
+		disk->dataFd = -1;
+		disk->dataBacking = BACKING_HUGETLB;
+		log_write(LOG_INFO,"data region : %ld bytes on hugetlb pages",disk->mappedsize);
+		return 0;
+	}
+#endif
+	disk->memoffset = NULL;
+	disk->dataFd = memfd_create("ramdisk",MFD_CLOEXEC);
+	if(disk->dataFd!=-1){
+		if(!ftruncate(disk->dataFd,disk->mappedsize))
+			disk->memoffset = data_region_map(disk->dataFd,0,disk->mappedsize,1);
+		if(disk->memoffset==NULL){
+			close(disk->dataFd);
+			disk->dataFd = -1;
+		}
+	}
+	if(disk->memoffset==NULL)
+		disk->memoffset = data_region_map(-1,0,disk->mappedsize,0);
+	if(disk->memoffset==NULL)
+		return -ENOMEM;
+	disk->dataBacking = BACKING_PAGES;
+#ifdef MADV_HUGEPAGE
+	// shmem only honours this when shmem_enabled allows advise
+	if(!madvise(disk->memoffset,disk->mappedsize,MADV_HUGEPAGE))
+		disk->dataBacking = BACKING_THP;
+#endif
+	log_write(LOG_INFO,"data region : %ld bytes, backing %s%s",disk->mappedsize,disk->dataBacking==BACKING_THP ? "transparent huge pages" : "normal pages",disk->dataFd!=-1 ? ", memfd backed" : "");
+	return 0;
+}
+
+
+static int capacity_init(long reserve);
+
+static int bitmap_from_extents(){
+	// mark the blocks the loaded extents map, -EIO if one is out of range.
+	// a block mapped more than once was shared by dedup. a disk saved
+	// with compress on can hold blocks past its ceiling, without it the
+	// ceiling is raised to take them
+	long b,i,ceiling = disk->blockcount;
+	for(i=0;i<disk->inodeSlots;i++){
+		struct inode *n = INODE(i);
+		int e;
+		if(n->type!='r')
+			continue;
+		for(e=0;e<n->ext.count;e++){
+			struct extent *x = &n->ext.ext[e];
+			if((x->pblock<0)||(x->count<=0)||(x->pblock+x->count>disk->maxBlocks))
+				return -EIO;
+			if(x->pblock+x->count>disk->fenceBlocks){
+				bitmap_fill(disk->fenceBlocks,x->pblock+x->count-disk->fenceBlocks,0);
+				disk->fenceBlocks = disk->blockcount = x->pblock+x->count;
+				disk->memorysize = disk->blockcount*disk->blocksize;
+			}
+			for(b=x->pblock;b<x->pblock+x->count;b++){
+				if(!((disk->bitMap[b>>6] >> (b&63)) & 1))
+					continue;
+				if(share_init()||(disk->shareCount[b]==UINT32_MAX))
+					return -EIO;
+				disk->shareCount[b]++;	// saved shared by dedup
+				disk->sharedRefs++;
+			}
+			bitmap_fill(x->pblock,x->count,1);
+		}
+	}
+	if(disk->blockcount!=ceiling)
+		log_write(LOG_ERROR,"ceiling raised from %ld to %ld blocks to hold the blocks in use",ceiling,disk->blockcount);
+	return 0;
+}
+
+static int image_load_blocks(int fd){
+	// the blocks in use are read in unless the image is mapped, whatever
+	// else the data section holds is stale
+	long b = 0;
+	if(bitmap_from_extents())
+		return -EIO;
+	if(disk->dataBacking==BACKING_IMAGE)
+		return 0;
+	while(b<disk->fenceBlocks){
+		if(!((disk->bitMap[b>>6] >> (b&63)) & 1)){
+			b++;
+			continue;
+		}
+		long e = b+1;
+		while((e<disk->fenceBlocks)&&(e-b<CKPTRUN)&&((disk->bitMap[e>>6] >> (e&63)) & 1))
+			e++;
+		if(read_all(fd,disk->memoffset+b*disk->blocksize,(e-b)*disk->blocksize,disk->image.dataOffset+(off_t)b*disk->blocksize))
+			return -EIO;
+		b = e;
+	}
+	return 0;
+}
+
+// snapshots : the compact alternative to an image (-o snapshot), written
+// whole at unmount and read whole at mount, without a journal. the disk
+// is cut into ranges of SNAPCHUNK bytes (or one block), the blocks in use
+// in a range are packed together and deflated and ranges without any are
+// left out. worker threads deflate ranges in parallel on save and inflate
+// and check them in parallel on load. a snapshot is written beside the
+// old one and renamed over it, so a failed save keeps the previous one
+#define SNAPMAGIC "RDSNAP"
+#define SNAPVERSION 2
+#define SNAPMETAVERSION 2
+#define SNAPCHUNK (1024*1024)
+#define SNAPBLOCKS ((disk->blocksize<SNAPCHUNK) ? SNAPCHUNK/disk->blocksize : 1)	// blocks per range
+#define SNAPLEVEL Z_BEST_SPEED
+struct snapHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t headerSize;
+	int64_t blocksize;
+	int64_t blockcount;	// ceiling
+	int64_t maxBlocks;
+	int64_t chunkBlocks;	// disk blocks per range
+	int64_t chunks;		// ranges stored
+	uint64_t metaOffset;	// deflated ns_save records
+	uint64_t metaLength;	// stored bytes
+	uint64_t metaRaw;	// bytes once inflated
+	uint64_t tableOffset;	// one snapChunk per range stored
+	uint32_t metaCheck;	// crc32 of the inflated metadata
+	uint32_t tableCheck;	// crc32 of the table
+	uint32_t pad;
+	uint32_t check;		// crc32 of the header with check zeroed
+};
+struct snapChunk {
+	int64_t first;		// first disk block of the range
+	uint64_t offset;
+	uint32_t length;	// stored bytes, equal to raw when not deflated
+	uint32_t raw;		// bytes of the blocks in use
+	uint32_t check;		// crc32 of those bytes
+	uint32_t pad;
+};
+struct snapJob {
+	int fd;
+	struct snapChunk *table;
+	long count;
+	long next;		// next range to take
+	uint64_t end;		// where the next stored range goes, on save
+	int err;
+	pthread_mutex_t lock;
+	struct ramdisk *disk;	// the workers' disk
+};
+
+static size_t snap_pack(long first,char *buf,int save){
+	// move the blocks in use of the range at first between the disk and
+	// buf, packed in block order, returns the bytes moved
+	long b = first,end = first+SNAPBLOCKS;
+	size_t len = 0;
+	if(end>disk->fenceBlocks)
+		end = disk->fenceBlocks;
+	while(b<end){
+		if(!((disk->bitMap[b>>6] >> (b&63)) & 1)){
+			b++;
+			continue;
+		}
+		long e = b+1;
+		while((e<end)&&((disk->bitMap[e>>6] >> (e&63)) & 1))
+			e++;
+		if(buf!=NULL){
+			if(save)
+				tier_copy(b,e-b,buf+len);
+			else
+				block_store(disk->memoffset+b*disk->blocksize,buf+len,(e-b)*disk->blocksize,COPYSTREAM);
+		}
+		len += (e-b)*disk->blocksize;
+		b = e;
+	}
+	return len;
+}
+
+static void *snap_save_worker(void *arg){
+	struct snapJob *job = (struct snapJob *)arg;
+	disk = job->disk;
+	size_t rawSize = SNAPBLOCKS*disk->blocksize;
+	uLong bound = compressBound(rawSize);
+	char *raw = (char *) malloc(rawSize);
+	char *out = (char *) malloc(bound);
+	if((raw==NULL)||(out==NULL))
+		job->err = -ENOMEM;
+	for(;;){
+		long i = __atomic_fetch_add(&job->next,1,__ATOMIC_RELAXED);
+		if((i>=job->count)||job->err)
+			break;
+		struct snapChunk *c = &job->table[i];
+		size_t len = snap_pack(c->first,raw,1);
+		uLongf outLen = bound;
+		const char *stored = out;
+		if((compress2((Bytef *)out,&outLen,(Bytef *)raw,len,SNAPLEVEL)!=Z_OK)||(outLen>=len)){
+			stored = raw;
+			outLen = len;
+		}
+		c->raw = len;
+		c->length = outLen;
+		c->check = crc32(0,(Bytef *)raw,len);
+		pthread_mutex_lock(&job->lock);
+		c->offset = job->end;
+		job->end += outLen;
+		pthread_mutex_unlock(&job->lock);
+		if(write_all(job->fd,stored,outLen,c->offset))
+			job->err = -EIO;
+	}
+	free(raw);
+	free(out);
+	return NULL;
+}
+
+static void *snap_load_worker(void *arg){
+	struct snapJob *job = (struct snapJob *)arg;
+	disk = job->disk;
+	size_t rawSize = SNAPBLOCKS*disk->blocksize;
+	char *raw = (char *) malloc(rawSize);
+	char *in = (char *) malloc(compressBound(rawSize));
+	if((raw==NULL)||(in==NULL))
+		job->err = -ENOMEM;
+	for(;;){
+		long i = __atomic_fetch_add(&job->next,1,__ATOMIC_RELAXED);
+		if((i>=job->count)||job->err)
+			break;
+		struct snapChunk *c = &job->table[i];
+		uLongf len = rawSize;
+		int ok = (c->raw==snap_pack(c->first,NULL,0))&&(c->length<=compressBound(rawSize))&&!read_all(job->fd,in,c->length,c->offset);
+		if(ok && (c->length==c->raw))
+			memcpy(raw,in,c->raw);
+		else if(ok)
+			ok = (uncompress((Bytef *)raw,&len,(Bytef *)in,c->length)==Z_OK)&&(len==c->raw);
+		if(!ok || (crc32(0,(Bytef *)raw,c->raw)!=c->check)){
+			log_write(LOG_ERROR,"snapshot : range at block %lld is damaged",(long long)c->first);
+			job->err = -EIO;
+			break;
+		}
+		snap_pack(c->first,raw,0);
+	}
+	free(raw);
+	free(in);
+	return NULL;
+}
+
+static int snap_run(struct snapJob *job,void *(*worker)(void *)){
+	// snapThreads workers, the caller being one of them
+	long i,n = disk->snapThreads ? disk->snapThreads : sysconf(_SC_NPROCESSORS_ONLN);
+	pthread_t *tid;
+	if(n>job->count)
+		n = job->count;
+	if(n<1)
+		n = 1;
+	tid = (pthread_t *) calloc(n,sizeof(pthread_t));
+	if(tid==NULL)
+		return -ENOMEM;
+	job->next = 0;
+	job->err = 0;
+	job->disk = disk;
+	pthread_mutex_init(&job->lock,NULL);
+	for(i=1;i<n;i++){
+		if(pthread_create(&tid[i],NULL,worker,job))
+			break;
+	}
+	n = i;
+	worker(job);
+	for(i=1;i<n;i++)
+		pthread_join(tid[i],NULL);
+	free(tid);
+	pthread_mutex_destroy(&job->lock);
+	return job->err;
+}
+
+static int snapshot_save(){
+	// write the whole disk to <snapshot>.tmp, then rename it into place
+	char tmp[WALPATHMAX];
+	char *meta = NULL,*metaOut = NULL;
+	size_t metaLen = 0;
+	struct snapHeader h;
+	struct snapJob job;
+	long i,c,ranges = (disk->fenceBlocks+SNAPBLOCKS-1)/SNAPBLOCKS;
+	struct timespec t0,t1;
+	int res = -ENOMEM;
+	clock_gettime(CLOCK_MONOTONIC,&t0);
+
+	// files unlinked but still open do not survive, free their blocks
+	for(i=0;i<disk->inodeSlots;i++){
+		if(INODE(i)->unlinked)
+			release_blocks(i);
+	}
+	snprintf(tmp,sizeof(tmp),"%s.tmp",disk->persistPath);
+	memset(&job,0,sizeof(job));
+	job.fd = open(tmp,O_RDWR|O_CREAT|O_TRUNC|O_CLOEXEC,0644);
+	if(job.fd==-1){
+		log_write(LOG_ERROR,"snapshot : cannot create [%s] : %s",tmp,strerror(errno));
+		return -EIO;
+	}
+	FILE *metaFile = open_memstream(&meta,&metaLen);
+	if(metaFile==NULL)
+		goto out;
+	ns_write_lock();
+	ns_save(metaFile);
+	ns_write_unlock();
+	if(fclose(metaFile))
+		goto out;
+	uLongf metaOutLen = compressBound(metaLen);
+	metaOut = (char *) malloc(metaOutLen);
+	job.table = (struct snapChunk *) calloc(ranges ? ranges : 1,sizeof(struct snapChunk));
+	if((metaOut==NULL)||(job.table==NULL)||(compress2((Bytef *)metaOut,&metaOutLen,(Bytef *)meta,metaLen,SNAPLEVEL)!=Z_OK))
+		goto out;
+	for(c=0;c<ranges;c++){
+		long first = c*SNAPBLOCKS;
+		if(snap_pack(first,NULL,1))
+			job.table[job.count++].first = first;
+	}
+
+	memset(&h,0,sizeof(h));
+	memcpy(h.magic,SNAPMAGIC,sizeof(SNAPMAGIC));
+	h.version = SNAPVERSION;
+	h.headerSize = sizeof(h);
+	h.blocksize = disk->blocksize;
+	h.blockcount = disk->blockcount;
+	h.maxBlocks = disk->maxBlocks;
+	h.chunkBlocks = SNAPBLOCKS;
+	h.chunks = job.count;
+	h.metaOffset = IMAGEHEADER;
+	h.metaLength = metaOutLen;
+	h.metaRaw = metaLen;
+	h.metaCheck = crc32(0,(Bytef *)meta,metaLen);
+	job.end = h.metaOffset + metaOutLen;
+	res = -EIO;
+	if(write_all(job.fd,metaOut,metaOutLen,h.metaOffset)||snap_run(&job,snap_save_worker))
+		goto out;
+	h.tableOffset = job.end;
+	h.tableCheck = crc32(0,(Bytef *)job.table,job.count*sizeof(struct snapChunk));
+	h.check = crc32(0,(Bytef *)&h,sizeof(h));
+	if(write_all(job.fd,(char *)job.table,job.count*sizeof(struct snapChunk),h.tableOffset)||write_all(job.fd,(char *)&h,sizeof(h),0))
+		goto out;
+	if(fsync(job.fd)||rename(tmp,disk->persistPath))
+		goto out;
+	res = 0;
+	clock_gettime(CLOCK_MONOTONIC,&t1);
+	log_write(LOG_INFO,"snapshot : %ld ranges, %llu bytes written in %ld ms",job.count,(unsigned long long)(job.end+job.count*sizeof(struct snapChunk)),
+		(t1.tv_sec-t0.tv_sec)*1000+(t1.tv_nsec-t0.tv_nsec)/1000000);
+out:
+	if(res){
+		log_write(LOG_ERROR,"snapshot : saving [%s] failed",disk->persistPath);
+		unlink(tmp);
+	}
+	close(job.fd);
+	free(job.table);
+	free(meta);
+	free(metaOut);
+	return res;
+}
+
+static int snapshot_load(int fd){
+	// metadata first, it says which blocks each range holds
+	struct snapHeader h;
+	struct snapJob job;
+	char *meta = NULL,*metaIn = NULL;
+	FILE *metaFile = NULL;
+	int res = -EIO;
+	uint32_t check;
+	memset(&job,0,sizeof(job));
+	if(pread(fd,&h,sizeof(h),0)!=sizeof(h))
+		return -EIO;
+	check = h.check;
+	h.check = 0;
+	if(memcmp(h.magic,SNAPMAGIC,sizeof(SNAPMAGIC))||(h.version<1)||(h.version>SNAPVERSION)||(crc32(0,(Bytef *)&h,sizeof(h))!=check))
+		return -EIO;
+	disk->blocksize = h.blocksize;
+	disk->memorysize = h.blockcount*disk->blocksize;
+	if((disk->blocksize<MINBLOCKSIZE)||(disk->blocksize>MAXBLOCKSIZE)||(disk->blocksize&(disk->blocksize-1))||(h.chunkBlocks!=SNAPBLOCKS))
+		return -EIO;
+	if(capacity_init(h.maxBlocks))
+		return -ENOMEM;
+	uLongf metaLen = h.metaRaw;
+	meta = (char *) malloc(h.metaRaw ? h.metaRaw : 1);
+	metaIn = (char *) malloc(h.metaLength ? h.metaLength : 1);
+	job.table = (struct snapChunk *) malloc(h.chunks ? h.chunks*sizeof(struct snapChunk) : 1);
+	if((meta==NULL)||(metaIn==NULL)||(job.table==NULL))
+		goto out;
+	if(read_all(fd,metaIn,h.metaLength,h.metaOffset)||(uncompress((Bytef *)meta,&metaLen,(Bytef *)metaIn,h.metaLength)!=Z_OK)||
+		(metaLen!=h.metaRaw)||(crc32(0,(Bytef *)meta,metaLen)!=h.metaCheck))
+		goto out;
+	metaFile = fmemopen(meta,metaLen,"rb");
+	if((metaFile==NULL)||ns_load(metaFile,h.version>=SNAPMETAVERSION)||bitmap_from_extents())
+		goto out;
+	job.fd = fd;
+	job.count = h.chunks;
+	if(read_all(fd,(char *)job.table,job.count*sizeof(struct snapChunk),h.tableOffset)||
+		(crc32(0,(Bytef *)job.table,job.count*sizeof(struct snapChunk))!=h.tableCheck))
+		goto out;
+	res = snap_run(&job,snap_load_worker);
+	if(res==0)
+		bitmap_recount();
+out:
+	if(metaFile!=NULL)
+		fclose(metaFile);
+	free(meta);
+	free(metaIn);
+	free(job.table);
+	return res;
+}
+
+static int loads_data(const char *path){
+	//check file exists
+	log_write(LOG_INFO," in loads_data File path in params is [%s]",path);
+	char currentPath[PATH_MAX],resolved[PATH_MAX];
+	if(path[0] != '/'){
+		//relative path given, made absolute as the daemon leaves its directory
+		if(getcwd(currentPath,sizeof(currentPath))==NULL){
+			log_write(LOG_ERROR,"loads_data : no working directory for [%s] : %s",path,strerror(errno));
+			return -1;
+		}
+		size_t len = strlen(currentPath);
+		if(snprintf(currentPath+len,sizeof(currentPath)-len,"/%s",path)>=(int)(sizeof(currentPath)-len))
+			return -ENAMETOOLONG;
+		// the image may not be there yet, the joined path does then
+		if(realpath(currentPath,resolved)!=NULL)
+			memcpy(currentPath,resolved,sizeof(currentPath));
+	}else if(snprintf(currentPath,sizeof(currentPath),"%s",path)>=(int)sizeof(currentPath)){
+		return -ENAMETOOLONG;
+	}
+
+	memcpy(disk->persistPath,currentPath,sizeof(disk->persistPath));
+	if( access( path, F_OK ) == -1 ) {
+	    // file doesn't exist
+	    return 1;
+	}
+
+	int fd = open(disk->persistPath,O_RDWR|O_CLOEXEC);
+	if(fd==-1){
+		log_write(LOG_ERROR,"loads_data : cannot open [%s] : %s",disk->persistPath,strerror(errno));
+		return -1;
+	}
+	char magic[8];
+	if((pread(fd,magic,sizeof(magic),0)==sizeof(magic))&&!memcmp(magic,SNAPMAGIC,sizeof(SNAPMAGIC))){
+		disk->useSnapshot = 1;
+		int res = snapshot_load(fd);
+		close(fd);
+		if(res){
+			log_write(LOG_ERROR,"loads_data : snapshot [%s] does not load",disk->persistPath);
+			return -1;
+		}
+		return 0;
+	}
+	if(image_header_read(fd,&disk->image)||(disk->image.version<2)||(disk->image.version>IMAGEVERSION)){
+		log_write(LOG_ERROR,"loads_data : [%s] is not a version 2 to %d image",disk->persistPath,IMAGEVERSION);
+		close(fd);
+		return -1;
+	}
+	disk->blocksize = disk->image.blocksize;
+	disk->memorysize = disk->image.blockcount*disk->blocksize;
+	disk->imageFd = fd;	// capacity_init maps the data section from it
+	log_write(LOG_INFO,"image : %ld blocks of %ld bytes, %ld reserved, checkpoint %llu at seq %llu",
+		(long)disk->image.blockcount,(long)disk->image.blocksize,(long)disk->image.maxBlocks,(unsigned long long)disk->image.generation,(unsigned long long)disk->image.seq);
+	if((disk->blocksize<MINBLOCKSIZE)||(disk->blocksize>MAXBLOCKSIZE)||(disk->blocksize&(disk->blocksize-1))||capacity_init(disk->image.maxBlocks)||persist_init()){
+		close(fd);
+		disk->imageFd = -1;
+		return -1;
+	}
+
+	// metadata first, it says which blocks to read
+	char *meta = (char *) malloc(disk->image.metaLength ? disk->image.metaLength : 1);
+	FILE *metaFile = NULL;
+	int res = -EIO;
+	if((meta!=NULL)&&!read_all(fd,meta,disk->image.metaLength,disk->image.metaOffset)&&(checksum(meta,disk->image.metaLength,CHECKSEED)==disk->image.metaCheck))
+		metaFile = fmemopen(meta,disk->image.metaLength,"rb");
+	if(metaFile!=NULL){
+		res = ns_load(metaFile,disk->image.version>=IMAGEMETAVERSION);
+		fclose(metaFile);
+	}
+	free(meta);
+	if(res||image_load_blocks(fd)){
+		log_write(LOG_ERROR,"loads_data : bad metadata in [%s]",path);
+		close(fd);
+		disk->imageFd = -1;
+		return -1;
+	}
+	// after the data so empty chunks it touched can be released
+	bitmap_recount();
+
+	disk->walSeq = disk->image.seq;
+	if(wal_replay()){
+		log_write(LOG_ERROR,"loads_data : the journal of [%s] does not apply",path);
+		return -1;
+	}
+	inode_rebuild_free();
+	disk->walDurable = disk->walSeq;
+	disk->walFileSeq = disk->walSeq;
+	disk->walActive = 1;
+	return 0;
+}
+
+
+// options by name, the daemon passes its -o options through here
+#define CONFIG_LONG 0
+#define CONFIG_FLAG 1
+#define CONFIG_NAME 2
+struct configOption {
+	const char *name;
+	size_t offset;
+	int kind;
+	const char *const *values;	// CONFIG_NAME : the names of 0, 1 and on, NULL ended
+};
+static const char *const logLevels[] = { "off", "error", "info", "trace", NULL };
+static const char *const copyNames[] = { "auto", "libc", "sse2", "avx2", NULL };
+#define CONFIG_OPT(name, kind) { #name, offsetof(struct ramdisk_config, name), kind, NULL }
+#define CONFIG_NAMED(name, values) { #name, offsetof(struct ramdisk_config, name), CONFIG_NAME, values }
+static const struct configOption configOptions[] = {
+	CONFIG_OPT(blocksize, CONFIG_LONG),
+	CONFIG_NAMED(loglevel, logLevels),
+	CONFIG_OPT(maxsize, CONFIG_LONG),
+	CONFIG_OPT(keepfree, CONFIG_LONG),
+	CONFIG_OPT(flush, CONFIG_LONG),
+	CONFIG_OPT(checkpoint, CONFIG_LONG),
+	CONFIG_OPT(journalmax, CONFIG_LONG),
+	CONFIG_OPT(snapshot, CONFIG_FLAG),
+	CONFIG_OPT(snapthreads, CONFIG_LONG),
+	CONFIG_OPT(compress, CONFIG_LONG),
+	CONFIG_OPT(compressratio, CONFIG_LONG),
+	CONFIG_OPT(compresshigh, CONFIG_LONG),
+	CONFIG_OPT(dedup, CONFIG_FLAG),
+	CONFIG_NAMED(copy, copyNames),
+};
+#define CONFIGCOUNT (int)(sizeof(configOptions)/sizeof(configOptions[0]))
+
+static int parse_name(const char *const *values,const char *name){
+	int i;
+	for(i=0;values[i];i++){
+		if(!strcmp(name,values[i]))
+			return i;
+	}
+	return -1;
+}
+
+void rd_config_init(struct ramdisk_config *config){
+	memset(config,0,sizeof(struct ramdisk_config));
+	config->blocksize = DEFAULTBLOCKSIZE;
+	config->loglevel = -1;
+	config->keepfree = DEFAULTKEEPFREE;
+	config->flush = DEFAULTFLUSHMS;
+	config->checkpoint = DEFAULTCHECKPOINT;
+	config->journalmax = DEFAULTJOURNALMAX;
+	config->compressratio = DEFAULTCOMPRESSRATIO;
+	config->compresshigh = DEFAULTCOMPRESSHIGH;
+}
+
+int rd_config_set(struct ramdisk_config *config, const char *option){
+	// flags are taken bare, the others only with a value
+	const char *value = strchr(option,'=');
+	size_t len = value ? (size_t)(value-option) : strlen(option);
+	char *end;
+	int i;
+	for(i=0;i<CONFIGCOUNT;i++){
+		const struct configOption *o = &configOptions[i];
+		char *field = (char *)config + o->offset;
+		if((strlen(o->name)!=len)||strncmp(o->name,option,len))
+			continue;
+		if((o->kind==CONFIG_FLAG) == (value!=NULL))
+			return 1;
+		if(o->kind==CONFIG_FLAG){
+			*(int *)field = 1;
+		}else if(o->kind==CONFIG_NAME){
+			int n = parse_name(o->values,value+1);
+			if(n==-1)
+				return -EINVAL;
+			*(int *)field = n;
+		}else{
+			long n = strtol(value+1,&end,10);
+			if((end==value+1)||(*end!='\0'))
+				return -EINVAL;
+			*(long *)field = n;
+		}
+		return 0;
+	}
+	return 1;
+}
+
+static int capacity_init(long reserve){
+	// size the ceiling from memorysize and the reservation from reserve
+	// blocks, then map the data region and set up the bitmap
+	disk->blockcount = disk->memorysize/disk->blocksize;
+	disk->maxBlocks = reserve;
+	if(disk->maxBlocks<disk->blockcount)
+		disk->maxBlocks = disk->blockcount;
+	disk->keepChunks = disk->config.keepfree*1024*1024/CHUNKSIZE;
+	if(disk->blockcount<=0)
+		return -1;
+	if(data_region_alloc())
+		return -1;
+	if(disk->coldAge&&(disk->dataBacking==BACKING_HUGETLB)){
+		// a block cannot be given back out of a huge page
+		log_write(LOG_ERROR,"compress is off : the disk is on hugetlb pages");
+		disk->coldAge = 0;
+	}
+	disk->fenceBlocks = disk->coldAge ? disk->maxBlocks : disk->blockcount;
+	if(bitmap_init()||(disk->useDedup && dedup_init()))
+		return -1;
+	return disk->coldAge ? tier_init() : 0;
+}
+
+static int disk_init(){
+	if(disk->memorysize <= 0)
+		return -1;
+
+	long reserve = disk->config.maxsize*1024*1024/disk->blocksize;
+	if(disk->coldAge&&(disk->config.maxsize==0))
+		reserve = disk->memorysize/disk->blocksize*COMPRESSRESERVE;
+	if(capacity_init(reserve))
+		return -1;
+	
+	if(ns_init())
+		return -1;
+	return 0;
+}
+
+// the process : lock attributes and thread keys are set up once for all
+// disks, the log is open while any disk is
+static pthread_once_t libOnce = PTHREAD_ONCE_INIT;
+pthread_mutex_t libLock = PTHREAD_MUTEX_INITIALIZER;
+int logUsers = 0;
+
+static void lib_init(){
+	// writer preference so a stream of lookups cannot starve mkdir/unlink,
+	// inode locks get the same attributes as their chunks are allocated
+	pthread_rwlockattr_init(&lockAttr);
+	pthread_rwlockattr_setkind_np(&lockAttr,PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+	pthread_key_create(&ringKey,log_ring_release);
+	pthread_key_create(&statsKey,stats_release);
+}
+
+static int config_check(const struct ramdisk_config *config){
+	// -EINVAL and a logged message on a bad option
+	if((config->loglevel<-1)||(config->loglevel>LOG_TRACE)){
+		log_write(LOG_ERROR,"config_check : loglevel must be one of off, error, info, trace");
+		return -EINVAL;
+	}
+	if((config->blocksize<MINBLOCKSIZE)||(config->blocksize>MAXBLOCKSIZE)||(config->blocksize&(config->blocksize-1))){
+		log_write(LOG_ERROR,"config_check : blocksize must be a power of two between %d and %d",MINBLOCKSIZE,MAXBLOCKSIZE);
+		return -EINVAL;
+	}
+	if((config->flush<0)||(config->checkpoint<0)||(config->journalmax<=0)||(config->snapthreads<0)){
+		log_write(LOG_ERROR,"config_check : flush, checkpoint and snapthreads must not be negative, journalmax must be positive");
+		return -EINVAL;
+	}
+	if((config->compress<0)||(config->compressratio<=0)||(config->compressratio>=100)||(config->compresshigh<=0)||(config->compresshigh>100)){
+		log_write(LOG_ERROR,"config_check : compress must not be negative, compressratio must be between 1 and 99 and compresshigh between 1 and 100");
+		return -EINVAL;
+	}
+	if((config->copy<COPY_AUTO)||(config->copy>COPY_AVX2)||(copy_engine(config->copy)==NULL)){
+		log_write(LOG_ERROR,"config_check : copy must be one of auto, libc, sse2, avx2 and one this CPU has");
+		return -EINVAL;
+	}
+	return 0;
+}
+
+static void disk_free(){
+	// everything rd_new may have set up, once the disk's threads are gone
+	long i,j;
+	stats_free();
+	if(disk->memoffset!=NULL)
+		munmap(disk->memoffset,disk->mappedsize);
+	if(disk->dataFd!=-1)
+		close(disk->dataFd);
+	if(disk->imageFd!=-1)
+		close(disk->imageFd);
+	for(i=0;(i<MAXINODECHUNKS)&&disk->inodeChunks[i];i++){
+		for(j=0;j<INODECHUNK;j++){
+			struct inode *n = &disk->inodeChunks[i][j];
+			free(n->ext.ext);
+			free(n->children.child);
+			pthread_rwlock_destroy(&n->lock);
+		}
+		free(disk->inodeChunks[i]);
+	}
+	for(i=0;(i<MAXARENACHUNKS)&&disk->arenaChunks[i];i++)
+		free(disk->arenaChunks[i]);
+	for(i=0;(i<MAXFDCHUNKS)&&disk->fdChunks[i];i++)
+		free(disk->fdChunks[i]);
+	if(disk->coldPool){
+		for(i=0;i<(disk->maxBlocks+TIERCHUNK-1)/TIERCHUNK;i++){
+			if(disk->coldPool[i]==NULL)
+				continue;
+			for(j=0;j<TIERCHUNK;j++)
+				free(disk->coldPool[i][j]);
+			free(disk->coldPool[i]);
+		}
+		free(disk->coldPool);
+	}
+	if(disk->tierInflateReady)
+		inflateEnd(&disk->tierInflate);
+	free(disk->dirIndex);
+	free(disk->bitMap);
+	free(disk->chunkUsed);
+	free(disk->chunkResident);
+	free(disk->dirtyMap);
+	free(disk->ckptDirty);
+	free(disk->ckptBitmap);
+	free(disk->ckptDeferred.ext);
+	free(disk->walQueue);
+	free(disk->walSpare);
+	free(disk->hotMap);
+	free(disk->coldMap);
+	free(disk->rejectMap);
+	free(disk->shareCount);
+	free(disk->blockHash);
+	free(disk->dedupIndex);
+	for(i=0;i<NSLOCKSHARDS;i++)
+		pthread_rwlock_destroy(&disk->nsLock[i].lock);
+	pthread_mutex_destroy(&disk->allocLock);
+	pthread_mutex_destroy(&disk->fdLock);
+	pthread_mutex_destroy(&disk->walLock);
+	pthread_cond_destroy(&disk->walWake);
+	pthread_cond_destroy(&disk->walDone);
+	pthread_mutex_destroy(&disk->ckptWaitLock);
+	pthread_cond_destroy(&disk->ckptWake);
+	pthread_mutex_destroy(&disk->tierLock);
+	pthread_mutex_destroy(&disk->tierGate);
+	pthread_cond_destroy(&disk->tierWake);
+	pthread_cond_destroy(&disk->tierDone);
+	free(disk);
+	pthread_mutex_lock(&libLock);
+	if(--logUsers==0)
+		log_close();
+	pthread_mutex_unlock(&libLock);
+}
+
+int rd_new(struct ramdisk **rd, long size, const char *image, const struct ramdisk_config *config){
+	// check the options and set what they drive, then build an empty
+	// disk or load it from image. -EINVAL on a bad option, -ENAMETOOLONG
+	// when image's full path does not fit in PATH_MAX, -EIO when the disk
+	// cannot be set up
+	struct ramdisk *prev = disk;
+	int i,res;
+	*rd = NULL;
+	pthread_once(&libOnce,lib_init);
+	if(config_check(config)){
+		// with no disk up yet nothing would write the message out
+		pthread_mutex_lock(&libLock);
+		if(logUsers==0){
+			log_init();
+			log_close();
+		}
+		pthread_mutex_unlock(&libLock);
+		return -EINVAL;
+	}
+	// aligned as its lock shards are, which calloc does not promise
+	if(posix_memalign((void **)&disk,__alignof__(struct ramdisk),sizeof(struct ramdisk))){
+		disk = prev;
+		return -ENOMEM;
+	}
+	memset(disk,0,sizeof(struct ramdisk));
+	pthread_mutex_lock(&libLock);
+	if(config->loglevel!=-1)
+		logLevel = config->loglevel;
+	if(logUsers++==0)
+		log_init();
+	pthread_mutex_unlock(&libLock);
+
+	disk->config = *config;
+	disk->copy = copy_engine(config->copy);
+	disk->uid = getuid();
+	disk->gid = getgid();
+	for(i=0;i<NSLOCKSHARDS;i++)
+		pthread_rwlock_init(&disk->nsLock[i].lock,&lockAttr);
+	pthread_mutex_init(&disk->allocLock,NULL);
+	pthread_mutex_init(&disk->fdLock,NULL);
+	pthread_mutex_init(&disk->walLock,NULL);
+	pthread_cond_init(&disk->walWake,NULL);
+	pthread_cond_init(&disk->walDone,NULL);
+	pthread_mutex_init(&disk->ckptWaitLock,NULL);
+	pthread_cond_init(&disk->ckptWake,NULL);
+	pthread_mutex_init(&disk->tierLock,NULL);
+	pthread_mutex_init(&disk->tierGate,NULL);
+	pthread_cond_init(&disk->tierWake,NULL);
+	pthread_cond_init(&disk->tierDone,NULL);
+	disk->dataFd = -1;
+	disk->imageFd = -1;
+	disk->inodeFree = -1;
+	disk->fdFree = -1;
+	disk->blocksize = config->blocksize;
+	disk->memorysize = size;
+	disk->coldAge = config->compress;
+	disk->coldRatio = config->compressratio;
+	disk->coldHigh = config->compresshigh;
+	disk->useSnapshot = config->snapshot;
+	disk->useDedup = config->dedup;
+	disk->snapThreads = config->snapthreads;
+	disk->walFlushMs = config->flush;
+	disk->ckptInterval = config->checkpoint;
+	disk->walLimit = (uint64_t)config->journalmax*1024*1024;
+
+	if(image==NULL){
+		res = disk_init();
+	}else{
+		disk->usePersist = 1;
+		res = loads_data(image);
+		if(res==1)
+			res = (disk_init()||(!disk->useSnapshot && image_create())) ? -1 : 0;
+	}
+	if(res){
+		disk_free();
+		disk = prev;
+		return (res==-ENAMETOOLONG) ? res : -EIO;
+	}
+	disk->tierBudget = 1;
+	log_write(LOG_INFO,"rd_new : %ld bytes in blocks of %ld%s%s",disk->memorysize,disk->blocksize,image ? ", image " : "",image ? disk->persistPath : "");
+	*rd = disk;
+	disk = prev;
+	return 0;
+}
+
+int rd_start(struct ramdisk *rd){
+	struct ramdisk *prev = disk;
+	disk = rd;
+	log_start();
+	persist_start();
+	tier_start();
+	log_write(LOG_INFO,"rd_start : disk is up");
+	disk = prev;
+	return 0;
+}
+
+void rd_notify(struct ramdisk *rd, const struct rd_notifier *notifier, void *arg){
+	rd->notifyArg = arg;
+	__atomic_store_n(&rd->notifier,notifier,__ATOMIC_RELEASE);
+}
+
+void rd_creds(uid_t uid, gid_t gid){
+	credUid = uid;
+	credGid = gid;
+}
+
+void rd_serve(struct ramdisk *rd){
+	serving = rd;
+}
+
+void rd_free(struct ramdisk *rd){
+	// stop the threads, save the disk and let it go. descriptors still
+	// open are dropped with it
+	struct ramdisk *prev = disk;
+	disk = rd;
+	log_write(LOG_INFO,"rd_free : with usePersist:%d",disk->usePersist);
+	tier_stop();
+	if(disk->usePersist){
+		log_write(LOG_INFO,"saving content in [%s]",disk->persistPath);
+		if(disk->useSnapshot)
+			snapshot_save();
+		else
+			persist_stop();
+	}
+	disk_free();
+	disk = (prev==rd) ? NULL : prev;
+}
+
+// every call makes rd the calling thread's disk for its length and is
+// timed for /.ramdisk/stats
+#define RD_OP(op, type, name, params, args) \
+type rd_##name params { \
+	struct ramdisk *prev = disk; \
+	struct timespec t0; \
+	disk = rd; \
+	clock_gettime(CLOCK_MONOTONIC,&t0); \
+	type res = ramdisk_##name args; \
+	stat_count(op,&t0,res); \
+	disk = prev; \
+	return res; \
+}
+RD_OP(OP_RELEASE, int, close, (struct ramdisk *rd, int fd), (fd))
+RD_OP(OP_READ, ssize_t, read, (struct ramdisk *rd, int fd, void *buf, size_t size), (fd,buf,size))
+RD_OP(OP_WRITE, ssize_t, write, (struct ramdisk *rd, int fd, const void *buf, size_t size), (fd,buf,size))
+RD_OP(OP_READ, ssize_t, pread, (struct ramdisk *rd, int fd, void *buf, size_t size, off_t offset), (fd,buf,size,offset))
+RD_OP(OP_WRITE, ssize_t, pwrite, (struct ramdisk *rd, int fd, const void *buf, size_t size, off_t offset), (fd,buf,size,offset))
+RD_OP(OP_WRITE, ssize_t, pwrite_with, (struct ramdisk *rd, int fd, size_t size, off_t offset, rd_source_t source, void *arg), (fd,size,offset,source,arg))
+RD_OP(OP_GETATTR, int, fstat, (struct ramdisk *rd, int fd, struct stat *st), (fd,st))
+RD_OP(OP_TRUNCATE, int, ftruncate, (struct ramdisk *rd, int fd, off_t length), (fd,length))
+RD_OP(OP_FALLOCATE, int, fallocate, (struct ramdisk *rd, int fd, int mode, off_t offset, off_t length), (fd,mode,offset,length))
+RD_OP(OP_FSYNC, int, fsync, (struct ramdisk *rd, int fd), (fd))
+RD_OP(OP_GETATTR, int, stat, (struct ramdisk *rd, const char *path, struct stat *st), (path,st))
+RD_OP(OP_ACCESS, int, access, (struct ramdisk *rd, const char *path, int mask), (path,mask))
+RD_OP(OP_TRUNCATE, int, truncate, (struct ramdisk *rd, const char *path, off_t length), (path,length))
+RD_OP(OP_MKDIR, int, mkdir, (struct ramdisk *rd, const char *path, mode_t mode), (path,mode))
+RD_OP(OP_RMDIR, int, rmdir, (struct ramdisk *rd, const char *path), (path))
+RD_OP(OP_UNLINK, int, unlink, (struct ramdisk *rd, const char *path), (path))
+RD_OP(OP_RENAME, int, rename, (struct ramdisk *rd, const char *from, const char *to), (from,to))
+RD_OP(OP_READDIR, int, readdir, (struct ramdisk *rd, const char *path, rd_filler_t filler, void *arg), (path,filler,arg))
+RD_OP(OP_CHMOD, int, chmod, (struct ramdisk *rd, const char *path, mode_t mode), (path,mode))
+RD_OP(OP_CHOWN, int, chown, (struct ramdisk *rd, const char *path, uid_t uid, gid_t gid), (path,uid,gid))
+RD_OP(OP_UTIMENS, int, utimens, (struct ramdisk *rd, const char *path, const struct timespec times[2]), (path,times))
+RD_OP(OP_LINK, int, link, (struct ramdisk *rd, const char *from, const char *to), (from,to))
+RD_OP(OP_SYMLINK, int, symlink, (struct ramdisk *rd, const char *target, const char *path), (target,path))
+RD_OP(OP_READLINK, ssize_t, readlink, (struct ramdisk *rd, const char *path, char *buf, size_t size), (path,buf,size))
+RD_OP(OP_STATFS, int, statfs, (struct ramdisk *rd, struct statvfs *st), (st))
+RD_OP(OP_FSYNC, int, sync, (struct ramdisk *rd), ())
+RD_OP(OP_LOOKUP, int, lookup, (struct ramdisk *rd, rd_ino_t dir, const char *name, struct stat *st), (dir,name,st))
+RD_OP(OP_GETATTR, int, stat_ino, (struct ramdisk *rd, rd_ino_t ino, struct stat *st), (ino,st))
+RD_OP(OP_TRUNCATE, int, truncate_ino, (struct ramdisk *rd, rd_ino_t ino, off_t length), (ino,length))
+RD_OP(OP_OPEN, int, open_ino, (struct ramdisk *rd, rd_ino_t ino, int flags), (ino,flags))
+RD_OP(OP_MKDIR, int, mkdirat, (struct ramdisk *rd, rd_ino_t dir, const char *name, mode_t mode, struct stat *st), (dir,name,mode,st))
+RD_OP(OP_RENAME, int, renameat, (struct ramdisk *rd, rd_ino_t olddir, const char *oldname, rd_ino_t newdir, const char *newname, int flags), (olddir,oldname,newdir,newname,flags))
+RD_OP(OP_CHMOD, int, chmod_ino, (struct ramdisk *rd, rd_ino_t ino, mode_t mode), (ino,mode))
+RD_OP(OP_CHOWN, int, chown_ino, (struct ramdisk *rd, rd_ino_t ino, uid_t uid, gid_t gid), (ino,uid,gid))
+RD_OP(OP_UTIMENS, int, utimens_ino, (struct ramdisk *rd, rd_ino_t ino, const struct timespec times[2]), (ino,times))
+RD_OP(OP_LINK, int, linkat, (struct ramdisk *rd, rd_ino_t ino, rd_ino_t newdir, const char *newname, struct stat *st), (ino,newdir,newname,st))
+RD_OP(OP_SYMLINK, int, symlinkat, (struct ramdisk *rd, const char *target, rd_ino_t dir, const char *name, struct stat *st), (target,dir,name,st))
+RD_OP(OP_READLINK, ssize_t, readlink_ino, (struct ramdisk *rd, rd_ino_t ino, char *buf, size_t size), (ino,buf,size))
+RD_OP(OP_READDIR, int, readdir_ino, (struct ramdisk *rd, rd_ino_t ino, rd_filler_t filler, void *arg), (ino,filler,arg))
+
+int rd_open(struct ramdisk *rd, const char *path, int flags, mode_t mode){
+	// counted as a create when it may make the file
+	struct ramdisk *prev = disk;
+	struct timespec t0;
+	disk = rd;
+	clock_gettime(CLOCK_MONOTONIC,&t0);
+	int res = ramdisk_open(path,flags,mode);
+	stat_count((flags & O_CREAT) ? OP_CREATE : OP_OPEN,&t0,res);
+	disk = prev;
+	return res;
+}
+
+int rd_openat(struct ramdisk *rd, rd_ino_t dir, const char *name, int flags, mode_t mode, struct stat *st){
+	struct ramdisk *prev = disk;
+	struct timespec t0;
+	disk = rd;
+	clock_gettime(CLOCK_MONOTONIC,&t0);
+	int res = ramdisk_openat(dir,name,flags,mode,st);
+	stat_count((flags & O_CREAT) ? OP_CREATE : OP_OPEN,&t0,res);
+	disk = prev;
+	return res;
+}
+
+int rd_unlinkat(struct ramdisk *rd, rd_ino_t dir, const char *name, int flags){
+	struct ramdisk *prev = disk;
+	struct timespec t0;
+	disk = rd;
+	clock_gettime(CLOCK_MONOTONIC,&t0);
+	int res = ramdisk_unlinkat(dir,name,flags);
+	stat_count((flags & AT_REMOVEDIR) ? OP_RMDIR : OP_UNLINK,&t0,res);
+	disk = prev;
+	return res;
+}
+
+void rd_forget(struct ramdisk *rd, rd_ino_t ino, unsigned long n){
+	struct ramdisk *prev = disk;
+	struct timespec t0;
+	disk = rd;
+	clock_gettime(CLOCK_MONOTONIC,&t0);
+	ramdisk_forget(ino,n);
+	stat_count(OP_FORGET,&t0,0);
+	disk = prev;
+}
+
+ssize_t rd_splice(struct ramdisk *rd, int fd, int pipeFd, size_t size, off_t offset){
+	// counted only when it moved the data, a caller falls back to rd_pread
+	// otherwise and that is counted instead
+	struct ramdisk *prev = disk;
+	struct timespec t0;
+	disk = rd;
+	clock_gettime(CLOCK_MONOTONIC,&t0);
+	ssize_t res = ramdisk_splice(fd,pipeFd,size,offset);
+	if(res>=0)
+		stat_count(OP_READ,&t0,res);
+	disk = prev;
+	return res;
+}
+
+off_t rd_lseek(struct ramdisk *rd, int fd, off_t offset, int whence){
+	struct ramdisk *prev = disk;
+	disk = rd;
+	off_t res = ramdisk_lseek(fd,offset,whence);
+	disk = prev;
+	return res;
+}
@@ -1,486 +1,231 @@
 /*
   RAMDISK :  A filesystem that resides on memory and uses fuse system
-  
+
+  the FUSE daemon : every callback maps onto the library in
+  libramdisk.c, see ramdisk.h, with fi->fh holding the disk's descriptor.
+  by default on the high-level, path based, FUSE API. with -o lowlevel on
+  the low-level one keyed by inode numbers, where a request reaches its
+  inode directly without a path being built or resolved
+
   Author: Durgesh Kumar Gupta (dgupta9@ncsu.edu)
 
   gcc -Wall hello.c `pkg-config fuse --cflags --libs` -o hello
 */
 
 #define FUSE_USE_VERSION 26
+#define _GNU_SOURCE
 
 #include <fuse.h>
+#include <fuse_lowlevel.h>
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
 #include <fcntl.h>
-#include <linux/limits.h>
 #include <stdlib.h>
-#include <string.h>
-#include <fnmatch.h>
 #include <unistd.h>
+#include <stddef.h>
 #include <sys/stat.h>
 #include <sys/types.h>
-#include <time.h>
-#include <stdarg.h>
-
-// set the block size to 1K bytes
-#define BLOCKSIZE 1024
-
-//#define MEMORYSIZE 1048576
-long memorysize = 0;
-long blockcount = 0;
-//#define BLOCKCOUNT 1024
-
-//hold pointer to ram disk block start
-char *memoffset;
-char *bitMap;//[BLOCKCOUNT];
-int  *nextBlockMap;//[BLOCKCOUNT];
-
-// hold all the paths as list
-#define MAXPATHLIST 2000
-char pathlist[MAXPATHLIST][PATH_MAX];
-int  blockMap[MAXPATHLIST];
-char isDir[MAXPATHLIST];
-int fileSize[MAXPATHLIST];
-
-//hold current path
-char cwd[PATH_MAX];
-
+#include <sys/ioctl.h>
+#include <linux/limits.h>
+#include <pthread.h>
+#include "ramdisk.h"
 
-// log handler
-#define LOGFILEPATH "/tmp/ramdisk.log"
-#define LOG_ENABLE 1
-int logfd;
+struct ramdisk *rd;
 
-int usePersist = 0;
-char persistPath[PATH_MAX];
+// per thread pipe read_buf has the disk splice blocks into while it holds
+// the file lock, so a reply owns its pages before a truncate can recycle
+// the blocks
+struct splicePipe {
+	int fd[2];
+	long cap;		// pipe capacity in bytes
+};
+static __thread struct splicePipe *threadPipe;
+pthread_key_t pipeKey;
 
-static void log_init(){
-	if(LOG_ENABLE)
-		logfd = open(LOGFILEPATH,O_WRONLY|O_CREAT);
+static int is_ctl(const char *path){
+	// a control file or their directory, whose text changes on every read
+	int len = strlen(RAMDISK_CTLDIR);
+	return path && !strncmp(path,RAMDISK_CTLDIR,len) && ((path[len]=='\0')||(path[len]=='/'));
 }
 
-static void log_close(){
-	if(LOG_ENABLE)
-		close(logfd);
+static int ramdisk_getattr(const char *path, struct stat *stbuf)
+{
+	return rd_stat(rd,path,stbuf);
 }
 
-static void log_write(char *logmsg, ...){
-	// copied from http://stackoverflow.com/questions/1442116/how-to-get-date-and-time-value-in-c-program
-	if(LOG_ENABLE){
-		time_t t = time(NULL);
-		struct tm tm = *localtime(&t);
-		dprintf(logfd,"%d-%d-%d %d:%d:%d : ", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
-
-		va_list args;
-	    va_start(args,logmsg);
-	    vdprintf(logfd,logmsg,args);
-	    va_end(args);
-	    dprintf(logfd,"\n");
-	}
+static int ramdisk_fgetattr(const char *path, struct stat *stbuf, struct fuse_file_info *fi)
+{
+	return rd_fstat(rd,fi->fh,stbuf);
 }
 
-static int ramdisk_getattr(const char *path, struct stat *stbuf)
-{
-	int res = 0;
-	log_write("ramdisk_getattr called with path : %s",path);
-
-	memset(stbuf, 0, sizeof(struct stat));
-	
-	if (strcmp(path, "/") == 0) {
-		stbuf->st_mode = S_IFDIR | 0755;
-		stbuf->st_nlink = 2;
-		stbuf->st_uid = getuid();
-		stbuf->st_gid = stbuf->st_uid;
-		return res;
-	}
-	
-	int i=0;
-	for(i=0;i<MAXPATHLIST;i++){
-		//log_write("IN ramdisk_getattr pathlist[%d]=%s",i,pathlist[i]);
-		if(!strcmp(path,pathlist[i])){
-			//found path
-			//if folder set folder props
-			stbuf->st_uid = getuid();
-			stbuf->st_gid = stbuf->st_uid;
-			if(isDir[i]=='d'){
-				stbuf->st_mode = S_IFDIR | 0755;
-				stbuf->st_nlink = 2;
-				stbuf->st_size = 4096;
-			}else{
-				//else file props
-				stbuf->st_mode = S_IFREG | 0644;
-				stbuf->st_nlink = 1;
-				stbuf->st_size = fileSize[i];
-			}
-			log_write("FOUND path [%s] at index : %d",pathlist[i],i);
-			return res;
-		}
-	}
-	log_write("Couldn't find path [%s]",path);
-	
-	return -ENOENT;
+struct fillArg {
+	void *buf;
+	fuse_fill_dir_t filler;
+};
+
+static int fill_entry(void *arg, const char *name, const struct stat *st){
+	struct fillArg *f = (struct fillArg *)arg;
+	return f->filler(f->buf,name,st,0);
 }
 
 static int ramdisk_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
 			 off_t offset, struct fuse_file_info *fi){
 	(void) offset;
 	(void) fi;
-	
-	log_write("ramdisk_readdir called with path : %s",path);
-
-	filler(buf, ".", NULL, 0);
-	filler(buf, "..", NULL, 0);
-	
-	/* testing directory
-	char *pp,*aa;
-	pp = strdup(path);
-	aa=pp;
-	while(*pp != '\0'){
-		if(*pp == '/')
-			*pp='#';
-		pp=pp+1;
-	}
-	
-	filler(buf, (const char *) aa, NULL, 0);
-	*/
-	
-	int i=0;
-	// check if directory exists
-	int noexist=1;
-	for(i=0;i<MAXPATHLIST;i++){
-		if((!strcmp(path,pathlist[i]))&&(isDir[i]=='d')){
-			noexist=0;
-			break;
-		}
-	}
-	
-	if((noexist)&&(strcmp(path, "/")))
-		return -ENOENT;
-	
-	char pattern[PATH_MAX];
-	strcpy(pattern,path);
-	if(pattern[strlen(pattern)-1] != '/')
-		strcat(pattern,"/*");
-	else
-		strcat(pattern,"*");
-	for(i=0;i<MAXPATHLIST;i++){
-		if(!fnmatch(pattern,pathlist[i],FNM_PATHNAME)){
-			int start = strlen(pattern)-1;
-			char *filename = pathlist[i];
-			filename = filename+start;
-			filler(buf, (const char*)filename, NULL, 0);
-		}
-	}
+	struct fillArg f = { buf, filler };
+	return rd_readdir(rd,path,fill_entry,&f);
+}
 
-	return 0;
+static void caller_creds(void){
+	// what the request creates belongs to the process that made it
+	struct fuse_context *c = fuse_get_context();
+	rd_creds(c->uid,c->gid);
 }
 
 static int ramdisk_mkdir(const char *path, mode_t mode){
-	/*
-	int fd = open("/tmp/output",O_RDWR|O_CREAT);
-	write(fd,"STARTLOG\n",strlen("STARTLOG\n"));
-	write(fd,path,strlen(path));
-	*/
-	log_write("ramdisk_mkdir called with path : %s",path);
-	int i,lastNull=-1;
-	for(i=0;i<MAXPATHLIST;i++){
-		//write(fd,"\nPATH:",strlen("\nPATH:"));
-		//write(fd,pathlist[i],strlen(pathlist[i]));
-		if(!strcmp(path,pathlist[i])){
-			return -EEXIST;
-		}
-		if(pathlist[i][0]=='\0'){
-			lastNull=i;
-			break;
-		}
-	}
-	
-	//write(fd,"\nLast null\n",strlen("\nLast null\n"));
-	//char num[11];
-	//sprintf(num,"%d",lastNull);
-	//write(fd,num,strlen(num));
-	if(lastNull==-1){
-		return -ENOSPC;
-	}
-	
-	strcpy(pathlist[i],path);
-	isDir[i]='d';
-	//close(fd);
-	return 0;
+	caller_creds();
+	return rd_mkdir(rd,path,mode);
 }
 
-static int getfreeBlock(){
-	// return block id of next free block
-	// or -1 is no free blocks where ENOSPC should be set
-	int i=0;
-	log_write("getfreeBlock called");
-	for(i=0;i<blockcount;i++){
-		//log_write("val BITMAP[%d]=%d",i,bitMap[i]);
-		if(bitMap[i]==0)
-			return i;
-	}
-	return -1;
+static int ramdisk_open(const char *path, struct fuse_file_info *fi){
+	int fd = rd_open(rd,path,fi->flags,0);
+	if(fd<0)
+		return fd;
+	fi->fh = fd;
+	fi->direct_io = is_ctl(path);
+	return 0;
 }
 
-static void setBlock(int blockNum){
-	bitMap[blockNum]=1;
+static int ramdisk_create(const char *path, mode_t mode, struct fuse_file_info *fi){
+	caller_creds();
+	int fd = rd_open(rd,path,fi->flags|O_CREAT,mode);
+	if(fd<0)
+		return fd;
+	fi->fh = fd;
+	fi->direct_io = is_ctl(path);
+	return 0;
 }
 
-static void resetBlock(int blockNum){
-	bitMap[blockNum]=0;
+static int ramdisk_read(const char *path, char *buf, size_t size, off_t offset,
+		      struct fuse_file_info *fi){
+	return rd_pread(rd,fi->fh,buf,size,offset);
 }
 
 static int ramdisk_write(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi){
-	int i=0,fileExists=0,index=-1;
-	log_write("ramdisk_write called with path : [%s] , buf : [], size: [%d] and offset:[%d]",path,size,offset);
-	
-	for(i=0;i<MAXPATHLIST;i++){
-		if(!strcmp(path,pathlist[i])){
-			fileExists=1;
-			index=i;
-			break;
-		}
-	}
-	
-	if(fileExists){
-		//file exists
-		//based on offset, check which is the starting block
-		log_write("ramdisk_write offsetchecksum offset : [%d], filesize : [%d]",offset,fileSize[index]);
-		if(offset>fileSize[index])
-			return -ENXIO;
-
-		
-
-		//offset = 0;
-		int blockOffsetNum = offset/BLOCKSIZE;
-		log_write("ramdisk_write and file exists");
-		
-		int byteWrite=size,nextBlock = blockMap[index];
-
-		//handle offset
-		int partialBlock = 0;
-		if(offset != 0){
-			if(offset%BLOCKSIZE == 0){
-				//offset aligns with block 
-			}else{
-				partialBlock = 1;
-			}
-			int temp = blockOffsetNum;
-			log_write("block offset temo : %d , %d , %d",temp,nextBlock,nextBlockMap[nextBlock]);
-			while(temp>1){
-				nextBlock = nextBlockMap[nextBlock];
-				temp -=1;
-			}
-			if(offset>=BLOCKSIZE){
-				int t = getfreeBlock();
-				if(t==-1)
-					return -ENOSPC;
-				setBlock(t);
-				nextBlockMap[nextBlock] = t;
-				nextBlock = t;
-			}
-		}
+	return rd_pwrite(rd,fi->fh,buf,size,offset);
+}
 
+static ssize_t copy_request(void *arg, void *dst, size_t len){
+	// the next len bytes of the request, from its pipe when spliced
+	struct fuse_bufvec to = FUSE_BUFVEC_INIT(len);
+	to.buf[0].mem = dst;
+	return fuse_buf_copy(&to,(struct fuse_bufvec *)arg,0);
+}
 
-		while(byteWrite>0){
-			if(partialBlock){
-				log_write("in ramdisk_write with partial offset to write [%d] as byteWrite:%d, offset : %d", nextBlock, byteWrite,offset);
-				char *blockoffset = memoffset + (nextBlock*BLOCKSIZE);
-				int partialoffset = offset - ((offset/BLOCKSIZE) * BLOCKSIZE);
-				blockoffset += partialoffset;
-				strncpy(blockoffset,buf,(BLOCKSIZE-partialoffset));
-				partialBlock = 0;
-				byteWrite -=(BLOCKSIZE-partialoffset);
-				fileSize[index]+=(BLOCKSIZE-partialoffset);
-				buf += (BLOCKSIZE-partialoffset);
-			}else if(byteWrite<=BLOCKSIZE){
-				//write on remaining block
-				log_write("in ramdisk_write with only last block [%d] to write as byteWrite:%d",nextBlock, byteWrite);
-				char *offset = memoffset  + (nextBlock*BLOCKSIZE);
-				strncpy(offset,buf,byteWrite);
-				fileSize[index]+=byteWrite;
-				byteWrite = 0;
-			}else {
-				log_write("in ramdisk_write with more block to write as byteWrite:%d",byteWrite);
-				log_write("writing a block : [%d]",nextBlock);
-				char *offset = memoffset  + (nextBlock*BLOCKSIZE);
-				strncpy(offset,buf,BLOCKSIZE);
-				int t = nextBlock;
-				nextBlock = getfreeBlock();
-				if(nextBlock==-1)
-					return -ENOSPC;
-				setBlock(nextBlock);
-				nextBlockMap[t]=nextBlock;
-				byteWrite -= BLOCKSIZE;
-				fileSize[index]+=BLOCKSIZE;
-				buf += BLOCKSIZE;
-			}
-		}
-		//fileSize[index]=(int)size;
-		return (int)size;
-		/*
-		//check the blocks needed for write
-		char *next =  memoffset + blockMap[index];
-		next = next + blockOffsetNum;
-		
-		int blockNum=blockMap[index];
-		fileSize[index]=size;
-		char * buffPtr=(char *)buf;
-		while(size>BLOCKSIZE){
-			strncpy(next,buffPtr,BLOCKSIZE);
-			nextBlockMap[blockNum]=getfreeBlock();
-			blockNum = nextBlockMap[blockNum];
-			setBlock(blockNum);
-			next = memoffset + (BLOCKSIZE*blockNum);
-			buffPtr = buffPtr + BLOCKSIZE;
-			size = size - BLOCKSIZE;
-		}
-		
-		//fit the final left piece of buffer
-		if(size<BLOCKSIZE){
-			strncpy(next,buffPtr,size);
-		}
-		*/
-		
-	}else{
-		// file doesn't exists
-		return -ENOENT;
-	}
-	return 0;
+static int ramdisk_write_buf(const char *path, struct fuse_bufvec *buf, off_t offset, struct fuse_file_info *fi){
+	// the request goes straight into the blocks it lands on
+	return rd_pwrite_with(rd,fi->fh,fuse_buf_size(buf),offset,copy_request,buf);
 }
 
-static int ramdisk_open(const char *path, struct fuse_file_info *fi){
-	log_write("ramdisk_open called with path : %s",path);
-	int i=0,fileExists=0;//,index=-1;
-	for(i=0;i<MAXPATHLIST;i++){
-		if(!strcmp(path,pathlist[i])){
-			fileExists=1;
-			break;
-		}
-	}
-	
-	if(!fileExists)
-		return -ENOENT;
-		
-	
-	
+static int splice_pipe_open(struct splicePipe *sp){
+	if(pipe2(sp->fd,O_CLOEXEC))
+		return -errno;
+	sp->cap = fcntl(sp->fd[1],F_GETPIPE_SZ);
 	return 0;
 }
 
-static int ramdisk_read(const char *path, char *buf, size_t size, off_t offset,
-		      struct fuse_file_info *fi){
-	//size_t len;
-	log_write("ramdisk_read called with path : [%s], size:[%d], offset : [%d]",path,size,offset);
-	(void) fi;
-	int i,fileExists=0,index=-1;
-	for(i=0;i<MAXPATHLIST;i++){
-		if(!strcmp(path,pathlist[i])){
-			fileExists=1;
-			index=i;
-			break;
-		}
-	}
-	
-	if(fileExists){
-		//file exists
-		//based on offset, check which is the starting block
-
-		if(offset>fileSize[index])
-			return -ENXIO;
-
-		//offset = 0;
-		int blockOffsetNum = offset/BLOCKSIZE;
-		log_write("ramdisk_read and file exists");
-		
-		int byteRead=size,nextBlock = blockMap[index];
-
-		//handle offset
-		int partialBlock = 0;
-		if(offset != 0){
-			if(offset%BLOCKSIZE == 0){
-				//offset aligns with block 
-			}else{
-				partialBlock = 1;
-			}
-			int temp =blockOffsetNum;
-			while(temp>0){
-				nextBlock = nextBlockMap[nextBlock];
-				temp -=1;
-			}
-		}
-		while(byteRead>0){
-			if(nextBlock ==-1)
-				break;
-			if(partialBlock){
-				log_write("in ramdisk_read with partial offset to read as byteRead:%d, offset : %d",byteRead,offset);
-				char *blockoffset = memoffset + (nextBlock*BLOCKSIZE);
-				int partialoffset = offset - ((offset/BLOCKSIZE) * BLOCKSIZE);
-				blockoffset += partialoffset;
-				strncpy(buf,blockoffset,(BLOCKSIZE-partialoffset));
-				partialBlock = 0;
-				byteRead -=(BLOCKSIZE-partialoffset);
-				buf += partialoffset;
-			}else if(byteRead<=BLOCKSIZE){
-				//write on remaining block
-				log_write("in ramdisk_read with only last block to read as byteRead:%d",byteRead);
-				char *offset = memoffset  + (nextBlock*BLOCKSIZE);
-				strncpy(buf,offset,byteRead);
-				byteRead = 0;
-			}else {
-				log_write("in ramdisk_read with more block to read as byteRead:%d",byteRead);
-				log_write("reading a block : [%d]",nextBlock);
-				char *offset = memoffset  + (nextBlock*BLOCKSIZE);
-				strncpy(buf,offset,BLOCKSIZE);
-				log_write("value read : [[%s]]",buf);
-				nextBlock = nextBlockMap[nextBlock];
-				byteRead -= BLOCKSIZE;
-				buf += BLOCKSIZE;
-				log_write("left bytes : %d",byteRead);
-			}
-		}
+static void splice_pipe_close(struct splicePipe *sp){
+	close(sp->fd[0]);
+	close(sp->fd[1]);
+}
 
+static void splice_pipe_release(void *sp){
+	splice_pipe_close((struct splicePipe *)sp);
+	free(sp);
+}
 
-/*
-		offset = 0;
-		int blockOffsetNum = offset/BLOCKSIZE;
-		log_write("ramdisk_read called with path : [%s] , buf : [%s]",path,buf);
-		
-		int byteRead=size,nextBlock = blockMap[index];
-		if(byteRead<fileSize[index])
-			byteRead=fileSize[index];
-		while(byteRead>0){
-			if(nextBlock==-1)
-				break;
-			if(byteRead<=BLOCKSIZE){
-				//write on remaining block
-				log_write("in ramdisk_read with only last block to write as byteRead:%d",byteRead);
-				char *offset = memoffset + (nextBlock*BLOCKSIZE);
-				strncpy(buf,offset,byteRead);
-				byteRead = 0;
-			}else{
-				log_write("in ramdisk_read with more block to write as byteRead:%d",byteRead);
-				char *offset = memoffset + (nextBlock*BLOCKSIZE);
-				strncpy(buf,offset,BLOCKSIZE);
-				if(nextBlock==-1)
-					return -ENOSPC;
-				nextBlock = nextBlockMap[nextBlock];
-				byteRead -= BLOCKSIZE;
-			}
-		}*/
-		return ((int)size)-offset;
-	}else{
-		return -ENOENT;
+static struct splicePipe *splice_pipe_get(size_t size){
+	// the calling thread's pipe, empty and able to hold size bytes
+	struct splicePipe *sp = threadPipe;
+	int left = 0;
+	if(sp==NULL){
+		sp = (struct splicePipe *) malloc(sizeof(struct splicePipe));
+		if(sp==NULL)
+			return NULL;
+		if(splice_pipe_open(sp)){
+			free(sp);
+			return NULL;
+		}
+		pthread_setspecific(pipeKey,sp);
+		threadPipe = sp;
+	}else if(!ioctl(sp->fd[0],FIONREAD,&left)&&left){
+		// a reply that failed half way left data behind, start over
+		splice_pipe_close(sp);
+		if(splice_pipe_open(sp)){
+			pthread_setspecific(pipeKey,NULL);
+			free(sp);
+			threadPipe = NULL;
+			return NULL;
+		}
 	}
+	if((long)size > sp->cap){
+		long cap = fcntl(sp->fd[1],F_SETPIPE_SZ,size);
+		if(cap<0)
+			return NULL;
+		sp->cap = cap;
+	}
+	return sp;
+}
+
+static ssize_t read_reply(struct fuse_bufvec *bv, int fd, size_t size, off_t offset){
+	// reply with the blocks themselves : the disk splices them into a per
+	// thread pipe and the library splices the pipe on to the kernel, so
+	// no byte is copied in user space when splice_write is on. the library
+	// frees buf[].mem of a read_buf reply, so pointers into the data
+	// region cannot be handed out directly. when the disk cannot splice
+	// the range the data is copied into a malloc'd buffer instead, which
+	// the caller frees once replied
+	*bv = (struct fuse_bufvec) FUSE_BUFVEC_INIT(0);
+	struct splicePipe *sp = (size>0) ? splice_pipe_get(size) : NULL;
+	ssize_t res = sp ? rd_splice(rd,fd,sp->fd[1],size,offset) : -EOPNOTSUPP;
+	if(res>=0){
+		bv->buf[0].size = res;
+		bv->buf[0].flags = FUSE_BUF_IS_FD;
+		bv->buf[0].fd = sp->fd[0];
+	}else if((res==-EOPNOTSUPP)||(res==-EIO)){
+		// a short splice leaves the pipe dirty, splice_pipe_get resets it
+		bv->buf[0].mem = malloc(size ? size : 1);
+		res = bv->buf[0].mem ? rd_pread(rd,fd,bv->buf[0].mem,size,offset) : -ENOMEM;
+		if(res>=0)
+			bv->buf[0].size = res;
+	}
+	if(res<0){
+		free(bv->buf[0].mem);
+		bv->buf[0].mem = NULL;
+	}
+	return res;
+}
+
+static int ramdisk_read_buf(const char *path, struct fuse_bufvec **bufp, size_t size, off_t offset,
+		      struct fuse_file_info *fi){
+	struct fuse_bufvec *bv = (struct fuse_bufvec *) malloc(sizeof(struct fuse_bufvec));
+	if(bv==NULL)
+		return -ENOMEM;
+	ssize_t res = read_reply(bv,fi->fh,size,offset);
+	if(res<0){
+		free(bv);
+		return res;
+	}
+	*bufp = bv;
 	return 0;
 }
 
 static int ramdisk_mknod(const char *path, mode_t mode, dev_t rdev)
 {
 	int res;
-	log_write("ramdisk_mknod called with path : %s",path);
 	/* On Linux this could just be 'mknod(path, mode, rdev)' but this
-	   is more portable 
+	   is more portable
 	if (S_ISREG(mode)) {
 		res = open(path, O_CREAT | O_EXCL | O_WRONLY, mode);
 		if (res >= 0)
@@ -492,551 +237,780 @@ static int ramdisk_mknod(const char *path, mode_t mode, dev_t rdev)
 	if (res == -1)
 		return -errno;
 	*/
-	log_write("ramdisk_mknod called with path : [%s]",path);
 	return 0;
 }
 
-
-
-static int checkInDir(char *dirStr,char *filePath){
-	int i=0;
-	log_write("checkInDir called with dirStr:[%s] len : %d and filePath:[%s]",dirStr,strlen(dirStr),filePath);
-	while((i<strlen(dirStr))&&(i<strlen(filePath))){
-		log_write("matching [%d] == [%c]",dirStr[i],filePath[i]);
-		if(dirStr[i]!=filePath[i])
-			break;
-		i+=1;
-	}
-
-	log_write("i is :%d",i);
-	if(i<strlen(dirStr))
-		return 0;
-	/*
-	while(i<strlen(filePath)){
-		if(filePath[i]=='/')
-			return 0;
-		i+=1;
-	}*/
-	return 1;
+static int ramdisk_truncate(const char *path, off_t length)
+{
+	return rd_truncate(rd,path,length);
 }
 
-
-static int ramdisk_truncate(const char *pathStr, off_t length)
+static int ramdisk_ftruncate(const char *path, off_t length, struct fuse_file_info *fi)
 {
-	log_write("ramdisk_truncate called with path : %s",pathStr);
-
-	int i,index=-1,dirExists=0,fileExists=0;
-
-	for(i=0;i<MAXPATHLIST;i++){
-		if(!strcmp(pathStr,pathlist[i])){
-			fileExists=1;
-			index=i;
-			if(isDir[i]=='d')
-				return -EISDIR;
-		}else if((isDir[i]=='d')&&(checkInDir(pathlist[i],(char *)pathStr))) {
-			dirExists = 1;
-		}
-		if(fileExists&&dirExists)
-			break;
-	}
-
-	if(checkInDir("/",(char *)pathStr))
-		dirExists=1;
-
-	log_write("fileExists=%d and dirExists=%d",fileExists,dirExists);
-
-	if(!dirExists)
-		return -ENOENT;
-
-	if(!fileExists){
-		// create the file
-		log_write("NEW file");
-		int lastNull=-1;
-		//create a new entry in pathtable
-		for(i=0;i<MAXPATHLIST;i++){
-			if(pathlist[i][0]=='\0'){
-				lastNull=i;
-				break;
-			}
-		}
-		if(lastNull==-1)
-			return -ENOSPC;
-		log_write("Found index %d free",lastNull);
-		strcpy(pathlist[lastNull],strdup(pathStr));
-		fileSize[lastNull]=0;
-		//get free block from bitmap
-		int blockNum = getfreeBlock();
-		log_write("Found free block at : %d ",blockNum);
-		//set the bitmap
-		setBlock(blockNum);
-		// allocate block
-		blockMap[lastNull]=blockNum;
-		nextBlockMap[blockNum]=-1;
-
-		return 0;
-	}else{
-		int size = 	fileSize[index];
-		if(length<=BLOCKSIZE){
-			if(size>BLOCKSIZE){
-				// allocated blocks > 1
-				int numBlocks = (size/BLOCKSIZE);
-				if(size%BLOCKSIZE==0)
-					numBlocks-=1;
-				int nextBlock = nextBlockMap[blockMap[index]];
-				int *prevBlock;
-
-				while((numBlocks>0)&&(nextBlock!=-1)){
-					 resetBlock(nextBlock);
-					 prevBlock = &nextBlockMap[nextBlock];
-					 nextBlock = nextBlockMap[nextBlock];
-					 *prevBlock=-1;
-					 numBlocks-=1;
-				}
-				
-			}
-		}else{
-			int startBlocks = (length/BLOCKSIZE);
-			if(length%BLOCKSIZE==0)
-				startBlocks-=1;
-			int nextBlock = nextBlockMap[blockMap[index]];
-			while((startBlocks>0)&&(nextBlock!=-1)){
-				nextBlock = nextBlockMap[nextBlock];
-				startBlocks-=1;
-			}
-			int *prevBlock;
-			while(nextBlock!=-1){
-				resetBlock(nextBlock);
-				prevBlock = &nextBlockMap[nextBlock];
-				nextBlock = nextBlockMap[nextBlock];
-				*prevBlock=-1;
-			}
-		}
-	}
-	fileSize[index]=length;
-	return 0;
+	return rd_ftruncate(rd,fi->fh,length);
 }
 
+static int ramdisk_fallocate(const char *path, int mode, off_t offset, off_t length, struct fuse_file_info *fi)
+{
+	return rd_fallocate(rd,fi->fh,mode,offset,length);
+}
 
-static int ramdisk_unlink(const char *path) {
-	int i,index=-1,dirExists=0,fileExists=0;
-	log_write("ramdisk_unlink called with path : %s",path);
-	for(i=0;i<MAXPATHLIST;i++){
-		if(!strcmp(path,pathlist[i])){
-			fileExists=1;
-			index=i;
-			if(isDir[i]=='d')
-				return -EISDIR;
-			break;
-		}
-	}
-
-	if(!fileExists)
-		return -ENOENT;
+#define EXTENTSXATTR "user.ramdisk.extents"
 
-	log_write("in ramdisk_unlink found path [%s] at index [%d]",path,index);
-	int nextBlock = blockMap[index];
-	while(nextBlock!= -1){
-		resetBlock(nextBlock);
-		int *ptrprevblock = &nextBlockMap[index];
-		nextBlock = nextBlockMap[index];
-		*ptrprevblock=-1;
-	}
-
-	blockMap[index]=-1;
-	strcpy(pathlist[i],"");
-	isDir[index]='r';
-	return 0;
+static int extents_list(int fd, char *value, size_t size)
+{
+	// EXTENTSXATTR lists the data ranges of a file, one "offset length"
+	// line each, as SEEK_DATA and SEEK_HOLE would find them : the kernel
+	// does not pass lseek on to this version of the library. it is left
+	// out of listxattr so copies do not carry it along. only installed
+	// with -o extents, as once there is a getxattr the kernel asks it for
+	// security.capability before every write. closes fd
+	ssize_t len = 0;
+	if(fd<0)
+		return (fd==-EISDIR) ? -ENODATA : fd;
+	off_t data = rd_lseek(rd,fd,0,SEEK_DATA);
+	while(data>=0){
+		off_t hole = rd_lseek(rd,fd,data,SEEK_HOLE);
+		char line[48];
+		int n = snprintf(line,sizeof(line),"%lld %lld\n",(long long)data,(long long)(hole-data));
+		if(size && (len+n <= (ssize_t)size))
+			memcpy(value+len,line,n);
+		len += n;
+		data = rd_lseek(rd,fd,hole,SEEK_DATA);
+	}
+	rd_close(rd,fd);
+	if(size && (len>(ssize_t)size))
+		return -ERANGE;
+	return (len>XATTR_SIZE_MAX) ? -E2BIG : (int)len;
+}
+
+static int ramdisk_getxattr(const char *path, const char *name, char *value, size_t size)
+{
+	if(strcmp(name,EXTENTSXATTR) || is_ctl(path))
+		return -ENODATA;
+	return extents_list(rd_open(rd,path,O_RDONLY,0),value,size);
 }
 
-
-static int ramdisk_create(const char* pathStr, mode_t mode, struct fuse_file_info *fileInfo){
-	log_write("ramdisk_create called with path : %s",pathStr);
-	ramdisk_truncate(pathStr,0);
-	return 0;
+static int ramdisk_unlink(const char *path) {
+	return rd_unlink(rd,path);
 }
 
 static int ramdisk_access(const char* path,int mask){
-	int i,index=-1,dirExists=0,fileExists=0;
-	log_write("in ramdisk_access with path : %s, mask: %d",path,mask);
-	for(i=0;i<MAXPATHLIST;i++){
-		if(!strcmp(path,pathlist[i])){
-			return 0;
-		}
-	}
-	if(!strcmp(path,"/"))
-		return 0;
-	return -ENOENT;
+	return rd_access(rd,path,mask);
 }
 
 static int ramdisk_readlink(const char *path, char *buf, size_t size)
 {
-	log_write("ramdisk_readlink called with path : %s",path);
+	// the library wants the target NUL terminated, cut to fit
+	if(size==0)
+		return -EINVAL;
+	ssize_t res = rd_readlink(rd,path,buf,size-1);
+	if(res<0)
+		return res;
+	buf[res] = '\0';
 	return 0;
 }
 
 static int ramdisk_rename(const char *from, const char *to)
 {
-	log_write("ramdisk_rename called with from: [%s] and to [%s]",from,to);
-	int i,index=-1,dir=0,fileExists=0;
-	for(i=0;i<MAXPATHLIST;i++){
-		if(!strcmp(from,pathlist[i])){
-			fileExists=1;
-			index=i;
-			if(isDir[i]=='d')
-				dir=1;
-		}
-	}
-
-	if(dir){
-		//special handling for directory	
-		log_write("ramdisk_rename called for directory");
-	}else{
-		if(fileExists)
-			strcpy(pathlist[index],to);
-		return 0;
-	}
-
-	if(!strcmp(from,"/"))
-		return -EACCES;
-
-	return -ENOENT;
+	return rd_rename(rd,from,to);
 }
 
 static int ramdisk_rmdir(const char *path)
 {
-	log_write("ramdisk_rmdir called with path: %s",path);
-
-	//check for subfolder or files inside the dir
-	int i=0;
-	// check if directory exists
-	int exists=0,dir=0,index=-1;
-	for(i=0;i<MAXPATHLIST;i++){
-		if(!strcmp(path,pathlist[i])){
-			if(isDir[i]=='d'){
-				exists=1;
-				dir=1;
-				index=i;
-			}
-			break;
-		}
-	}
-	
-	if(!strcmp(path, "/")){
-		log_write("ramdisk_rmdir return ebusy");
-		return -EBUSY;
-	}
-
-	if(!exists){
-		log_write("ramdisk_rmdir return enoent");
-		return -ENOENT;
-	}
-	
-	char pattern[PATH_MAX];
-	strcpy(pattern,path);
-	if(pattern[strlen(pattern)-1] != '/')
-		strcat(pattern,"/*");
-	else
-		strcat(pattern,"*");
-	for(i=0;i<MAXPATHLIST;i++){
-		if(!fnmatch(pattern,pathlist[i],FNM_PATHNAME)){
-			log_write("ramdisk_rmdir return enotempty cause file [%s] exists",pathlist[i]);
-			return -ENOTEMPTY;
-		}
-	}
-
-	// delete the folder
-	isDir[index]=='r';
-	strcpy(pathlist[index],"");
-	pathlist[index][0] = '\0';
-
-
-	return 0;
+	return rd_rmdir(rd,path);
 }
 
-
 static int ramdisk_utimens(const char *path, const struct timespec ts[2])
 {
-	log_write("ramdisk_utimens called with path: %s",path);
-
-	return 0;
+	return rd_utimens(rd,path,ts);
 }
 
-static int xmp_symlink(const char *from, const char *to)
+static int ramdisk_symlink(const char *from, const char *to)
 {
-	int res;
-int fd = open("/tmp/output-symlink",O_RDWR|O_CREAT);
-	write(fd,"STARTLOG\n",strlen("STARTLOG\n"));
-	close(fd);
-	res = symlink(from, to);
-	if (res == -1)
-		return -errno;
-
-	return 0;
+	caller_creds();
+	return rd_symlink(rd,from,to);
 }
 
-
-
-static int xmp_link(const char *from, const char *to)
+static int ramdisk_link(const char *from, const char *to)
 {
-	int res;
-int fd = open("/tmp/output-link",O_RDWR|O_CREAT);
-	write(fd,"STARTLOG\n",strlen("STARTLOG\n"));
-	close(fd);
-	res = link(from, to);
-	if (res == -1)
-		return -errno;
-
-	return 0;
+	return rd_link(rd,from,to);
 }
 
-static int xmp_chmod(const char *path, mode_t mode)
+static int ramdisk_chmod(const char *path, mode_t mode)
 {
-	int res;
-int fd = open("/tmp/output-chmod",O_RDWR|O_CREAT);
-	write(fd,"STARTLOG\n",strlen("STARTLOG\n"));
-	close(fd);
-	res = chmod(path, mode);
-	if (res == -1)
-		return -errno;
-
-	return 0;
+	return rd_chmod(rd,path,mode);
 }
 
-static int xmp_chown(const char *path, uid_t uid, gid_t gid)
+static int ramdisk_chown(const char *path, uid_t uid, gid_t gid)
 {
-	int res;
-int fd = open("/tmp/output-chown",O_RDWR|O_CREAT);
-	write(fd,"STARTLOG\n",strlen("STARTLOG\n"));
-	close(fd);
-	res = lchown(path, uid, gid);
-	if (res == -1)
-		return -errno;
-
-	return 0;
+	return rd_chown(rd,path,uid,gid);
 }
 
-
-static int xmp_statfs(const char *path, struct statvfs *stbuf)
+static int ramdisk_statfs(const char *path, struct statvfs *stbuf)
 {
-	int res;
-int fd = open("/tmp/output-statfs",O_RDWR|O_CREAT);
-	write(fd,"STARTLOG\n",strlen("STARTLOG\n"));
-	close(fd);
-	res = statvfs(path, stbuf);
-	if (res == -1)
-		return -errno;
+	return rd_statfs(rd,stbuf);
+}
 
-	return 0;
+static int ramdisk_release(const char *path, struct fuse_file_info *fi)
+{
+	return rd_close(rd,fi->fh);
 }
 
-static int xmp_release(const char *path, struct fuse_file_info *fi)
+static int ramdisk_fsync(const char *path, int isdatasync,
+		     struct fuse_file_info *fi)
 {
-	/* Just a stub.	 This method is optional and can safely be left
-	   unimplemented */
-int fd = open("/tmp/output-release",O_RDWR|O_CREAT);
-	write(fd,"STARTLOG\n",strlen("STARTLOG\n"));
-	close(fd);
-	(void) path;
-	(void) fi;
-	return 0;
+	// the journal is the only thing to wait for, with or without data
+	(void) isdatasync;
+	return rd_fsync(rd,fi->fh);
 }
 
-static int xmp_fsync(const char *path, int isdatasync,
+static int ramdisk_fsyncdir(const char *path, int isdatasync,
 		     struct fuse_file_info *fi)
 {
-	/* Just a stub.	 This method is optional and can safely be left
-	   unimplemented */
-int fd = open("/tmp/output-fsync",O_RDWR|O_CREAT);
-	write(fd,"STARTLOG\n",strlen("STARTLOG\n"));
-	close(fd);
-	(void) path;
 	(void) isdatasync;
-	(void) fi;
-	return 0;
+	return rd_sync(rd);
 }
 
-static void ramdisk_destroy(){
-	log_write("in ramdisk_destroy !!! with usePersist:%d",usePersist);
-	if(usePersist){
-		// save content is disk
-		log_write("saving content in [%s]",persistPath);
-		FILE *dataFile = fopen(persistPath,"wb");
-		memorysize /= 1024*1024;
-		fwrite(&memorysize,sizeof(int),1,dataFile);
-		fwrite(bitMap,1,blockcount,dataFile);
-		fwrite(nextBlockMap,sizeof(int),blockcount,dataFile);
-		fwrite(blockMap,sizeof(int),MAXPATHLIST,dataFile);
-		int i=0;
-		for(i=0;i<MAXPATHLIST;i++){
-			fwrite(&pathlist[i],1,PATH_MAX,dataFile);
-		}
-		fwrite(fileSize,sizeof(int),MAXPATHLIST , dataFile);
-		fwrite(blockMap,sizeof(int),MAXPATHLIST,dataFile);
-		fwrite(isDir,1,MAXPATHLIST,dataFile);
-
-		
-		memorysize *= 1024*1024;
-		fwrite(memoffset,1,memorysize,dataFile);	
-		fclose(dataFile);	
-	}
+static void daemon_start(struct fuse_conn_info *conn){
+	// the disk's threads start here, after the daemon has daemonized
+	pthread_key_create(&pipeKey,splice_pipe_release);
+	// reads reply with spliced pipes, let the library splice them on to
+	// the kernel rather than copy them (-o no_splice_write still wins)
+	if(conn->capable & FUSE_CAP_SPLICE_WRITE)
+		conn->want |= FUSE_CAP_SPLICE_WRITE;
+	rd_start(rd);
+}
+
+static void *ramdisk_init(struct fuse_conn_info *conn){
+	daemon_start(conn);
+	return NULL;
+}
+
+static void ramdisk_destroy(void *data){
+	rd_free(rd);
+	rd = NULL;
 }
 
 static struct fuse_operations ramdisk_opts={
 	.getattr	= ramdisk_getattr,
+	.fgetattr	= ramdisk_fgetattr,
 	.readdir	= ramdisk_readdir,
 	.mkdir		= ramdisk_mkdir,
 	.open		= ramdisk_open,
 	.write		= ramdisk_write,
 	.read		= ramdisk_read,
+	.write_buf	= ramdisk_write_buf,
+	.read_buf	= ramdisk_read_buf,
 	.mknod		= ramdisk_mknod,
 	.create		= ramdisk_create,
 	.truncate	= ramdisk_truncate,
+	.ftruncate	= ramdisk_ftruncate,
+	.fallocate	= ramdisk_fallocate,
+	.getxattr	= ramdisk_getxattr,
 	.unlink		= ramdisk_unlink,
 	.access		= ramdisk_access,
 	.rmdir		= ramdisk_rmdir,
 	.rename		= ramdisk_rename,
 	.readlink	= ramdisk_readlink,
 	.utimens	= ramdisk_utimens,
+	.init		= ramdisk_init,
 	.destroy 	= ramdisk_destroy,
 
-	.symlink	= xmp_symlink,
-	.link		= xmp_link,
-	.chmod		= xmp_chmod,
-	.chown		= xmp_chown,
-	.statfs		= xmp_statfs,
-	.release	= xmp_release,
-	.fsync		= xmp_fsync,
+	.symlink	= ramdisk_symlink,
+	.link		= ramdisk_link,
+	.chmod		= ramdisk_chmod,
+	.chown		= ramdisk_chown,
+	.statfs		= ramdisk_statfs,
+	.release	= ramdisk_release,
+	.fsync		= ramdisk_fsync,
+	.fsyncdir	= ramdisk_fsyncdir,
+
+	// read, write, ftruncate, fgetattr and release work from fi->fh alone,
+	// so they keep working on files unlinked while open (hard_remove)
+	.flag_nullpath_ok = 1,
 };
 
-void init_pathlist(){
-	int i=0;
-	for(i=0;i<MAXPATHLIST;i++){
-		pathlist[i][0]='\0';
-		fileSize[i] = 0;
-		isDir[i] = 'r';
+// low-level backend : the kernel holds the disk's own inode numbers,
+// see rd_lookup, and every reply that hands one out takes a lookup
+// reference the kernel gives back through forget. a directory is listed
+// whole at opendir and readdir serves that copy by offset. the cache
+// options are set from the mount options of the same names, see main
+static double llEntryTimeout = 1.0;	// s, as on the high-level API
+static double llAttrTimeout = 1.0;
+static double llNegativeTimeout;	// 0 caches no failed lookup
+static int llKeepCache;		// kernel_cache or auto_cache
+
+static double ll_timeout(fuse_ino_t ino,double timeout){
+	// control entries change on every read
+	return (ino>=RAMDISK_CTLINO) ? 0.0 : timeout;
+}
+
+static void ll_serve(void){
+	// the kernel saw the changes its own requests make, see rd_serve
+	static __thread int served;
+	if(!served){
+		rd_serve(rd);
+		served = 1;
+	}
+}
+
+// changes made past the kernel, see rd_notify, are queued and sent by a
+// thread of their own : the kernel can hold the locks an invalidation
+// takes until a request it has in flight is answered
+struct inval {
+	struct inval *next;
+	fuse_ino_t ino;
+	off_t offset,length;
+	size_t len;		// of name, 0 for the inode itself
+	char name[];
+};
+static struct fuse_chan *llChan;
+static struct inval *invalHead,**invalTail = &invalHead;
+static pthread_mutex_t invalLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t invalWake = PTHREAD_COND_INITIALIZER;
+static int invalStop;
+static pthread_t invalThread;
+
+static void inval_queue(fuse_ino_t ino, off_t offset, off_t length, const char *name, size_t len){
+	// a notice lost to a failed malloc leaves the entry cached until it times out
+	struct inval *v = (struct inval *) malloc(sizeof(struct inval)+len);
+	if(v==NULL)
+		return;
+	v->next = NULL;
+	v->ino = ino;
+	v->offset = offset;
+	v->length = length;
+	v->len = len;
+	memcpy(v->name,name,len);
+	pthread_mutex_lock(&invalLock);
+	*invalTail = v;
+	invalTail = &v->next;
+	pthread_cond_signal(&invalWake);
+	pthread_mutex_unlock(&invalLock);
+}
+
+static void inval_inode(void *arg, rd_ino_t ino, off_t offset, off_t length){
+	inval_queue(ino,offset,length,NULL,0);
+}
+
+static void inval_entry(void *arg, rd_ino_t dir, const char *name, size_t len){
+	inval_queue(dir,0,0,name,len);
+}
+
+static const struct rd_notifier llNotifier = { inval_inode, inval_entry };
+
+static void *inval_run(void *arg){
+	// -ENOENT only means the kernel has nothing of it cached
+	struct inval *v;
+	char name[NAME_MAX+1];
+	pthread_mutex_lock(&invalLock);
+	for(;;){
+		while((invalHead==NULL)&&!invalStop)
+			pthread_cond_wait(&invalWake,&invalLock);
+		if((v = invalHead)==NULL)
+			break;
+		if((invalHead = v->next)==NULL)
+			invalTail = &invalHead;
+		pthread_mutex_unlock(&invalLock);
+		if(v->len){
+			memcpy(name,v->name,v->len);
+			name[v->len] = '\0';
+			fuse_lowlevel_notify_inval_entry(llChan,v->ino,name,v->len);
+		}else{
+			fuse_lowlevel_notify_inval_inode(llChan,v->ino,v->offset,v->length);
+		}
+		free(v);
+		pthread_mutex_lock(&invalLock);
 	}
-	for(i=0;i<blockcount;i++){
-		bitMap[i]=0;
+	pthread_mutex_unlock(&invalLock);
+	return NULL;
+}
+
+static void ll_reply_entry(fuse_req_t req, int res, struct fuse_entry_param *e){
+	// reply with the entry res took a reference on, which goes back when
+	// the request was interrupted meanwhile
+	if(res){
+		fuse_reply_err(req,-res);
+		return;
+	}
+	e->ino = e->attr.st_ino;
+	e->entry_timeout = ll_timeout(e->ino,llEntryTimeout);
+	e->attr_timeout = ll_timeout(e->ino,llAttrTimeout);
+	if(fuse_reply_entry(req,e)==-ENOENT)
+		rd_forget(rd,e->ino,1);
+}
+
+static void ll_lookup(fuse_req_t req, fuse_ino_t parent, const char *name){
+	struct fuse_entry_param e;
+	memset(&e,0,sizeof(e));
+	int res = rd_lookup(rd,parent,name,&e.attr);
+	if((res==-ENOENT)&&(llNegativeTimeout>0)){
+		// inode 0 has the kernel cache the name as missing
+		e.entry_timeout = ll_timeout(parent,llNegativeTimeout);
+		fuse_reply_entry(req,&e);
+		return;
+	}
+	ll_reply_entry(req,res,&e);
+}
+
+static void ll_forget(fuse_req_t req, fuse_ino_t ino, unsigned long nlookup){
+	rd_forget(rd,ino,nlookup);
+	fuse_reply_none(req);
+}
+
+static void ll_forget_multi(fuse_req_t req, size_t count, struct fuse_forget_data *forgets){
+	size_t i;
+	for(i=0;i<count;i++)
+		rd_forget(rd,forgets[i].ino,forgets[i].nlookup);
+	fuse_reply_none(req);
+}
+
+static void ll_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi){
+	struct stat st;
+	int res = fi ? rd_fstat(rd,fi->fh,&st) : rd_stat_ino(rd,ino,&st);
+	if(res)
+		fuse_reply_err(req,-res);
+	else
+		fuse_reply_attr(req,&st,ll_timeout(ino,llAttrTimeout));
+}
+
+static void ll_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr, int to_set, struct fuse_file_info *fi){
+	// each change is applied on its own, the first to fail is the reply
+	ll_serve();
+	int res = 0;
+	if(to_set & FUSE_SET_ATTR_MODE)
+		res = rd_chmod_ino(rd,ino,attr->st_mode);
+	if(!res && (to_set & (FUSE_SET_ATTR_UID|FUSE_SET_ATTR_GID)))
+		res = rd_chown_ino(rd,ino,(to_set & FUSE_SET_ATTR_UID) ? attr->st_uid : (uid_t)-1,(to_set & FUSE_SET_ATTR_GID) ? attr->st_gid : (gid_t)-1);
+	if(!res && (to_set & FUSE_SET_ATTR_SIZE))
+		res = fi ? rd_ftruncate(rd,fi->fh,attr->st_size) : rd_truncate_ino(rd,ino,attr->st_size);
+	if(!res && (to_set & (FUSE_SET_ATTR_ATIME|FUSE_SET_ATTR_MTIME))){
+		struct timespec ts[2] = { { 0, UTIME_OMIT }, { 0, UTIME_OMIT } };
+		if(to_set & FUSE_SET_ATTR_ATIME)
+			ts[0] = (to_set & FUSE_SET_ATTR_ATIME_NOW) ? (struct timespec){ 0, UTIME_NOW } : attr->st_atim;
+		if(to_set & FUSE_SET_ATTR_MTIME)
+			ts[1] = (to_set & FUSE_SET_ATTR_MTIME_NOW) ? (struct timespec){ 0, UTIME_NOW } : attr->st_mtim;
+		res = rd_utimens_ino(rd,ino,ts);
+	}
+	if(res)
+		fuse_reply_err(req,-res);
+	else
+		ll_getattr(req,ino,NULL);
+}
+
+static void ll_creds(fuse_req_t req){
+	const struct fuse_ctx *c = fuse_req_ctx(req);
+	rd_creds(c->uid,c->gid);
+}
+
+static void ll_mknod(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode, dev_t rdev){
+	// regular files only, made as create would
+	ll_serve();
+	ll_creds(req);
+	struct fuse_entry_param e;
+	memset(&e,0,sizeof(e));
+	int fd = S_ISREG(mode) ? rd_openat(rd,parent,name,O_CREAT|O_EXCL|O_WRONLY,mode,&e.attr) : -EPERM;
+	if(fd>=0)
+		rd_close(rd,fd);
+	ll_reply_entry(req,(fd<0) ? fd : 0,&e);
+}
+
+static void ll_mkdir(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode){
+	ll_serve();
+	ll_creds(req);
+	struct fuse_entry_param e;
+	memset(&e,0,sizeof(e));
+	ll_reply_entry(req,rd_mkdirat(rd,parent,name,mode,&e.attr),&e);
+}
+
+static void ll_unlink(fuse_req_t req, fuse_ino_t parent, const char *name){
+	ll_serve();
+	fuse_reply_err(req,-rd_unlinkat(rd,parent,name,0));
+}
+
+static void ll_rmdir(fuse_req_t req, fuse_ino_t parent, const char *name){
+	ll_serve();
+	fuse_reply_err(req,-rd_unlinkat(rd,parent,name,AT_REMOVEDIR));
+}
+
+static void ll_rename(fuse_req_t req, fuse_ino_t parent, const char *name, fuse_ino_t newparent, const char *newname){
+	ll_serve();
+	// this version of the low-level API takes no rename flags
+	fuse_reply_err(req,-rd_renameat(rd,parent,name,newparent,newname,0));
+}
+
+static void ll_symlink(fuse_req_t req, const char *link, fuse_ino_t parent, const char *name){
+	ll_serve();
+	ll_creds(req);
+	struct fuse_entry_param e;
+	memset(&e,0,sizeof(e));
+	ll_reply_entry(req,rd_symlinkat(rd,link,parent,name,&e.attr),&e);
+}
+
+static void ll_link(fuse_req_t req, fuse_ino_t ino, fuse_ino_t newparent, const char *newname){
+	ll_serve();
+	struct fuse_entry_param e;
+	memset(&e,0,sizeof(e));
+	ll_reply_entry(req,rd_linkat(rd,ino,newparent,newname,&e.attr),&e);
+}
+
+static void ll_readlink(fuse_req_t req, fuse_ino_t ino){
+	char target[PATH_MAX];
+	ssize_t res = rd_readlink_ino(rd,ino,target,sizeof(target)-1);
+	if(res<0){
+		fuse_reply_err(req,-res);
+		return;
 	}
-	
-}
-
-int loads_data(char * path){
-	//check file exists
-	log_write(" in loads_data File path in params is [%s]",path);
-	char currentPath[PATH_MAX];
-	getcwd(currentPath,PATH_MAX);
-	if(path[0] != '/'){
-		//relative path given
-		strcat(currentPath,"/");
-		strcat(currentPath,path);
-		realpath((const char *)strdup(currentPath),currentPath);
+	target[res] = '\0';
+	fuse_reply_readlink(req,target);
+}
+
+static void ll_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi){
+	ll_serve();
+	int fd = rd_open_ino(rd,ino,fi->flags);
+	if(fd<0){
+		fuse_reply_err(req,-fd);
+		return;
 	}
+	fi->fh = fd;
+	fi->direct_io = (ino>=RAMDISK_CTLINO);
+	fi->keep_cache = llKeepCache && !fi->direct_io;
+	if(fuse_reply_open(req,fi)==-ENOENT)
+		rd_close(rd,fd);
+}
 
-	if( access( path, F_OK ) == -1 ) {
-	    // file doesn't exist
-	    strcpy(persistPath,currentPath);
-	    return 1;
+static void ll_create(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode, struct fuse_file_info *fi){
+	ll_serve();
+	ll_creds(req);
+	struct fuse_entry_param e;
+	memset(&e,0,sizeof(e));
+	int fd = rd_openat(rd,parent,name,fi->flags|O_CREAT,mode,&e.attr);
+	if(fd<0){
+		fuse_reply_err(req,-fd);
+		return;
 	}
+	fi->fh = fd;
+	e.ino = e.attr.st_ino;
+	e.entry_timeout = ll_timeout(e.ino,llEntryTimeout);
+	e.attr_timeout = ll_timeout(e.ino,llAttrTimeout);
+	fi->direct_io = (e.ino>=RAMDISK_CTLINO);
+	fi->keep_cache = llKeepCache && !fi->direct_io;
+	if(fuse_reply_create(req,&e,fi)==-ENOENT){
+		rd_close(rd,fd);
+		rd_forget(rd,e.ino,1);
+	}
+}
 
-	
-
-	//read meta data
-	FILE *dataFile = fopen(path,"rb");
-	log_write("fopen done");
-	fread(&memorysize,sizeof(int),1,dataFile);
-	log_write("TOTAL MEMORY : %d",memorysize);
-	log_write("fopen memorysize");
-	memorysize *= 1024*1024;
-
-	blockcount = memorysize/BLOCKSIZE;
-	
-	bitMap = (char*) malloc(blockcount);
-	fread(bitMap,1,blockcount,dataFile);
-	log_write("fopen dataFile");
-	nextBlockMap = (int*) malloc(blockcount*(sizeof(int)));
-	fread(nextBlockMap,sizeof(int),blockcount,dataFile);
-	log_write("fopen nextBlockMap");
-	fread(blockMap,sizeof(int),MAXPATHLIST,dataFile);
-	log_write("fopen blockMap");
-	int i=0;
-	for(i=0;i<MAXPATHLIST;i++){
-		fread(&pathlist[i],1,PATH_MAX,dataFile);
+static void ll_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi){
+	struct fuse_bufvec bv;
+	ssize_t res = read_reply(&bv,fi->fh,size,off);
+	if(res<0){
+		fuse_reply_err(req,-res);
+		return;
 	}
+	fuse_reply_data(req,&bv,FUSE_BUF_SPLICE_MOVE);
+	free(bv.buf[0].mem);
+}
 
-	log_write("fopen pathlist");
-fread(fileSize,sizeof(int),MAXPATHLIST , dataFile);
-	fread(blockMap,sizeof(int),MAXPATHLIST,dataFile);
-	log_write("fopen blockMap");
-	fread(isDir,1,MAXPATHLIST,dataFile);
-	log_write("fopen isDir");
-	
-	log_write("fopen fileSize");
-	//lseek to the data address
-	memoffset = (char *)malloc(memorysize);
-	fread(memoffset,1,memorysize,dataFile);
-	log_write("fopen memoffset");
-	//read the data and store in memory offset
-	fclose (dataFile);
-	return 0;
+static void ll_write_buf(fuse_req_t req, fuse_ino_t ino, struct fuse_bufvec *bufv, off_t off, struct fuse_file_info *fi){
+	ll_serve();
+	ssize_t res = rd_pwrite_with(rd,fi->fh,fuse_buf_size(bufv),off,copy_request,bufv);
+	if(res<0)
+		fuse_reply_err(req,-res);
+	else
+		fuse_reply_write(req,res);
 }
 
+static void ll_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi){
+	fuse_reply_err(req,-rd_close(rd,fi->fh));
+}
 
-int main(int argc,char *argv[]){
-	log_init();
-	char *datafile;
-	if(argc == 3){
-		//running without mount file
-		memorysize = atoi(argv[2]);
-		argv[2][0]='\0';
-		argc -=1;
-		if(memorysize == 0)
-			return -1;
-		memorysize *= 1024*1024;
+static void ll_fsync(fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info *fi){
+	fuse_reply_err(req,-rd_fsync(rd,fi->fh));
+}
 
-		memoffset = (char *)malloc(memorysize);
-		memset(memoffset,0,memorysize);
+static void ll_fallocate(fuse_req_t req, fuse_ino_t ino, int mode, off_t offset, off_t length, struct fuse_file_info *fi){
+	ll_serve();
+	fuse_reply_err(req,-rd_fallocate(rd,fi->fh,mode,offset,length));
+}
 
-		blockcount = memorysize/BLOCKSIZE;
-		
-		bitMap = (char*) malloc(blockcount);
-		memset(bitMap,0,blockcount);
-		
-		nextBlockMap = (int*) malloc(blockcount*(sizeof(int)));
-		memset(nextBlockMap,-1,blockcount*(sizeof(int)));
+struct dirBuf {
+	fuse_req_t req;
+	char *p;
+	size_t size,cap;
+	int err;
+};
 
-		memset(blockMap,-1,MAXPATHLIST*(sizeof(int)));
-		init_pathlist();
+static int dir_add(void *arg, const char *name, const struct stat *st){
+	// append one entry, its offset is where the next one starts
+	struct dirBuf *d = (struct dirBuf *)arg;
+	size_t len = fuse_add_direntry(d->req,NULL,0,name,NULL,0);
+	if(d->size+len > d->cap){
+		size_t cap = d->cap ? d->cap : 4096;
+		while(cap < d->size+len)
+			cap *= 2;
+		char *p = (char *) realloc(d->p,cap);
+		if(p==NULL){
+			d->err = -ENOMEM;
+			return 1;
+		}
+		d->p = p;
+		d->cap = cap;
+	}
+	fuse_add_direntry(d->req,d->p+d->size,len,name,st,d->size+len);
+	d->size += len;
+	return 0;
+}
+
+static void ll_opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi){
+	struct dirBuf *d = (struct dirBuf *) calloc(1,sizeof(struct dirBuf));
+	if(d==NULL){
+		fuse_reply_err(req,ENOMEM);
+		return;
+	}
+	d->req = req;
+	int res = rd_readdir_ino(rd,ino,dir_add,d);
+	if(res==0)
+		res = d->err;
+	if(res==0){
+		fi->fh = (uintptr_t)d;
+		if(fuse_reply_open(req,fi)!=-ENOENT)
+			return;
 	}else{
-		//running with mount file
-		usePersist = 1;
-		memorysize = atoi(argv[2]);
-		argv[2][0]='\0';
-		argc -=2;
-		datafile = strdup(argv[3]);
-		if(loads_data(datafile)){
-				if(memorysize == 0)
-					return -1;
-				memorysize *= 1024*1024;
-
-				memoffset = (char *)malloc(memorysize);
-				memset(memoffset,0,memorysize);
-
-				blockcount = memorysize/BLOCKSIZE;
-				
-				bitMap = (char*) malloc(blockcount);
-				memset(bitMap,0,blockcount);
-				
-				nextBlockMap = (int*) malloc(blockcount*(sizeof(int)));
-				memset(nextBlockMap,-1,blockcount*(sizeof(int)));
-
-				memset(blockMap,-1,MAXPATHLIST*(sizeof(int)));
-				init_pathlist();
+		fuse_reply_err(req,-res);
+	}
+	free(d->p);
+	free(d);
+}
+
+static void ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi){
+	// the kernel drops an entry cut short and asks again from its offset
+	struct dirBuf *d = (struct dirBuf *)(uintptr_t)fi->fh;
+	if((size_t)off >= d->size)
+		fuse_reply_buf(req,NULL,0);
+	else
+		fuse_reply_buf(req,d->p+off,(d->size-off < size) ? d->size-off : size);
+}
+
+static void ll_releasedir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi){
+	struct dirBuf *d = (struct dirBuf *)(uintptr_t)fi->fh;
+	free(d->p);
+	free(d);
+	fuse_reply_err(req,0);
+}
+
+static void ll_fsyncdir(fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info *fi){
+	fuse_reply_err(req,-rd_sync(rd));
+}
+
+static void ll_statfs(fuse_req_t req, fuse_ino_t ino){
+	struct statvfs st;
+	int res = rd_statfs(rd,&st);
+	if(res)
+		fuse_reply_err(req,-res);
+	else
+		fuse_reply_statfs(req,&st);
+}
+
+static void ll_getxattr(fuse_req_t req, fuse_ino_t ino, const char *name, size_t size){
+	if(strcmp(name,EXTENTSXATTR) || (ino>=RAMDISK_CTLINO)){
+		fuse_reply_err(req,ENODATA);
+		return;
+	}
+	char *value = size ? (char *) malloc(size) : NULL;
+	int res = (size && (value==NULL)) ? -ENOMEM : extents_list(rd_open_ino(rd,ino,O_RDONLY),value,size);
+	if(res<0)
+		fuse_reply_err(req,-res);
+	else if(size)
+		fuse_reply_buf(req,value,res);
+	else
+		fuse_reply_xattr(req,res);
+	free(value);
+}
+
+static void ll_init(void *userdata, struct fuse_conn_info *conn){
+	daemon_start(conn);
+}
+
+static void ll_destroy(void *userdata){
+	ramdisk_destroy(userdata);
+}
+
+static struct fuse_lowlevel_ops ll_ops={
+	.init		= ll_init,
+	.destroy	= ll_destroy,
+	.lookup		= ll_lookup,
+	.forget		= ll_forget,
+	.forget_multi	= ll_forget_multi,
+	.getattr	= ll_getattr,
+	.setattr	= ll_setattr,
+	.mknod		= ll_mknod,
+	.mkdir		= ll_mkdir,
+	.unlink		= ll_unlink,
+	.rmdir		= ll_rmdir,
+	.rename		= ll_rename,
+	.symlink	= ll_symlink,
+	.link		= ll_link,
+	.readlink	= ll_readlink,
+	.open		= ll_open,
+	.create		= ll_create,
+	.read		= ll_read,
+	.write_buf	= ll_write_buf,
+	.release	= ll_release,
+	.fsync		= ll_fsync,
+	.fallocate	= ll_fallocate,
+	.opendir	= ll_opendir,
+	.readdir	= ll_readdir,
+	.releasedir	= ll_releasedir,
+	.fsyncdir	= ll_fsyncdir,
+	.statfs		= ll_statfs,
+	.getxattr	= ll_getxattr,
+};
+
+// the high-level API's cache options, taken by main, that the low-level
+// session would refuse
+static struct fuse_opt ll_cache_opts[] = {
+	FUSE_OPT_KEY("entry_timeout=", FUSE_OPT_KEY_DISCARD),
+	FUSE_OPT_KEY("attr_timeout=", FUSE_OPT_KEY_DISCARD),
+	FUSE_OPT_KEY("negative_timeout=", FUSE_OPT_KEY_DISCARD),
+	FUSE_OPT_KEY("kernel_cache", FUSE_OPT_KEY_DISCARD),
+	FUSE_OPT_KEY("auto_cache", FUSE_OPT_KEY_DISCARD),
+	FUSE_OPT_END
+};
+
+static int ll_main(struct fuse_args *args){
+	// fuse_main's steps, on a low-level session
+	struct fuse_chan *ch;
+	struct fuse_session *se;
+	char *mountpoint;
+	int mt,fg,res = -1;
+	if(fuse_opt_parse(args,NULL,ll_cache_opts,NULL)==-1)
+		return 1;
+	if(fuse_parse_cmdline(args,&mountpoint,&mt,&fg)==-1)
+		return 1;
+	ch = fuse_mount(mountpoint,args);
+	if(ch!=NULL){
+		se = fuse_lowlevel_new(args,&ll_ops,sizeof(ll_ops),NULL);
+		if(se!=NULL){
+			if(fuse_set_signal_handlers(se)!=-1){
+				fuse_session_add_chan(se,ch);
+				if(fuse_daemonize(fg)!=-1){
+					llChan = ch;
+					if(pthread_create(&invalThread,NULL,inval_run,NULL)==0){
+						rd_notify(rd,&llNotifier,NULL);
+						res = mt ? fuse_session_loop_mt(se) : fuse_session_loop(se);
+						rd_notify(rd,NULL,NULL);
+						pthread_mutex_lock(&invalLock);
+						invalStop = 1;
+						pthread_cond_signal(&invalWake);
+						pthread_mutex_unlock(&invalLock);
+						pthread_join(invalThread,NULL);
+					}
+				}
+				fuse_remove_signal_handlers(se);
+				fuse_session_remove_chan(ch);
+			}
+			fuse_session_destroy(se);
+		}
+		fuse_unmount(mountpoint,ch);
+	}
+	free(mountpoint);
+	return res ? 1 : 0;
+}
+
+// mount options : the disk's own go to rd_config_set, see ramdisk.h, the
+// daemon keeps extents (report data ranges through EXTENTSXATTR) and
+// lowlevel (serve the low-level API). the cache options are libfuse's on
+// the high-level API and are read here for the low-level one as well
+struct mountConfig {
+	struct ramdisk_config disk;
+	int extents;
+	int lowlevel;
+	double entryTimeout,attrTimeout,negativeTimeout;
+	int keepCache;
+	long size;		// MB
+	char *datafile;
+	int nonoptCount;
+};
+
+static struct fuse_opt ramdisk_fuse_opts[] = {
+	{ "extents", offsetof(struct mountConfig, extents), 1 },
+	{ "lowlevel", offsetof(struct mountConfig, lowlevel), 1 },
+	{ "entry_timeout=%lf", offsetof(struct mountConfig, entryTimeout), 0 },
+	{ "attr_timeout=%lf", offsetof(struct mountConfig, attrTimeout), 0 },
+	{ "negative_timeout=%lf", offsetof(struct mountConfig, negativeTimeout), 0 },
+	{ "kernel_cache", offsetof(struct mountConfig, keepCache), 1 },
+	{ "auto_cache", offsetof(struct mountConfig, keepCache), 1 },
+	FUSE_OPT_KEY("entry_timeout=", FUSE_OPT_KEY_KEEP),
+	FUSE_OPT_KEY("attr_timeout=", FUSE_OPT_KEY_KEEP),
+	FUSE_OPT_KEY("negative_timeout=", FUSE_OPT_KEY_KEEP),
+	FUSE_OPT_KEY("kernel_cache", FUSE_OPT_KEY_KEEP),
+	FUSE_OPT_KEY("auto_cache", FUSE_OPT_KEY_KEEP),
+	FUSE_OPT_END
+};
+
+static int ramdisk_opt_proc(void *data, const char *arg, int key, struct fuse_args *outargs){
+	// positional arguments are : mountpoint, size in MB, optional image
+	struct mountConfig *config = (struct mountConfig *)data;
+	if(key == FUSE_OPT_KEY_NONOPT){
+		config->nonoptCount++;
+		if(config->nonoptCount == 1)
+			return 1;
+		if(config->nonoptCount == 2){
+			config->size = atol(arg);
+			return 0;
+		}
+		if(config->nonoptCount == 3){
+			config->datafile = strdup(arg);
+			return 0;
 		}
 	}
+	if(key == FUSE_OPT_KEY_OPT){
+		int res = rd_config_set(&config->disk,arg);
+		if(res<0){
+			fprintf(stderr,"invalid value in option `%s'\n",arg);
+			return -1;
+		}
+		return res;
+	}
+	return 1;
+}
 
-	log_write("LOG INITIALIZED, Running fuse");
-	int fuse_ret = fuse_main(argc,argv,&ramdisk_opts,NULL);
-	log_close();
+int main(int argc,char *argv[]){
+	struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+	struct mountConfig config;
+	memset(&config,0,sizeof(config));
+	rd_config_init(&config.disk);
+	config.entryTimeout = llEntryTimeout;
+	config.attrTimeout = llAttrTimeout;
+	if(fuse_opt_parse(&args,&config,ramdisk_fuse_opts,ramdisk_opt_proc) == -1)
+		return -1;
+	if(config.size<=0)
+		return -1;
+	int res = rd_new(&rd,config.size*1024*1024,config.datafile,&config.disk);
+	if(res){
+		// the library logs why, the daemon is the one with a terminal
+		if(res==-EINVAL)
+			fprintf(stderr,"invalid disk options, see %s\n",RAMDISK_LOGFILE);
+		else
+			fprintf(stderr,"cannot set up the disk%s%s : %s, see %s\n",config.datafile ? " from " : "",config.datafile ? config.datafile : "",strerror(-res),RAMDISK_LOGFILE);
+		return -1;
+	}
+	if(!config.extents){
+		ramdisk_opts.getxattr = NULL;
+		ll_ops.getxattr = NULL;
+	}
+
+	int fuse_ret;
+	llEntryTimeout = config.entryTimeout;
+	llAttrTimeout = config.attrTimeout;
+	llNegativeTimeout = config.negativeTimeout;
+	llKeepCache = config.keepCache;
+	if(config.lowlevel)
+		fuse_ret = ll_main(&args);
+	else
+		fuse_ret = fuse_main(args.argc,args.argv,&ramdisk_opts,NULL);
+	fuse_opt_free_args(&args);
 	return fuse_ret;
-}
\ No newline at end of file
+}
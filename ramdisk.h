@@ -0,0 +1,191 @@
+/*
+  RAMDISK :  the in-memory filesystem as a library
+
+  A disk lives in the calling process: files are read and written with
+  memcpy, without the kernel or FUSE in between, and a process can hold
+  any number of independent disks. The FUSE daemon (ramdisk.c) is a thin
+  adapter over these calls, so both go through the same code.
+
+  Calls follow their POSIX namesakes but take the disk first and return
+  -errno instead of setting errno. Paths are absolute within the disk.
+  Descriptors are the disk's own and mean nothing to the kernel. A
+  descriptor's position is not locked: threads sharing one use
+  rd_pread and rd_pwrite.
+
+    struct ramdisk_config config;
+    struct ramdisk *rd;
+    rd_config_init(&config);
+    rd_config_set(&config,"dedup");
+    if(rd_new(&rd,512L*1024*1024,NULL,&config)==0){
+        rd_start(rd);
+        int fd = rd_open(rd,"/hello",O_CREAT|O_RDWR,0644);
+        rd_write(rd,fd,"hi\n",3);
+        rd_close(rd,fd);
+        rd_free(rd);
+    }
+
+  Author: Durgesh Kumar Gupta (dgupta9@ncsu.edu)
+*/
+
+#ifndef RAMDISK_H
+#define RAMDISK_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <fcntl.h>
+#include <stdio.h>
+
+#ifndef RENAME_NOREPLACE
+#define RENAME_NOREPLACE (1<<0)
+#endif
+#ifndef RENAME_EXCHANGE
+#define RENAME_EXCHANGE (1<<1)
+#endif
+
+// the directory of control files, see README, and the inode number of
+// that directory. its files are numbered on from there, above any inode
+#define RAMDISK_CTLDIR "/.ramdisk"
+#define RAMDISK_CTLINO ((1UL<<26)+1)
+
+// where the disk logs, see loglevel. a call that fails for a reason the
+// errno alone does not tell logs it there at the error level
+#define RAMDISK_LOGFILE "/tmp/ramdisk.log"
+
+typedef unsigned long rd_ino_t;
+#define RD_ROOT_INO 1
+
+// disk options, the daemon's -o options of the same names
+struct ramdisk_config {
+	long blocksize;
+	int loglevel;		// off, error, info, trace as 0 to 3, -1 to keep the level, which is per process
+	long maxsize;		// MB, 0 for the disk size
+	long keepfree;		// MB
+	long flush;		// ms between journal flushes, 0 for fsync only
+	long checkpoint;	// s between checkpoints, 0 for unmount only
+	long journalmax;	// MB of journal that forces a checkpoint
+	int snapshot;		// a new image file is a snapshot
+	long snapthreads;	// 0 for one per CPU
+	long compress;		// s a block stays untouched before it is compressed, 0 for off
+	long compressratio;	// percent
+	long compresshigh;	// percent
+	int dedup;		// share blocks with the same bytes
+	int copy;		// large stores into blocks : auto, libc, sse2, avx2 as 0 to 3
+};
+
+struct ramdisk;
+
+// readdir calls it once per entry, under a lock of the disk it must not
+// call back into. st may be NULL, or give only st_ino and the type bits
+// of st_mode. a non zero return stops the listing
+typedef int (*rd_filler_t)(void *arg, const char *name, const struct stat *st);
+// rd_pwrite_with calls it to fill len bytes at dst, returns what it
+// filled or -errno. the same rule applies
+typedef ssize_t (*rd_source_t)(void *arg, void *dst, size_t len);
+
+void rd_config_init(struct ramdisk_config *config);
+// take one "name" or "name=value" option : 0 when taken, 1 when it is not
+// a disk option, -EINVAL when its value is not a number
+int rd_config_set(struct ramdisk_config *config, const char *option);
+
+// a disk of size bytes, loaded from image when the file exists and saved
+// to it from then on. nothing runs in the background until rd_start, so
+// a process can fork in between. rd_free saves the disk when it has an
+// image and frees it
+int rd_new(struct ramdisk **rd, long size, const char *image, const struct ramdisk_config *config);
+int rd_start(struct ramdisk *rd);
+void rd_free(struct ramdisk *rd);
+
+int rd_open(struct ramdisk *rd, const char *path, int flags, mode_t mode);
+int rd_close(struct ramdisk *rd, int fd);
+ssize_t rd_read(struct ramdisk *rd, int fd, void *buf, size_t size);
+ssize_t rd_write(struct ramdisk *rd, int fd, const void *buf, size_t size);
+ssize_t rd_pread(struct ramdisk *rd, int fd, void *buf, size_t size, off_t offset);
+ssize_t rd_pwrite(struct ramdisk *rd, int fd, const void *buf, size_t size, off_t offset);
+off_t rd_lseek(struct ramdisk *rd, int fd, off_t offset, int whence);
+int rd_fstat(struct ramdisk *rd, int fd, struct stat *st);
+int rd_ftruncate(struct ramdisk *rd, int fd, off_t length);
+int rd_fallocate(struct ramdisk *rd, int fd, int mode, off_t offset, off_t length);
+int rd_fsync(struct ramdisk *rd, int fd);
+
+int rd_stat(struct ramdisk *rd, const char *path, struct stat *st);
+int rd_access(struct ramdisk *rd, const char *path, int mask);
+int rd_truncate(struct ramdisk *rd, const char *path, off_t length);
+int rd_mkdir(struct ramdisk *rd, const char *path, mode_t mode);
+int rd_rmdir(struct ramdisk *rd, const char *path);
+int rd_unlink(struct ramdisk *rd, const char *path);
+int rd_rename(struct ramdisk *rd, const char *from, const char *to);
+int rd_readdir(struct ramdisk *rd, const char *path, rd_filler_t filler, void *arg);
+int rd_statfs(struct ramdisk *rd, struct statvfs *st);
+int rd_sync(struct ramdisk *rd);
+
+// inodes carry mode, owner and times of their own. uid or gid -1 keeps
+// it and times NULL sets both to now. no call checks a permission or
+// follows a symlink, that is left to the caller, as the kernel does it
+// for the daemon. rd_readlink gives the target without a NUL
+int rd_chmod(struct ramdisk *rd, const char *path, mode_t mode);
+int rd_chown(struct ramdisk *rd, const char *path, uid_t uid, gid_t gid);
+int rd_utimens(struct ramdisk *rd, const char *path, const struct timespec times[2]);
+int rd_link(struct ramdisk *rd, const char *from, const char *to);
+int rd_symlink(struct ramdisk *rd, const char *target, const char *path);
+ssize_t rd_readlink(struct ramdisk *rd, const char *path, char *buf, size_t size);
+// what the calling thread creates from now on is owned by uid and gid,
+// -1 for the owner of the disk, the process that made it
+void rd_creds(uid_t uid, gid_t gid);
+
+// for a server that moves data by descriptor : rd_splice splices size
+// bytes at offset, or those up to the end of file, into the pipe pipeFd
+// and returns how many. -EOPNOTSUPP when the disk is not in a memfd,
+// -EIO when part of it is a hole or the pipe took less, which leaves the
+// pipe holding part of it. rd_pwrite_with writes size bytes at offset
+// straight into the blocks, as many calls to source as it takes
+ssize_t rd_splice(struct ramdisk *rd, int fd, int pipeFd, size_t size, off_t offset);
+ssize_t rd_pwrite_with(struct ramdisk *rd, int fd, size_t size, off_t offset, rd_source_t source, void *arg);
+
+// for a server keyed by inode number, such as the daemon's low-level
+// backend : entries are a directory's inode and one name, and no path is
+// ever resolved. st_ino of a stat is the inode number. rd_lookup, and
+// rd_openat and rd_mkdirat when given st, take a lookup reference on the
+// entry they return and rd_forget drops n of them. an entry removed while
+// referenced keeps its number until the last reference and descriptor on
+// it are gone, so a number is never reused under its holder
+int rd_lookup(struct ramdisk *rd, rd_ino_t dir, const char *name, struct stat *st);
+void rd_forget(struct ramdisk *rd, rd_ino_t ino, unsigned long n);
+int rd_stat_ino(struct ramdisk *rd, rd_ino_t ino, struct stat *st);
+int rd_truncate_ino(struct ramdisk *rd, rd_ino_t ino, off_t length);
+int rd_open_ino(struct ramdisk *rd, rd_ino_t ino, int flags);
+int rd_openat(struct ramdisk *rd, rd_ino_t dir, const char *name, int flags, mode_t mode, struct stat *st);
+int rd_mkdirat(struct ramdisk *rd, rd_ino_t dir, const char *name, mode_t mode, struct stat *st);
+// AT_REMOVEDIR in flags for rmdir
+int rd_unlinkat(struct ramdisk *rd, rd_ino_t dir, const char *name, int flags);
+// flags as renameat2 takes them : RENAME_NOREPLACE fails with -EEXIST
+// rather than replace newname, RENAME_EXCHANGE swaps the two entries,
+// which both exist. a directory moves in constant time whatever it holds
+int rd_renameat(struct ramdisk *rd, rd_ino_t olddir, const char *oldname, rd_ino_t newdir, const char *newname, int flags);
+int rd_readdir_ino(struct ramdisk *rd, rd_ino_t ino, rd_filler_t filler, void *arg);
+int rd_chmod_ino(struct ramdisk *rd, rd_ino_t ino, mode_t mode);
+int rd_chown_ino(struct ramdisk *rd, rd_ino_t ino, uid_t uid, gid_t gid);
+int rd_utimens_ino(struct ramdisk *rd, rd_ino_t ino, const struct timespec times[2]);
+// st of the file ino, now with one more link
+int rd_linkat(struct ramdisk *rd, rd_ino_t ino, rd_ino_t newdir, const char *newname, struct stat *st);
+int rd_symlinkat(struct ramdisk *rd, const char *target, rd_ino_t dir, const char *name, struct stat *st);
+ssize_t rd_readlink_ino(struct ramdisk *rd, rd_ino_t ino, char *buf, size_t size);
+
+// for a server that lets the kernel cache the disk, or keeps a cache of
+// its own, while something else changes it : the notifier is told of
+// every change made by a call on a thread other than those rd_serve
+// marked as the server's, NULL for none. it is called under a lock of the
+// disk, so it only takes note and acts from another thread
+struct rd_notifier {
+	// what is cached of ino from offset for length bytes, 0 for up to the
+	// end, and its attributes are stale. offset -1 for the attributes alone
+	void (*inode)(void *arg, rd_ino_t ino, off_t offset, off_t length);
+	// the entry name, len bytes not NUL terminated, of directory dir now
+	// names something else or nothing
+	void (*entry)(void *arg, rd_ino_t dir, const char *name, size_t len);
+};
+void rd_notify(struct ramdisk *rd, const struct rd_notifier *notifier, void *arg);
+// the calling thread serves rd from now on, NULL to stop
+void rd_serve(struct ramdisk *rd);
+
+#endif